@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wreath
+{
+    constexpr size_t kArenaAlignment{32}; // The Cortex-M7 cache line
+
+    /**
+     * @brief A simple arena allocator over a block of memory (usually the
+     * SDRAM). Memory is carved in sequence and it's only given back all at
+     * once, with Reset(). Nothing is ever freed, so it's meant to be used at
+     * initialization time only.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    class Arena
+    {
+    public:
+        Arena() {}
+        ~Arena() {}
+
+        /**
+         * @brief Initializes the arena over the given memory.
+         *
+         * @param memory
+         * @param size The size of the memory, in bytes
+         */
+        void Init(void *memory, size_t size)
+        {
+            memory_ = static_cast<uint8_t *>(memory);
+            size_ = size;
+            Reset();
+        }
+
+        /**
+         * @brief Allocates an array of the given number of elements.
+         *
+         * @param count
+         * @return T* The array, or nullptr if there's not enough memory left
+         */
+        template <typename T>
+        T *Allocate(size_t count)
+        {
+            size_t offset = Align(used_);
+            if (offset > size_ || count > (size_ - offset) / sizeof(T))
+            {
+                return nullptr;
+            }
+            used_ = offset + count * sizeof(T);
+
+            return reinterpret_cast<T *>(memory_ + offset);
+        }
+
+        /**
+         * @brief Returns how many elements of the given type can still be
+         * allocated in a single array.
+         *
+         * @return size_t
+         */
+        template <typename T>
+        size_t Available()
+        {
+            size_t offset = Align(used_);
+
+            return offset < size_ ? (size_ - offset) / sizeof(T) : 0;
+        }
+
+        /**
+         * @brief Gives back all the memory. The arrays allocated before must
+         * not be used anymore.
+         */
+        void Reset()
+        {
+            used_ = 0;
+        }
+
+        inline size_t GetSize() { return size_; }
+        inline size_t GetUsed() { return used_; }
+
+    private:
+        uint8_t *memory_{};
+        size_t size_{};
+        size_t used_{};
+
+        inline size_t Align(size_t offset)
+        {
+            return (offset + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+        }
+    };
+} // namespace wreath
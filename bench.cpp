@@ -0,0 +1,173 @@
+#include "stereo_looper.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using namespace wreath;
+
+constexpr int32_t sampleRate = 48000;
+constexpr int32_t warmupSamples = sampleRate / 10;
+constexpr int32_t benchSamples = sampleRate * 10;
+constexpr float tinyLoopSamples = 1000.f;         // Flanger range
+constexpr int32_t tinyBufferSamples = sampleRate; // Buffered for the tiny loops
+
+struct Scenario
+{
+    std::string desc{};
+    StereoLooper::Mode mode{};
+    Movement movement{};
+    Direction direction{};
+    float readRate{};
+    float writeRate{};
+    bool tinyLoop{};
+    float feedback{};
+    float freeze{};
+    float degradation{};
+};
+
+static Scenario scenarios[] =
+{
+    { "baseline", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.f, 0.f },
+    { "cross", StereoLooper::Mode::CROSS, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.f, 0.f },
+    { "dual", StereoLooper::Mode::DUAL, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.f, 0.f },
+    { "pendulum", StereoLooper::Mode::MONO, Movement::PENDULUM, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.f, 0.f },
+    { "drunk", StereoLooper::Mode::MONO, Movement::DRUNK, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.f, 0.f },
+    { "backwards", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::BACKWARDS, 1.f, 1.f, false, 0.f, 0.f, 0.f },
+    { "fractional-read", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.37f, 1.f, false, 0.f, 0.f, 0.f },
+    { "fractional-write", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 0.63f, false, 0.f, 0.f, 0.f },
+    { "fractional-both", StereoLooper::Mode::DUAL, Movement::NORMAL, Direction::BACKWARDS, 0.71f, 1.29f, false, 0.f, 0.f, 0.f },
+    { "tiny", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, true, 0.f, 0.f, 0.f },
+    { "tiny-pendulum", StereoLooper::Mode::MONO, Movement::PENDULUM, Direction::FORWARD, 1.37f, 1.f, true, 0.f, 0.f, 0.f },
+    { "tiny-backwards", StereoLooper::Mode::DUAL, Movement::NORMAL, Direction::BACKWARDS, 0.71f, 1.f, true, 0.f, 0.f, 0.f },
+    { "feedback", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.7f, 0.f, 0.f },
+    { "freeze-partial", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.5f, 0.f },
+    { "freeze-full", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.f, 1.f, 0.f },
+    { "degradation", StereoLooper::Mode::MONO, Movement::NORMAL, Direction::FORWARD, 1.f, 1.f, false, 0.f, 0.f, 0.6f },
+    { "everything", StereoLooper::Mode::DUAL, Movement::PENDULUM, Direction::BACKWARDS, 1.37f, 0.63f, false, 0.7f, 0.5f, 0.6f },
+    { "everything-tiny", StereoLooper::Mode::DUAL, Movement::PENDULUM, Direction::BACKWARDS, 1.37f, 0.63f, true, 0.7f, 0.5f, 0.6f },
+};
+
+const char *MapMode(StereoLooper::Mode mode)
+{
+    switch (mode)
+    {
+    case StereoLooper::Mode::MONO:
+        return "mono";
+    case StereoLooper::Mode::CROSS:
+        return "cross";
+    case StereoLooper::Mode::DUAL:
+        return "dual";
+    default:
+        return "";
+    }
+}
+
+const char *MapMovement(Movement movement)
+{
+    switch (movement)
+    {
+    case Movement::NORMAL:
+        return "normal";
+    case Movement::PENDULUM:
+        return "pendulum";
+    case Movement::DRUNK:
+        return "drunk";
+    default:
+        return "";
+    }
+}
+
+// The input is precomputed, so that only the processing is measured.
+float leftInput[sampleRate];
+float rightInput[sampleRate];
+
+// Keeps the compiler from optimizing the processing away.
+volatile float sink;
+
+void Process(StereoLooper *looper, int32_t t, float &left, float &right)
+{
+    looper->Process(leftInput[t % sampleRate], rightInput[t % sampleRate], left, right);
+}
+
+int main()
+{
+    for (int32_t t = 0; t < sampleRate; t++)
+    {
+        leftInput[t] = std::sin(t * 0.01f) * 0.5f;
+        rightInput[t] = std::sin(t * 0.013f) * 0.5f;
+    }
+
+    std::printf("scenario,mode,movement,direction,read_rate,write_rate,loop_samples,feedback,freeze,degradation,ns_per_sample,samples_per_sec\n");
+
+    for (Scenario scenario : scenarios)
+    {
+        StereoLooper *looper = new StereoLooper();
+        looper->Init(sampleRate, {scenario.mode, scenario.movement, scenario.direction, 1.f, 1});
+
+        // Go through the startup and fill the buffer, the whole of it unless
+        // the loop is a tiny one.
+        int32_t t{};
+        float left{};
+        float right{};
+        while (!looper->IsBuffering())
+        {
+            looper->Process(0.f, 0.f, left, right);
+        }
+        while (looper->IsBuffering())
+        {
+            if (scenario.tinyLoop && t == tinyBufferSamples)
+            {
+                looper->StopBuffering();
+            }
+            Process(looper, t, left, right);
+            t++;
+        }
+
+        looper->Start();
+        if (scenario.tinyLoop)
+        {
+            looper->SetLoopLength(StereoLooper::BOTH, tinyLoopSamples);
+        }
+        looper->SetReadRate(StereoLooper::BOTH, scenario.readRate);
+        looper->SetWriteRate(StereoLooper::BOTH, scenario.writeRate);
+        looper->SetFreeze(StereoLooper::BOTH, scenario.freeze);
+        looper->SetDegradation(scenario.degradation);
+        looper->feedback = scenario.feedback;
+
+        float sum{};
+        for (int32_t i = 0; i < warmupSamples; i++, t++)
+        {
+            Process(looper, t, left, right);
+            sum += left + right;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t i = 0; i < benchSamples; i++, t++)
+        {
+            Process(looper, t, left, right);
+            sum += left + right;
+        }
+        auto end = std::chrono::steady_clock::now();
+        sink = sum;
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / benchSamples;
+        std::printf("%s,%s,%s,%s,%g,%g,%.0f,%g,%g,%g,%.2f,%.0f\n",
+                    scenario.desc.c_str(),
+                    MapMode(scenario.mode),
+                    MapMovement(scenario.movement),
+                    Direction::FORWARD == scenario.direction ? "forward" : "backwards",
+                    scenario.readRate,
+                    scenario.writeRate,
+                    scenario.tinyLoop ? tinyLoopSamples : static_cast<float>(looper->GetBufferSamples(StereoLooper::LEFT)),
+                    scenario.feedback,
+                    scenario.freeze,
+                    scenario.degradation,
+                    ns,
+                    1e9 / ns);
+
+        delete looper;
+    }
+
+    return 0;
+}
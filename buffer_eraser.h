@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace wreath
+{
+    constexpr int32_t kMaxErasePages{4096};
+    constexpr int32_t kMinErasePageShift{8}; // 256 samples
+    constexpr int32_t kEraseFactor{64};      // Samples erased per sample processed
+
+    /**
+     * @brief Clears the looper buffer without stalling the audio callback.
+     * When started, the whole buffer is logically empty right away: the pages
+     * not yet erased read as silence. The actual zeroing is made a bounded
+     * amount per block, starting where the writing head is and going ahead of
+     * it, and the writing head erases a page before writing in it.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T>
+    class BufferEraser
+    {
+    public:
+        BufferEraser() {}
+        ~BufferEraser() {}
+
+        /**
+         * @brief Initializes the eraser.
+         *
+         * @param buffer The looper buffer
+         * @param maxSamples The whole buffer length
+         * @param stride The distance between two consecutive samples in the
+         * buffer
+         */
+        void Init(T *buffer, int32_t maxSamples, int32_t stride = 1)
+        {
+            buffer_ = buffer;
+            maxSamples_ = maxSamples;
+            stride_ = stride;
+            pageShift_ = kMinErasePageShift;
+            while (maxSamples_ > 0 && ((maxSamples_ - 1) >> pageShift_) + 1 > kMaxErasePages)
+            {
+                pageShift_++;
+            }
+            pages_ = maxSamples_ > 0 ? ((maxSamples_ - 1) >> pageShift_) + 1 : 0;
+            erasedPages_ = pages_;
+        }
+
+        /**
+         * @brief Starts erasing the buffer.
+         *
+         * @param from Where to start erasing from, usually the writing head
+         */
+        void Start(int32_t from)
+        {
+            if (!pages_)
+            {
+                return;
+            }
+            memset(pending_, 0xff, sizeof(pending_));
+            erasedPages_ = 0;
+            cursor_ = from >= 0 && from < maxSamples_ ? from >> pageShift_ : 0;
+            credit_ = 0;
+        }
+
+        /**
+         * @brief Erases the next pages, for the given number of processed
+         * samples. Call this once per block.
+         *
+         * @param samples
+         */
+        void Erase(int32_t samples)
+        {
+            if (!IsErasing())
+            {
+                return;
+            }
+
+            credit_ += samples * kEraseFactor;
+            int32_t pageSamples = 1 << pageShift_;
+            while (credit_ >= pageSamples && IsErasing())
+            {
+                while (!IsPendingPage(cursor_))
+                {
+                    cursor_ = cursor_ + 1 < pages_ ? cursor_ + 1 : 0;
+                }
+                ErasePage(cursor_);
+                credit_ -= pageSamples;
+            }
+            if (!IsErasing())
+            {
+                credit_ = 0;
+            }
+        }
+
+        /**
+         * @brief Tells whether the sample at the given index is yet to be
+         * erased, in which case it must be read as silence.
+         *
+         * @param index
+         * @return true
+         * @return false
+         */
+        inline bool IsPending(int32_t index) const
+        {
+            return IsErasing() && IsPendingPage(index >> pageShift_);
+        }
+
+        /**
+         * @brief Makes sure that the sample at the given index has been
+         * erased, call this before writing in the buffer.
+         *
+         * @param index
+         */
+        inline void Prepare(int32_t index)
+        {
+            if (IsPending(index))
+            {
+                ErasePage(index >> pageShift_);
+            }
+        }
+
+        inline bool IsErasing() const { return erasedPages_ < pages_; }
+
+    private:
+        T *buffer_{};
+        int32_t maxSamples_{}; // The whole buffer length
+        int32_t stride_{1};    // Distance between consecutive samples in the buffer
+        int32_t pageShift_{kMinErasePageShift};
+        int32_t pages_{};
+        int32_t erasedPages_{};
+        int32_t cursor_{}; // Next page to be erased
+        int32_t credit_{}; // Samples that can be erased
+        uint32_t pending_[kMaxErasePages / 32]{};
+
+        inline bool IsPendingPage(int32_t page) const
+        {
+            return pending_[page >> 5] & (1u << (page & 31));
+        }
+
+        void ErasePage(int32_t page)
+        {
+            int32_t start = page << pageShift_;
+            int32_t end = start + (1 << pageShift_) < maxSamples_ ? start + (1 << pageShift_) : maxSamples_;
+            if (stride_ > 1)
+            {
+                for (int32_t i = start; i < end; i++)
+                {
+                    buffer_[i * stride_] = T{};
+                }
+            }
+            else
+            {
+                memset(buffer_ + start, 0, (end - start) * sizeof(T));
+            }
+            pending_[page >> 5] &= ~(1u << (page & 31));
+            erasedPages_++;
+        }
+    };
+} // namespace wreath
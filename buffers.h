@@ -0,0 +1,59 @@
+#pragma once
+
+#include "arena.h"
+#include "interpolation.h"
+#include "dev/sdram.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace wreath
+{
+    // Define WREATH_INT16_BUFFERS to store the samples in 16 bit, doubling
+    // the maximum loop length.
+#ifdef WREATH_INT16_BUFFERS
+    using BufferSample = int16_t;
+#else
+    using BufferSample = float;
+#endif
+
+    // Define either WREATH_INTERPOLATION_NONE or WREATH_INTERPOLATION_HERMITE
+    // to change the interpolation used when reading at fractional positions.
+#if defined(WREATH_INTERPOLATION_NONE)
+    using BufferInterpolation = NoInterpolation;
+#elif defined(WREATH_INTERPOLATION_HERMITE)
+    using BufferInterpolation = HermiteInterpolation;
+#else
+    using BufferInterpolation = LinearInterpolation;
+#endif
+
+    // The supported sample rates. The buffers are sized in seconds and the
+    // time constants are resolved against the rate passed to Init(), so the
+    // same SDRAM holds twice the loop time at half the rate, and each second
+    // costs half the CPU. 24KHz and 32KHz are the economy modes, 96KHz is for
+    // when there's the headroom for it.
+    constexpr int32_t kSampleRateEconomy{24000};
+    constexpr int32_t kSampleRateLow{32000};
+    constexpr int32_t kSampleRateStandard{48000};
+    constexpr int32_t kSampleRateHigh{96000};
+
+    constexpr size_t kSdramBytes{61440000}; // 4 buffers of 1:20 minutes @ 48KHz, in float
+
+    /**
+     * @brief Returns the longest buffer that fits in SDRAM at the given
+     * sample rate, with four buffers (two channels and their freeze
+     * buffers). That's 1:20 minutes @ 48KHz in float, 2:40 minutes at 24KHz
+     * or in 16 bit.
+     *
+     * @param sampleRate
+     * @return constexpr float The seconds
+     */
+    constexpr float MaxBufferSeconds(int32_t sampleRate)
+    {
+        return static_cast<float>(kSdramBytes / (4 * sizeof(BufferSample))) / sampleRate;
+    }
+
+    // The memory the buffers are carved from, see StereoLooper::Init() and
+    // MultiLooper::Init().
+    alignas(kArenaAlignment) uint8_t DSY_SDRAM_BSS sdramMemory_[kSdramBytes];
+    Arena sdramArena_;
+} // namespace wreath
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace wreath
+{
+    /**
+     * @brief A wait-free single-producer single-consumer ring buffer, used to
+     * send commands from the control code to the audio callback. Only one
+     * thread may push and only one thread may pop.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T, size_t kSize>
+    class CommandQueue
+    {
+        static_assert(kSize > 0 && (kSize & (kSize - 1)) == 0, "The queue size must be a power of two");
+
+    public:
+        CommandQueue() {}
+        ~CommandQueue() {}
+
+        /**
+         * @brief Pushes an item in the queue. Call this from the producer side
+         * only.
+         *
+         * @param item
+         * @return true
+         * @return false if the queue is full and the item has been dropped
+         */
+        bool Push(const T &item)
+        {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head - tail_.load(std::memory_order_acquire) >= kSize)
+            {
+                return false;
+            }
+
+            items_[head & (kSize - 1)] = item;
+            head_.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * @brief Pops the oldest item from the queue. Call this from the
+         * consumer side only.
+         *
+         * @param item
+         * @return true
+         * @return false if the queue is empty
+         */
+        bool Pop(T &item)
+        {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail == head_.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            item = items_[tail & (kSize - 1)];
+            tail_.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * @brief Copies the oldest item without popping it, so that the
+         * consumer may leave it in the queue. Call this from the consumer side
+         * only.
+         *
+         * @param item
+         * @return true
+         * @return false if the queue is empty
+         */
+        bool Peek(T &item)
+        {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail == head_.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            item = items_[tail & (kSize - 1)];
+
+            return true;
+        }
+
+        bool IsEmpty() { return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire); }
+
+    private:
+        T items_[kSize];
+        std::atomic<size_t> head_{0}; // Written by the producer only
+        std::atomic<size_t> tail_{0}; // Written by the consumer only
+    };
+
+    /**
+     * @brief The latest values of a set of parameters, sent from the control
+     * code to the audio callback. Unlike a queue it never fills up: a value
+     * set again before the callback took it replaces the previous one, and
+     * only the slots set since the last take are reported as changed. Only
+     * one thread may set and only one thread may take.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <size_t kCount>
+    class LatestValues
+    {
+        static_assert(kCount > 0 && kCount <= 32, "The changed slots must fit in 32 bits");
+
+    public:
+        LatestValues() {}
+        ~LatestValues() {}
+
+        /**
+         * @brief Sets the values of the slots in the given mask, all to the
+         * same value and seen as changed together. Call this from the
+         * producer side only.
+         *
+         * @param slots
+         * @param value
+         */
+        void Set(uint32_t slots, float value)
+        {
+            for (size_t i = 0; i < kCount; i++)
+            {
+                if (slots & (1u << i))
+                {
+                    values_[i].store(value, std::memory_order_relaxed);
+                }
+            }
+            changed_.fetch_or(slots, std::memory_order_release);
+        }
+
+        /**
+         * @brief Returns the mask of the slots set since the last call and
+         * clears it. Call this from the consumer side only, then read the
+         * values with Get(). A slot set again in between is just reported
+         * once more the next time.
+         *
+         * @return uint32_t
+         */
+        uint32_t TakeChanged()
+        {
+            return changed_.exchange(0, std::memory_order_acquire);
+        }
+
+        float Get(size_t slot) { return values_[slot].load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<float> values_[kCount]{};
+        std::atomic<uint32_t> changed_{0};
+    };
+} // namespace wreath
@@ -11,36 +11,55 @@ namespace wreath
     class EnvFollow
     {
     private:
-        float avg;         // exp average of input
-        float pos_sample;  // positive sample
-        float sample_noDC; // no DC sample
-        float avg_env;     // average envelope
-        float w;           // weighting
-        float w_env;       // envelope weighting
+        static constexpr float kWeightingPerSecond{4.8f}; // 0.0001 per sample @ 48KHz
+
+        float avg;     // exp average of input
+        float avg_env; // average envelope
+        float w;       // weighting
+        float w_env;   // envelope weighting
 
     public:
         EnvFollow() // default constructor
         {
-            avg = 0.0f;        // exp average of input
-            pos_sample = 0.0f; // positive sample
-            avg_env = 0.0f;    // average envelope
-            w = 0.0001f;       // weighting
-            w_env = 0.0001f;   // envelope weighting
-            sample_noDC = 0.0f;
+            avg = 0.0f;      // exp average of input
+            avg_env = 0.0f;  // average envelope
+            w = 0.0001f;     // weighting
+            w_env = 0.0001f; // envelope weighting
         }
         ~EnvFollow() {}
 
-        float GetEnv(float sample)
+        /**
+         * @brief Resolves the weightings against the sample rate, so that the
+         * envelope has the same time constant at any rate (the defaults are
+         * meant for 48KHz).
+         *
+         * @param sampleRate
+         */
+        void Init(float sampleRate)
         {
-            // remove average DC offset:
-            avg = (w * sample) + ((1 - w) * avg);
-            sample_noDC = sample - avg;
+            avg = 0.0f;
+            avg_env = 0.0f;
+            w = kWeightingPerSecond / sampleRate;
+            w_env = kWeightingPerSecond / sampleRate;
+        }
 
-            // take absolute
-            pos_sample = fabsf(sample_noDC);
+        /**
+         * @brief Returns the envelope, given the next sample. The two
+         * averages are one pole filters written as a single multiply-add on
+         * the state, with no branches and no temporaries kept in the object,
+         * so that the envelopes of more channels updated side by side can be
+         * vectorized.
+         *
+         * @param sample
+         * @return float
+         */
+        inline float GetEnv(float sample)
+        {
+            // remove average DC offset:
+            avg += w * (sample - avg);
 
-            // remove ripple
-            avg_env = (w_env * pos_sample) + ((1 - w_env) * avg_env);
+            // take absolute and remove ripple
+            avg_env += w_env * (fabsf(sample - avg) - avg_env);
 
             return avg_env;
         }
@@ -1,12 +1,50 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 
 namespace wreath
 {
-    constexpr float kSamplesToFade{48.f * 100};       // 100ms @ 48KHz
-    constexpr float kSamplesToFadeTrigger{48.f * 10}; // 10ms @ 48KHz
+    constexpr float kFadeSeconds{0.1f};         // 100ms, see Timing
+    constexpr float kFadeTriggerSeconds{0.01f}; // 10ms
     constexpr float kEqualCrossFadeP{1.25f};
+    constexpr int32_t kFadeTableSize{256};
+
+    /**
+     * @brief The gain of the incoming source of the energy preserving
+     * crossfade, at the given position (see Fader::EqualCrossFade()).
+     *
+     * @param pos
+     * @return float
+     */
+    constexpr float EqualCrossFadeGain(float pos)
+    {
+        float k = -6.0026608f + kEqualCrossFadeP * (6.8773512f - 1.5838104f * kEqualCrossFadeP);
+        float a = pos * (1.f - pos);
+        float c = a * (1.f + k * a) + pos;
+
+        return c * c;
+    }
+
+    /**
+     * @brief The energy preserving crossfade gains, generated at compile time.
+     * The extra point is the guard for the interpolation at the end.
+     */
+    struct FadeTable
+    {
+        float gains[kFadeTableSize + 1];
+
+        constexpr FadeTable() : gains{}
+        {
+            for (int32_t i = 0; i <= kFadeTableSize; i++)
+            {
+                gains[i] = EqualCrossFadeGain(static_cast<float>(i) / kFadeTableSize);
+            }
+        }
+    };
+
+    constexpr FadeTable kFadeTable{};
 
     /**
      * @brief Handles different types of cross-fading between two sources.
@@ -33,6 +71,20 @@ namespace wreath
             ENDED,
         };
 
+        /**
+         * @brief How the gains of the crossfade are calculated.
+         * POLYNOMIAL evaluates EqualCrossFade() at each sample, TABLE reads the
+         * same curve from a precomputed table and INCREMENTAL steps the gains
+         * of the equal-power sine curve of CrossFade() with a rotation, which
+         * is the cheapest.
+         */
+        enum class FadeCurve
+        {
+            POLYNOMIAL,
+            TABLE,
+            INCREMENTAL,
+        };
+
         /**
          * @brief Resets a fader that had already been initialised.
          *
@@ -47,6 +99,12 @@ namespace wreath
             status_ = FadeStatus::PENDING;
             index_ = 0;
             toggle_ = false;
+
+            // The gains rotate by a fixed angle at each sample.
+            float step = rate_ * freq_ * 1.570796326794897f;
+            stepCos_ = std::cos(step);
+            stepSin_ = std::sin(step);
+            ResetGains();
         }
 
         /**
@@ -56,7 +114,7 @@ namespace wreath
          * @param samples
          * @param rate
          */
-        void Init(FadeType type = FadeType::FADE_SINGLE, float samples = kSamplesToFade, float rate = 1.f)
+        void Init(FadeType type, float samples, float rate = 1.f)
         {
             if (FadeStatus::CREATED == status_ || FadeStatus::ENDED == status_)
             {
@@ -115,6 +173,30 @@ namespace wreath
             return from * d * d + to * c * c;
         }
 
+        /**
+         * @brief Energy preserving crossfade, reading the gains from the
+         * precomputed table.
+         *
+         * @param from
+         * @param to
+         * @param pos
+         * @return float
+         */
+        static float TableCrossFade(float from, float to, float pos)
+        {
+            return from * TableGain(1.f - pos) + to * TableGain(pos);
+        }
+
+        /**
+         * @brief Sets how the gains of the crossfade are calculated.
+         *
+         * @param curve
+         */
+        void SetCurve(FadeCurve curve)
+        {
+            curve_ = curve;
+        }
+
         /**
          * @brief Processes the crossfade of the provided inputs.
          *
@@ -144,7 +226,19 @@ namespace wreath
                 from = toInput;
                 to = fromInput;
             }
-            output_ = EqualCrossFade(from, to, index_ * freq_);
+            switch (curve_)
+            {
+            case FadeCurve::TABLE:
+                output_ = TableCrossFade(from, to, index_ * freq_);
+                break;
+            case FadeCurve::INCREMENTAL:
+                output_ = from * outGain_ + to * inGain_;
+                RotateGains();
+                break;
+            default:
+                output_ = EqualCrossFade(from, to, index_ * freq_);
+                break;
+            }
             index_ += rate_;
             if (index_ >= samples_)
             {
@@ -153,6 +247,7 @@ namespace wreath
                     index_ = 0;
                     toggle_ = true;
                     type_ = FadeType::FADE_SINGLE;
+                    ResetGains();
                 }
                 else
                 {
@@ -165,6 +260,36 @@ namespace wreath
             return status_;
         }
 
+        /**
+         * @brief Processes the crossfade of a block of inputs. Outside of the
+         * fade the output is the source the fader rests on: the "from" input
+         * until it starts and the "to" input once it's ended (the "from" input
+         * again after a fade out-in).
+         *
+         * @param from
+         * @param to
+         * @param out
+         * @param size
+         * @return FadeStatus The status at the end of the block
+         */
+        FadeStatus ProcessBlock(const float *from, const float *to, float *out, size_t size)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                if (IsActive())
+                {
+                    Process(from[i], to[i]);
+                    out[i] = output_;
+                }
+                else
+                {
+                    out[i] = FadeStatus::ENDED == status_ && !toggle_ ? to[i] : from[i];
+                }
+            }
+
+            return status_;
+        }
+
         float GetIndex()
         {
             return index_;
@@ -180,7 +305,7 @@ namespace wreath
             return output_;
         }
 
-        bool IsActive()
+        bool IsActive() const
         {
             return FadeStatus::PENDING == status_ || FadeStatus::FADING == status_;
         }
@@ -195,5 +320,46 @@ namespace wreath
         float input_{};
         float output_{};
         bool toggle_{};
+#if defined(WREATH_FADE_TABLE)
+        FadeCurve curve_{FadeCurve::TABLE};
+#elif defined(WREATH_FADE_INCREMENTAL)
+        FadeCurve curve_{FadeCurve::INCREMENTAL};
+#else
+        FadeCurve curve_{FadeCurve::POLYNOMIAL};
+#endif
+        float inGain_{};   // Incremental gain of the "to" input
+        float outGain_{};  // Incremental gain of the "from" input
+        float stepCos_{1.f};
+        float stepSin_{};
+
+        static inline float TableGain(float pos)
+        {
+            float index = pos * kFadeTableSize;
+            int32_t intIndex = static_cast<int32_t>(index);
+            if (intIndex >= kFadeTableSize)
+            {
+                return kFadeTable.gains[kFadeTableSize];
+            }
+            if (intIndex < 0)
+            {
+                return kFadeTable.gains[0];
+            }
+            float frac = index - intIndex;
+
+            return kFadeTable.gains[intIndex] + (kFadeTable.gains[intIndex + 1] - kFadeTable.gains[intIndex]) * frac;
+        }
+
+        inline void ResetGains()
+        {
+            inGain_ = 0.f;
+            outGain_ = 1.f;
+        }
+
+        inline void RotateGains()
+        {
+            float in = inGain_ * stepCos_ + outGain_ * stepSin_;
+            outGain_ = outGain_ * stepCos_ - inGain_ * stepSin_;
+            inGain_ = in;
+        }
     };
 } // namespace wreath
\ No newline at end of file
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "buffer_eraser.h"
+#include "sample_format.h"
+#include <cstdint>
+#include <cstring>
+
+namespace wreath
+{
+    constexpr int32_t kMaxFreezePages{4096};
+    constexpr int32_t kMinFreezePageShift{6}; // 64 samples
+    constexpr int32_t kFreezeCopyFactor{8};   // Samples copied per sample processed
+
+    /**
+     * @brief Holds a snapshot of the looper buffer, taken when freezing. The
+     * copy is made incrementally, a bounded amount per block, starting where
+     * the writing head is. Until a page is copied, the frozen value is still
+     * in the buffer, and the writing head preserves it by copying the page
+     * before overwriting it (copy on write).
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T>
+    class FreezeBuffer
+    {
+    public:
+        FreezeBuffer() {}
+        ~FreezeBuffer() {}
+
+        /**
+         * @brief Initializes the freeze buffer.
+         *
+         * @param buffer The looper buffer
+         * @param eraser The looper buffer's eraser, the samples it has yet to
+         * erase are taken as silence
+         * @param frozen The memory where the snapshot is stored
+         * @param maxFrozenSamples The length of the snapshot memory
+         * @param stride The distance between two consecutive samples in the
+         * looper buffer
+         */
+        void Init(T *buffer, const BufferEraser<T> *eraser, T *frozen, int32_t maxFrozenSamples, int32_t stride = 1)
+        {
+            buffer_ = buffer;
+            eraser_ = eraser;
+            stride_ = stride;
+            frozen_ = frozen;
+            maxFrozenSamples_ = maxFrozenSamples;
+            Release();
+        }
+
+        /**
+         * @brief Starts taking the snapshot. The whole buffer is frozen if it
+         * fits in the snapshot memory, otherwise the loop is (or as much of it
+         * as it fits).
+         *
+         * @param bufferSamples The written buffer length
+         * @param loopStart
+         * @param loopLength
+         * @param from Where to start copying from
+         */
+        void Snapshot(int32_t bufferSamples, int32_t loopStart, int32_t loopLength, int32_t from)
+        {
+            bufferSamples_ = bufferSamples;
+            if (bufferSamples_ <= maxFrozenSamples_)
+            {
+                origin_ = 0;
+                length_ = bufferSamples_;
+            }
+            else
+            {
+                origin_ = loopStart;
+                length_ = std::min(loopLength, maxFrozenSamples_);
+            }
+
+            pageShift_ = kMinFreezePageShift;
+            while (((length_ - 1) >> pageShift_) + 1 > kMaxFreezePages)
+            {
+                pageShift_++;
+            }
+            pages_ = length_ > 0 ? ((length_ - 1) >> pageShift_) + 1 : 0;
+            copiedPages_ = 0;
+            cleared_ = false;
+            memset(copied_, 0, sizeof(copied_));
+
+            int32_t offset = Offset(from);
+            cursor_ = offset < length_ ? offset >> pageShift_ : 0;
+            credit_ = 0;
+        }
+
+        /**
+         * @brief Releases the snapshot.
+         */
+        void Release()
+        {
+            length_ = 0;
+            pages_ = 0;
+            copiedPages_ = 0;
+            cleared_ = false;
+        }
+
+        /**
+         * @brief Copies the next pages of the snapshot, for the given number of
+         * processed samples. Call this once per block.
+         *
+         * @param samples
+         */
+        void Copy(int32_t samples)
+        {
+            if (!IsCopying())
+            {
+                return;
+            }
+
+            credit_ += samples * kFreezeCopyFactor;
+            int32_t pageSamples = 1 << pageShift_;
+            while (credit_ >= pageSamples && IsCopying())
+            {
+                while (IsCopied(cursor_))
+                {
+                    cursor_ = cursor_ + 1 < pages_ ? cursor_ + 1 : 0;
+                }
+                CopyPage(cursor_);
+                credit_ -= pageSamples;
+            }
+            if (!IsCopying())
+            {
+                credit_ = 0;
+            }
+        }
+
+        /**
+         * @brief Reads the frozen value at the given buffer index. Outside of
+         * the snapshot (when only the loop fits) the live value is returned.
+         *
+         * @param index
+         * @return float
+         */
+        float Read(int32_t index)
+        {
+            int32_t offset = Offset(index);
+            if (offset < length_ && (cleared_ || IsCopied(offset >> pageShift_)))
+            {
+                return cleared_ ? 0.f : SampleFormat<T>::Load(frozen_[offset]);
+            }
+
+            return SampleFormat<T>::Load(Live(index));
+        }
+
+        /**
+         * @brief Writes the given value in the snapshot, used to fade the
+         * recording when freezing.
+         *
+         * @param index
+         * @param value
+         */
+        void Write(int32_t index, float value)
+        {
+            int32_t offset = Offset(index);
+            if (offset < length_ && !cleared_)
+            {
+                Preserve(index);
+                frozen_[offset] = SampleFormat<T>::Store(value);
+            }
+        }
+
+        /**
+         * @brief Makes sure that the frozen value at the given index is in the
+         * snapshot, call this before overwriting the buffer.
+         *
+         * @param index
+         */
+        inline void Preserve(int32_t index)
+        {
+            if (!IsCopying())
+            {
+                return;
+            }
+
+            int32_t offset = Offset(index);
+            if (offset < length_ && !IsCopied(offset >> pageShift_))
+            {
+                CopyPage(offset >> pageShift_);
+            }
+        }
+
+        /**
+         * @brief Clears the snapshot, which then reads as silence until the
+         * next one is taken.
+         */
+        void Clear()
+        {
+            if (length_)
+            {
+                cleared_ = true;
+                copiedPages_ = pages_;
+            }
+        }
+
+        inline bool IsCopying() { return copiedPages_ < pages_; }
+        inline int32_t GetMaxSamples() { return maxFrozenSamples_; }
+
+    private:
+        T *buffer_{};
+        const BufferEraser<T> *eraser_{};
+        T *frozen_{};
+        int32_t stride_{1};          // Distance between consecutive samples in the buffer
+        int32_t maxFrozenSamples_{}; // The snapshot memory length
+        int32_t bufferSamples_{};    // The written buffer length
+        int32_t origin_{};           // Buffer index of the snapshot start
+        int32_t length_{};           // Length of the snapshot
+        int32_t pageShift_{kMinFreezePageShift};
+        int32_t pages_{};
+        int32_t copiedPages_{};
+        int32_t cursor_{}; // Next page to be copied
+        int32_t credit_{}; // Samples that can be copied
+        bool cleared_{};   // Whether the snapshot has been cleared
+        uint32_t copied_[kMaxFreezePages / 32]{};
+
+        inline T Live(int32_t index)
+        {
+            return eraser_->IsPending(index) ? T{} : buffer_[index * stride_];
+        }
+
+        inline int32_t Offset(int32_t index)
+        {
+            int32_t offset = index - origin_;
+
+            return offset < 0 ? offset + bufferSamples_ : offset;
+        }
+
+        inline bool IsCopied(int32_t page)
+        {
+            return copied_[page >> 5] & (1u << (page & 31));
+        }
+
+        void CopyPage(int32_t page)
+        {
+            int32_t start = page << pageShift_;
+            int32_t end = std::min(start + (1 << pageShift_), length_);
+            int32_t index = origin_ + start;
+            if (index >= bufferSamples_)
+            {
+                index -= bufferSamples_;
+            }
+            for (int32_t offset = start; offset < end; offset++)
+            {
+                frozen_[offset] = Live(index);
+                if (++index >= bufferSamples_)
+                {
+                    index = 0;
+                }
+            }
+            copied_[page >> 5] |= 1u << (page & 31);
+            copiedPages_++;
+        }
+    };
+} // namespace wreath
@@ -0,0 +1,394 @@
+#include "script.h"
+#include "stereo_looper.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Golden output regression suite: renders a set of scenarios through
+// StereoLooper and compares the output with the one stored in golden/, within
+// a tolerance. The processing time is reported along with the budget stored
+// with the output, exceeding it doesn't fail the scenario.
+//
+// Usage: golden_looper [-u] [-d dir]
+//
+// With -u the golden files are recorded again, do it only when a change of
+// the output is intended. The budget is then set to twice the time measured,
+// so it's specific to the host the files are recorded on.
+//
+// The output is compared by its fingerprint: the RMS and the first sample of
+// each window of kWindowFrames frames, per channel. The filter level is zeroed
+// in all the scenarios, so that the output doesn't depend on DaisySP's Svf.
+
+using namespace wreath;
+
+constexpr size_t blockSize = 48;
+constexpr int32_t kWindowFrames = 256;
+constexpr float kTolerance = 1e-3f;
+constexpr float kBudgetFactor = 2.f; // The budget recorded, relative to the time measured
+constexpr int kRuns = 3;             // The best time is taken
+
+struct Scenario
+{
+    std::string desc{};
+    std::string script{};
+    int32_t sampleRate{kSampleRateStandard};
+};
+
+// All the scenarios buffer one second of the input and then play with it, at
+// 48KHz unless given. The retrigger-sync one moves the heads of a varispeed
+// delay while they are reading, at the end of the trigger fades. The
+// mid-block one has its events off the blocks boundaries, so they take effect
+// within the blocks. The last ones run the
+// same timeline at the economy and the high rates, so that the time constants
+// are checked at both.
+static Scenario scenarios[] =
+{
+    { "backwards-shrink", R"(
+        mode mono
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.2 direction both backwards
+        1.5 loop_length both 0.4
+        1.9 loop_length both 0.1
+        2.3 loop_length both 0.03
+        2.6 loop_length both 0.5
+    )" },
+    { "inverted-loop", R"(
+        mode dual
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.2 loop_start both 0.7
+        1.2 loop_length both 0.6
+        1.8 rate left 1.37
+        2.2 direction right backwards
+    )" },
+    { "pendulum", R"(
+        mode mono
+        movement pendulum
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.2 loop_length both 0.3
+        1.6 rate both 1.5
+        2.2 loop_start both 0.5
+    )" },
+    { "freeze", R"(
+        mode mono
+        buffer 1
+        length 3.5
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.1 feedback 0.5
+        1.5 freeze both 1
+        2.2 freeze both 0.4
+        2.8 freeze both 0
+    )" },
+    { "delay-sync", R"(
+        mode mono
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.1 loop_sync both on
+        1.2 loop_length both 0.25
+        1.6 rate both 0.5
+        2.1 rate both 1
+    )" },
+    { "retrigger-sync", R"(
+        mode mono
+        buffer 1
+        length 4
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.1 loop_sync both on
+        1.12 direction both backwards
+        1.15 loop_length both 0.3
+        1.2 rate both 0.6
+        1.7 trigger
+        2.13 trigger
+        2.61 trigger
+        3.07 trigger
+        3.5 trigger
+    )" },
+    { "varispeed", R"(
+        mode dual
+        buffer 1
+        length 3
+        seed 7
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.1 rate_slew 0.2
+        1.1 rate left 0.71
+        1.1 write_rate right 0.63
+        1.6 movement left drunk
+        2.0 trigger
+    )" },
+    { "granular", R"(
+        mode dual
+        buffer 1
+        length 3
+        seed 11
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.1 grain_size both 0.05
+        1.1 grain_spread both 0.3
+        1.2 grains both 80
+        1.8 rate left 1.5
+        2.0 grains right 400
+        2.5 grains both 0
+    )" },
+    { "mid-block", R"(
+        mode cross
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.0503 start
+        1.2011 loop_length both 0.2
+        1.4007 trigger
+        1.6513 loop_start both 0.31
+        1.9002 rate both 1.25
+        2.3019 direction both backwards
+    )" },
+    { "economy-rate", R"(
+        mode cross
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.2 loop_length both 0.3
+        1.6 rate both 0.8
+        2.2 direction both backwards
+    )", kSampleRateEconomy },
+    { "high-rate", R"(
+        mode cross
+        buffer 1
+        length 3
+        0 filter_level 0
+        1 stop_buffering
+        1.05 start
+        1.2 loop_length both 0.3
+        1.6 rate both 0.8
+        2.2 direction both backwards
+    )", kSampleRateHigh },
+};
+
+struct Fingerprint
+{
+    std::vector<float> values{}; // RMS and first sample per window, left and right
+    double nsPerSample{};
+};
+
+float Input(int64_t frame, int channel)
+{
+    float t = static_cast<float>(frame);
+    float saw = (frame % (channel ? 331 : 257)) / (channel ? 331.f : 257.f) - 0.5f;
+
+    return 0.4f * std::sin(t * (channel ? 0.013f : 0.01f)) + 0.2f * saw;
+}
+
+bool Render(const Scenario &scenario, Fingerprint &fingerprint)
+{
+    int32_t sampleRate = scenario.sampleRate;
+    Script script;
+    std::istringstream in(scenario.script);
+    if (!script.Parse(in, sampleRate))
+    {
+        std::fprintf(stderr, "%s: %s\n", scenario.desc.c_str(), script.GetError().c_str());
+
+        return false;
+    }
+
+    int64_t frames = static_cast<int64_t>(script.lengthSeconds * sampleRate);
+    size_t memoryBytes = 4 * static_cast<size_t>(script.conf.bufferSeconds * sampleRate + 1) * sizeof(BufferSample) + 4 * kArenaAlignment;
+    std::unique_ptr<uint8_t[]> memory{new uint8_t[memoryBytes + kArenaAlignment]};
+    std::vector<float> output(frames * 2);
+
+    fingerprint.nsPerSample = 0;
+    for (int run = 0; run < kRuns; run++)
+    {
+        void *aligned = memory.get();
+        size_t space = memoryBytes + kArenaAlignment;
+        std::align(kArenaAlignment, memoryBytes, aligned, space);
+        Arena arena;
+        arena.Init(aligned, memoryBytes);
+        std::unique_ptr<StereoLooper> looper{new StereoLooper()};
+        if (!looper->Init(sampleRate, script.conf, arena))
+        {
+            std::fprintf(stderr, "%s: the buffers don't fit in memory\n", scenario.desc.c_str());
+
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        script.Render(
+            *looper, frames, blockSize,
+            [](int64_t frame, float *left, float *right, size_t n)
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    left[i] = Input(frame + i, 0);
+                    right[i] = Input(frame + i, 1);
+                }
+            },
+            [&output](int64_t frame, const float *left, const float *right, size_t n)
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    output[(frame + i) * 2] = left[i];
+                    output[(frame + i) * 2 + 1] = right[i];
+                }
+            });
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+        fingerprint.nsPerSample = run ? std::min(fingerprint.nsPerSample, ns) : ns;
+    }
+
+    fingerprint.values.clear();
+    for (int64_t window = 0; window < frames; window += kWindowFrames)
+    {
+        int64_t end = std::min(frames, window + kWindowFrames);
+        for (int channel = 0; channel < 2; channel++)
+        {
+            double sum{};
+            for (int64_t frame = window; frame < end; frame++)
+            {
+                sum += output[frame * 2 + channel] * output[frame * 2 + channel];
+            }
+            fingerprint.values.push_back(std::sqrt(sum / (end - window)));
+            fingerprint.values.push_back(output[window * 2 + channel]);
+        }
+    }
+
+    return true;
+}
+
+bool Load(const std::string &path, std::vector<float> &values, double &budget)
+{
+    std::ifstream file(path);
+    std::string line;
+    values.clear();
+    budget = 0;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || '#' == line[0])
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        if (!line.compare(0, 6, "budget"))
+        {
+            std::string keyword;
+            fields >> keyword >> budget;
+            continue;
+        }
+        float value;
+        while (fields >> value)
+        {
+            values.push_back(value);
+        }
+    }
+
+    return budget > 0 && !values.empty();
+}
+
+bool Save(const std::string &path, const Scenario &scenario, const Fingerprint &fingerprint)
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+    {
+        return false;
+    }
+    std::fprintf(file, "# %s: RMS and first sample of each %d frames window, left then right\n", scenario.desc.c_str(), kWindowFrames);
+    std::fprintf(file, "budget %.1f\n", fingerprint.nsPerSample * kBudgetFactor);
+    for (size_t i = 0; i < fingerprint.values.size(); i += 4)
+    {
+        std::fprintf(file, "%.6f %.6f %.6f %.6f\n", fingerprint.values[i], fingerprint.values[i + 1], fingerprint.values[i + 2], fingerprint.values[i + 3]);
+    }
+    std::fclose(file);
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool update{};
+    std::string dir{"golden"};
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (!std::strcmp(argv[arg], "-u"))
+        {
+            update = true;
+        }
+        else if (!std::strcmp(argv[arg], "-d") && arg + 1 < argc)
+        {
+            dir = argv[++arg];
+        }
+    }
+
+    int failed{};
+    std::printf("scenario,max_error,ns_per_sample,budget_ns,result\n");
+    for (const Scenario &scenario : scenarios)
+    {
+        Fingerprint fingerprint;
+        std::string path = dir + "/" + scenario.desc + ".txt";
+        if (!Render(scenario, fingerprint))
+        {
+            failed++;
+            continue;
+        }
+
+        if (update)
+        {
+            bool saved = Save(path, scenario, fingerprint);
+            std::printf("%s,,%.2f,%.1f,%s\n", scenario.desc.c_str(), fingerprint.nsPerSample, fingerprint.nsPerSample * kBudgetFactor, saved ? "recorded" : "not saved");
+            failed += !saved;
+            continue;
+        }
+
+        std::vector<float> golden;
+        double budget;
+        if (!Load(path, golden, budget))
+        {
+            std::printf("%s,,%.2f,,missing\n", scenario.desc.c_str(), fingerprint.nsPerSample);
+            failed++;
+            continue;
+        }
+
+        float error{golden.size() == fingerprint.values.size() ? 0.f : INFINITY};
+        for (size_t i = 0; i < golden.size() && i < fingerprint.values.size(); i++)
+        {
+            error = std::max(error, std::fabs(golden[i] - fingerprint.values[i]));
+        }
+        // The time is only reported: on a host it varies from run to run
+        // more than a regression would show.
+        bool sounds = error <= kTolerance;
+        bool fast = fingerprint.nsPerSample <= budget;
+        std::printf("%s,%g,%.2f,%.1f,%s\n", scenario.desc.c_str(), error, fingerprint.nsPerSample, budget,
+                    sounds ? (fast ? "pass" : "pass over budget") : "output changed");
+        failed += !sounds;
+    }
+
+    return failed ? 1 : 0;
+}
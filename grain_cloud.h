@@ -0,0 +1,319 @@
+#pragma once
+
+#include "head.h"
+#include "random.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace wreath
+{
+    constexpr int32_t kMaxGrains{16};         // The voices of a cloud
+    constexpr int32_t kMaxGrainSpawns{4};     // Grains started per update at most
+    constexpr int32_t kGrainStealSamples{64}; // The fade out of a stolen grain
+    constexpr float kMinGrainSamples{32.f};
+
+    /**
+     * @brief A pool of lightweight reading voices, the grains, that play the
+     * loop of a reading head at the same time. Each grain starts around the
+     * head's position, plays for its size at its own rate and direction and
+     * is shaped by a parabolic window. The grains are placed so that they
+     * don't cross the loop's boundaries, unless they are longer than the
+     * loop, so the cloud needs no crossfade there. All the grains read
+     * through Head::ReadVoice(), with the head's interpolation.
+     *
+     * The voices are kept as a structure of arrays, with the playing ones
+     * packed at the front, so that the per-sample loop only goes through
+     * them. The grains are scheduled once per update: at most
+     * kMaxGrainSpawns start, at the sample they are due within the block,
+     * and when all the voices are busy the most advanced grain is faded out
+     * quickly to make room, one at a time. So the cost grows with the
+     * density and the size of the grains, but never beyond the voices.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T, typename I = LinearInterpolation>
+    class GrainCloud
+    {
+    public:
+        GrainCloud() {}
+        ~GrainCloud() {}
+
+        /**
+         * @brief Initializes the cloud, with no grains.
+         *
+         * @param sampleRate
+         * @param random The generator of the looper, so that the grains only
+         * depend on its seed
+         */
+        void Init(int32_t sampleRate, Random *random)
+        {
+            sampleRate_ = sampleRate;
+            random_ = random;
+            density_ = 0.f;
+            size_ = sampleRate * 0.1f;
+            spread_ = 0.f;
+            voices_ = kMaxGrains;
+            UpdateGain();
+            Reset();
+        }
+
+        /**
+         * @brief Stops all the grains at once.
+         */
+        void Reset()
+        {
+            active_ = 0;
+            credit_ = 0.f;
+        }
+
+        /**
+         * @brief Sets how many grains start per second, 0 turns the cloud
+         * off. The grains already playing are let end, keep processing the
+         * cloud while there are some.
+         *
+         * @param density
+         */
+        void SetDensity(float density)
+        {
+            density_ = std::max(density, 0.f);
+            if (!density_)
+            {
+                // The grains left keep the level they have.
+                credit_ = 0.f;
+
+                return;
+            }
+            UpdateGain();
+        }
+
+        /**
+         * @brief Sets the length of the grains to come, in samples.
+         *
+         * @param size
+         */
+        void SetSize(float size)
+        {
+            size_ = std::max(size, kMinGrainSamples);
+            UpdateGain();
+        }
+
+        /**
+         * @brief Sets how far from the head's position the grains start, as
+         * a share of the loop length: 0 on the head, 1 anywhere in the loop.
+         *
+         * @param spread
+         */
+        void SetSpread(float spread)
+        {
+            spread_ = std::min(std::max(spread, 0.f), 1.f);
+        }
+
+        /**
+         * @brief Sets how many grains may play at the same time, at most
+         * kMaxGrains. The grains beyond are let end.
+         *
+         * @param voices
+         */
+        void SetVoices(int32_t voices)
+        {
+            voices_ = std::min(std::max(voices, static_cast<int32_t>(1)), kMaxGrains);
+            UpdateGain();
+        }
+
+        /**
+         * @brief Starts the grains due in the next samples and sets the loop
+         * they play. Call this once per block, before processing it.
+         *
+         * @param samples The samples in the block
+         * @param position The reading head's position
+         * @param rate The grains' rate
+         * @param direction The grains' direction
+         * @param loopStart
+         * @param loopLength
+         * @param bufferSamples The written buffer length, inverted loops wrap
+         * around at its end
+         */
+        void Schedule(int32_t samples, float position, float rate, Direction direction, float loopStart, float loopLength, int32_t bufferSamples)
+        {
+            loopStart_ = ToPhase(loopStart);
+            bufferPhase_ = ToPhase(bufferSamples);
+            int64_t loopPhase = std::max(ToPhase(loopLength), kPhaseOne);
+            if (loopPhase != loopPhase_)
+            {
+                // The loop changed, the grains go on within the new one.
+                loopPhase_ = loopPhase;
+                for (int32_t v = 0; v < active_; v++)
+                {
+                    offset_[v] %= loopPhase_;
+                }
+            }
+
+            if (!density_ || bufferSamples <= 0)
+            {
+                return;
+            }
+
+            // The n-th grain of the block is due when the credit reaches n.
+            float start = credit_;
+            float samplesPerGrain = sampleRate_ / density_;
+            credit_ += samples / samplesPerGrain;
+            float relative = position - loopStart;
+            relative = relative < 0 ? relative + bufferSamples : relative;
+            for (int32_t spawn = 1; credit_ >= 1.f && spawn <= kMaxGrainSpawns; spawn++)
+            {
+                if (active_ >= voices_)
+                {
+                    Steal();
+
+                    break;
+                }
+                int32_t wait = std::max(static_cast<int32_t>((spawn - start) * samplesPerGrain), static_cast<int32_t>(0));
+                float offset = relative + (random_->NextFloat() - 0.5f) * spread_ * loopLength;
+                Start(std::min(wait, samples - 1), offset, rate, direction);
+                credit_ -= 1.f;
+            }
+            // What couldn't start now is dropped, not to burst later.
+            credit_ = std::min(credit_, 1.f);
+        }
+
+        /**
+         * @brief Returns the sum of the grains at the current sample and moves
+         * them forward.
+         *
+         * @param head The reading head whose loop the grains play
+         * @return float
+         */
+        float Process(Head<T, I> &head)
+        {
+            float sum{};
+            for (int32_t v = 0; v < active_; v++)
+            {
+                if (wait_[v] > 0)
+                {
+                    wait_[v]--;
+                    continue;
+                }
+
+                float x = window_[v];
+                int64_t phase = loopStart_ + offset_[v];
+                phase = phase >= bufferPhase_ ? phase - bufferPhase_ : phase;
+                sum += 4.f * x * (1.f - x) * release_[v] * head.ReadVoice(phase, direction_[v]);
+
+                int64_t offset = offset_[v] + step_[v];
+                offset_[v] = offset >= loopPhase_ ? offset - loopPhase_ : (offset < 0 ? offset + loopPhase_ : offset);
+                window_[v] = x + windowStep_[v];
+                release_[v] -= releaseStep_[v];
+                if (window_[v] >= 1.f || release_[v] <= 0.f)
+                {
+                    // The last voice takes its place, and plays now.
+                    Stop(v--);
+                }
+            }
+
+            return sum * gain_;
+        }
+
+        inline bool IsEnabled() const { return density_ > 0; }
+        inline int32_t GetActive() const { return active_; }
+        inline float GetDensity() const { return density_; }
+        inline float GetSize() const { return size_; }
+        inline float GetSpread() const { return spread_; }
+
+    private:
+        int32_t sampleRate_{};
+        Random *random_{};
+        float density_{}; // Grains per second
+        float size_{};    // Grains length in samples
+        float spread_{};
+        int32_t voices_{kMaxGrains};
+        float gain_{1.f};   // Keeps the level steady with the overlap
+        float credit_{};    // The grains due, see Schedule()
+        int32_t active_{};  // The voices playing, the first ones
+        int64_t loopStart_{};
+        int64_t loopPhase_{kPhaseOne}; // The loop length
+        int64_t bufferPhase_{};
+
+        // The voices, in 32.32 fixed point like the heads' positions.
+        int64_t offset_[kMaxGrains]{}; // The position from the loop start
+        int64_t step_[kMaxGrains]{};   // The rate, negative backwards
+        int32_t direction_[kMaxGrains]{};
+        int32_t wait_[kMaxGrains]{}; // The samples before starting
+        float window_[kMaxGrains]{}; // Where in the window, from 0 to 1
+        float windowStep_[kMaxGrains]{};
+        float release_[kMaxGrains]{}; // 1, or fading out when stolen
+        float releaseStep_[kMaxGrains]{};
+
+        static inline int64_t ToPhase(float value)
+        {
+            return static_cast<int64_t>(std::floor(static_cast<double>(value) * kPhaseOne));
+        }
+
+        /**
+         * @brief Sets the gain from the grains overlapping on average, as
+         * they sum up like uncorrelated signals.
+         */
+        void UpdateGain()
+        {
+            float overlap = density_ * size_ / std::max(sampleRate_, static_cast<int32_t>(1));
+            gain_ = 1.f / std::sqrt(std::min(std::max(overlap, 1.f), static_cast<float>(voices_)));
+        }
+
+        void Start(int32_t wait, float offset, float rate, Direction direction)
+        {
+            int32_t v = active_++;
+            float length = loopPhase_ * kPhaseFraction;
+            rate = std::min(std::abs(rate), length);
+            offset = std::fmod(offset, length);
+            offset = offset < 0 ? offset + length : offset;
+            float reach = rate * size_;
+            if (reach < length)
+            {
+                // Back from the boundary the grain would cross.
+                offset = FORWARD == direction ? std::min(offset, length - reach) : std::max(offset, reach);
+            }
+            offset_[v] = ToPhase(offset) % loopPhase_;
+            step_[v] = ToPhase(rate) * direction;
+            direction_[v] = direction;
+            wait_[v] = wait;
+            window_[v] = 0.f;
+            windowStep_[v] = 1.f / size_;
+            release_[v] = 1.f;
+            releaseStep_[v] = 0.f;
+        }
+
+        /**
+         * @brief Fades out the most advanced grain, unless one is already
+         * fading out.
+         */
+        void Steal()
+        {
+            int32_t victim{-1};
+            for (int32_t v = 0; v < active_; v++)
+            {
+                if (releaseStep_[v] > 0)
+                {
+                    return;
+                }
+                if (victim < 0 || window_[v] > window_[victim])
+                {
+                    victim = v;
+                }
+            }
+            releaseStep_[victim] = 1.f / kGrainStealSamples;
+        }
+
+        void Stop(int32_t v)
+        {
+            int32_t last = --active_;
+            offset_[v] = offset_[last];
+            step_[v] = step_[last];
+            direction_[v] = direction_[last];
+            wait_[v] = wait_[last];
+            window_[v] = window_[last];
+            windowStep_[v] = windowStep_[last];
+            release_[v] = release_[last];
+            releaseStep_[v] = releaseStep_[last];
+        }
+    };
+} // namespace wreath
@@ -1,16 +1,56 @@
 #pragma once
 
 #include "fader.h"
+#include "freeze_buffer.h"
+#include "hot_loop.h"
+#include "interpolation.h"
+#include "peak_index.h"
+#include "sample_format.h"
+#include "stage_window.h"
+#include "undo_history.h"
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <limits>
 
 namespace wreath
 {
-    constexpr float kMinLoopLengthSamples{46.f}; // ~C1 @ 48KHz
-    constexpr float kMinSamplesForTone{91.f};    // ~C2 @ 48KHz
-    constexpr float kMinSamplesForFlanger{1722.f};
+    constexpr float kMinLoopLengthSeconds{46.f / 48000}; // 46 samples @ 48KHz
+    constexpr float kMinSecondsForTone{91.f / 48000};    // 91 samples @ 48KHz
+    constexpr float kMinSecondsForFlanger{1722.f / 48000};
+    constexpr int64_t kPhaseOne{int64_t{1} << 32}; // One sample in 32.32 fixed point
+    constexpr float kPhaseFraction{1.f / kPhaseOne};
+
+    /**
+     * @brief The time constants of the looper converted to samples at the
+     * given sample rate. They are rounded to whole samples, so that at 48KHz
+     * they are the ones the looper was tuned with.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    struct Timing
+    {
+        float samplesToFade{};        // See kFadeSeconds
+        float samplesToFadeTrigger{}; // See kFadeTriggerSeconds
+        float minLoopLength{};
+        float minSamplesForTone{};
+        float minSamplesForFlanger{};
+
+        void Init(int32_t sampleRate)
+        {
+            samplesToFade = ToSamples(kFadeSeconds, sampleRate);
+            samplesToFadeTrigger = ToSamples(kFadeTriggerSeconds, sampleRate);
+            minLoopLength = ToSamples(kMinLoopLengthSeconds, sampleRate);
+            minSamplesForTone = ToSamples(kMinSecondsForTone, sampleRate);
+            minSamplesForFlanger = ToSamples(kMinSecondsForFlanger, sampleRate);
+        }
+
+        static float ToSamples(float seconds, int32_t sampleRate)
+        {
+            return std::round(seconds * sampleRate);
+        }
+    };
 
     enum Type
     {
@@ -38,7 +78,16 @@ namespace wreath
      *
      * Inspired by Monome Softcut's subhead class:
      * https://github.com/monome/softcut-lib/blob/main/softcut-lib/src/SubHead.cpp
+     *
+     * The template parameters are the buffer storage format (see SampleFormat)
+     * and the interpolation policy used when reading (see interpolation.h).
+     *
+     * The position is a 32.32 fixed point phase, moved by the rate in the same
+     * format, so that it keeps a sub-sample precision at every loop length and
+     * fractional rates don't drift. The float position is a view of it, only
+     * used for the boundaries checks and by the looper.
      */
+    template <typename T, typename I = LinearInterpolation>
     class Head
     {
     public:
@@ -55,22 +104,38 @@ namespace wreath
 
         void Reset()
         {
-            intIndex_ = 0;
-            index_ = 0.f;
+            MovePhase(0);
             intLoopStart_ = 0;
             intLoopEnd_ = 0;
+            ResetEvents();
         }
 
-        void Init(float *buffer, float *buffer2, int32_t maxBufferSamples)
+        /**
+         * @brief Initializes the head.
+         *
+         * @param buffer
+         * @param freezeBuffer
+         * @param eraser
+         * @param maxBufferSamples
+         * @param maxSamplesToFade The length of the fades, at most half of
+         * the loop (see Timing)
+         * @param stride The distance between two consecutive samples in the
+         * buffer, 2 when the channels are interleaved
+         */
+        void Init(T *buffer, FreezeBuffer<T> *freezeBuffer, BufferEraser<T> *eraser, int32_t maxBufferSamples, float maxSamplesToFade, int32_t stride = 1)
         {
             buffer_ = buffer;
-            freezeBuffer_ = buffer2;
+            freezeBuffer_ = freezeBuffer;
+            eraser_ = eraser;
             maxBufferSamples_ = maxBufferSamples;
+            stride_ = stride;
+            maxSamplesToFade_ = maxSamplesToFade;
             rate_ = 1.f;
+            step_ = kPhaseOne;
             looping_ = false;
             movement_ = Movement::NORMAL;
             direction_ = Direction::FORWARD;
-            samplesToFade_ = std::min(kSamplesToFade, loopLength_ / 2.f);
+            samplesToFade_ = std::min(maxSamplesToFade_, loopLength_ / 2.f);
             Reset();
         }
 
@@ -79,6 +144,7 @@ namespace wreath
             loopStart_ = start;
             intLoopStart_ = loopStart_;
             CalculateLoopEnd();
+            ResetEvents();
             if (!looping_)
             {
                 ResetPosition();
@@ -91,7 +157,8 @@ namespace wreath
             loopLength_ = length;
             intLoopLength_ = loopLength_;
             CalculateLoopEnd();
-            samplesToFade_ = std::min(kSamplesToFade, loopLength_ / 2.f);
+            samplesToFade_ = std::min(maxSamplesToFade_, loopLength_ / 2.f);
+            ResetEvents();
 
             return loopLength_;
         }
@@ -103,7 +170,8 @@ namespace wreath
             loopLength_ = length;
             intLoopLength_ = loopLength_;
             CalculateLoopEnd();
-            samplesToFade_ = std::min(kSamplesToFade, loopLength_ / 2.f);
+            samplesToFade_ = std::min(maxSamplesToFade_, loopLength_ / 2.f);
+            ResetEvents();
         }
 
         inline void SetFreeze(float amount)
@@ -116,15 +184,15 @@ namespace wreath
             }
             else
             {
-                if (frozen_ && !frozen && !mustUnfreeze_)
+                if (!frozen)
                 {
-                    // Fade in recording in the freeze buffer.
-                    mustUnfreeze_ = true;
-                    freezeFadeIndex_ = 0;
+                    // The snapshot is released, nothing to fade.
+                    frozen_ = false;
+                    mustFreeze_ = false;
                 }
-                else if (!frozen_ && frozen && !mustFreeze_)
+                else if (!frozen_ && !mustFreeze_)
                 {
-                    // Fade out recording in the freeze buffer.
+                    // Fade out recording in the snapshot.
                     mustFreeze_ = true;
                     freezeFadeIndex_ = 0;
                 }
@@ -134,21 +202,38 @@ namespace wreath
         inline void SetRate(float rate)
         {
             rate_ = std::abs(rate);
+            step_ = ToPhase(rate_);
+            ResetEvents();
         }
         inline void SetMovement(Movement movement)
         {
             movement_ = movement;
+            ResetEvents();
         }
 
         inline void SetDirection(Direction direction)
         {
             direction_ = direction;
+            ResetEvents();
         }
 
         inline void SetIndex(float index)
         {
-            index_ = index;
-            intIndex_ = std::floor(index_);
+            MovePhase(ToPhase(index));
+            ResetEvents();
+        }
+
+        /**
+         * @brief Moves the head to the given fixed point position, use this
+         * rather than SetIndex() to put it where another head is without
+         * losing precision.
+         *
+         * @param phase
+         */
+        inline void SetPhase(int64_t phase)
+        {
+            MovePhase(phase);
+            ResetEvents();
         }
 
         inline void SetOffset(float offset)
@@ -173,17 +258,34 @@ namespace wreath
                 return Action::NO_ACTION;
             }
 
-            float index = index_ + (rate_ * direction_);
-            SetIndex(index);
+            int64_t phase = phase_ + step_ * direction_;
+
+            // Far from the loop and buffer boundaries nothing can happen, so
+            // we just move on.
+            if (stepsToEvent_ > 0)
+            {
+                stepsToEvent_--;
+                MovePhase(phase);
+
+                return Action::NO_ACTION;
+            }
+
+            MovePhase(phase);
             Action action = HandleLoopAction();
 
             if (intIndex_ >= bufferSamples_)
             {
-                SetIndex(index_ - bufferSamples_);
+                MovePhase(phase_ - bufferSamples_ * kPhaseOne);
             }
             else if (intIndex_ < 0)
             {
-                SetIndex(bufferSamples_ + index_);
+                MovePhase(phase_ + bufferSamples_ * kPhaseOne);
+            }
+            // Check how long it'll be before something may happen, unless the
+            // head has just crossed a boundary.
+            else if (Action::NO_ACTION == action)
+            {
+                CalculateStepsToEvent();
             }
 
             switch (action)
@@ -210,18 +312,133 @@ namespace wreath
         void SetSamplesToFade(float samples)
         {
             samplesToFade_ = loopLength_ ? std::min(samples, loopLength_ / 2.f) : samples;
+            ResetEvents();
         }
 
         float ReadFrozen()
         {
-            return frozen_ ? ReadAt(freezeBuffer_, index_) : 0;
+            if (!frozen_)
+            {
+                return 0;
+            }
+            if (integral_)
+            {
+                return freezeBuffer_->Read(intIndex_);
+            }
+
+            return ReadAt([this](int32_t i)
+                          { return freezeBuffer_->Read(i); });
         }
 
         float Read()
         {
-            return ReadAt(buffer_, index_);
+            // Fast path when the head is on an integral position (which is
+            // always the case at integral rates), no interpolation needed.
+            if (integral_)
+            {
+                return SampleFormat<T>::Load(Fetch(intIndex_));
+            }
+
+            return ReadAt([this](int32_t i)
+                          { return SampleFormat<T>::Load(Fetch(i)); });
+        }
+
+        /**
+         * @brief Reads the buffer at the given position, with the head's
+         * interpolation and within its loop. This is how the voices of a
+         * GrainCloud play the loop of the reading head.
+         *
+         * @param phase The position in 32.32 fixed point
+         * @param direction
+         * @return float
+         */
+        float ReadVoice(int64_t phase, int32_t direction)
+        {
+            int32_t intPos = static_cast<int32_t>(phase >> 32);
+            uint32_t fraction = static_cast<uint32_t>(phase);
+            if (!fraction)
+            {
+                return SampleFormat<T>::Load(Fetch(intPos));
+            }
+
+            // The farthest tap is two samples away (see HermiteInterpolation).
+            bool wrapFree = intLoopEnd_ > intLoopStart_ && intPos - 2 >= intLoopStart_ && intPos + 2 <= intLoopEnd_;
+
+            return ReadAt(intPos, fraction * kPhaseFraction, direction, wrapFree, [this](int32_t i)
+                          { return SampleFormat<T>::Load(Fetch(i)); });
+        }
+
+        /**
+         * @brief Sets the index where the writing head adds the peaks of the
+         * samples it writes, a head without one doesn't index them.
+         *
+         * @param peaks
+         */
+        void SetPeaks(PeakIndex *peaks)
+        {
+            peaks_ = peaks;
+        }
+
+        /**
+         * @brief Sets the history where the writing head saves what it's
+         * about to overwrite, a head without one keeps no history.
+         *
+         * @param undo
+         */
+        void SetUndo(UndoHistory<T> *undo)
+        {
+            undo_ = undo;
+        }
+
+#if defined(WREATH_HOT_LOOPS)
+        /**
+         * @brief Sets the mirror of the short loops, where the head reads
+         * the samples it holds.
+         *
+         * @param hot
+         */
+        void SetHot(HotLoop<T> *hot)
+        {
+            hot_ = hot;
+        }
+#endif
+
+#if defined(WREATH_STAGED_READS)
+        /**
+         * @brief Sets the window where the buffer is staged for reading, a
+         * head without one reads straight from the buffer.
+         *
+         * @param stage
+         */
+        void SetStage(StageWindow<T> *stage)
+        {
+            stage_ = stage;
         }
 
+        /**
+         * @brief Stages the span of the buffer that the head will read in the
+         * given number of samples, if it keeps moving the way it does. When it
+         * doesn't (the loop wraps, the position is reset, the speed changes)
+         * the samples outside of the window are read from the buffer.
+         *
+         * @param samples
+         */
+        void Stage(int32_t samples)
+        {
+            // While erasing the buffer, the heads read from it directly.
+            if (!stage_ || !active_ || eraser_->IsErasing())
+            {
+                return;
+            }
+
+            int32_t reach = std::ceil(rate_ * samples);
+            bool forward = FORWARD == direction_;
+            int32_t from = intIndex_ - kStageMargin - (forward ? 0 : reach);
+            int32_t to = intIndex_ + kStageMargin + 1 + (forward ? reach : 0);
+            stage_->Stage(buffer_, stride_, from, to, forward, bufferSamples_);
+        }
+#endif
+
         bool toggleOnset{true};
         int32_t previousE_{};
         /**
@@ -253,16 +470,20 @@ namespace wreath
         }
 
         /**
-         * @brief Handles the freeze buffer on writing.
+         * @brief Handles the freeze buffer on writing. While the snapshot is
+         * being taken, the value about to be overwritten is preserved, and
+         * right after freezing the recording is faded out in the snapshot to
+         * avoid a click where the writing head was.
          *
          * @param input
          */
         void HandleFreeze(float input)
         {
-            float frozenValue = freezeBuffer_[intIndex_];
+            freezeBuffer_->Preserve(intIndex_);
             if (mustFreeze_)
             {
-                input = Fader::EqualCrossFade(input, frozenValue, freezeFadeIndex_ * (1.f / samplesToFade_));
+                float frozenValue = freezeBuffer_->Read(intIndex_);
+                freezeBuffer_->Write(intIndex_, Fader::EqualCrossFade(input, frozenValue, freezeFadeIndex_ * (1.f / samplesToFade_)));
                 if (freezeFadeIndex_ >= samplesToFade_)
                 {
                     mustFreeze_ = false;
@@ -270,20 +491,6 @@ namespace wreath
                 }
                 freezeFadeIndex_ += rate_;
             }
-            else if (mustUnfreeze_)
-            {
-                input = Fader::EqualCrossFade(frozenValue, input, freezeFadeIndex_ * (1.f / samplesToFade_));
-                if (freezeFadeIndex_ >= samplesToFade_)
-                {
-                    mustUnfreeze_ = false;
-                    frozen_ = false;
-                }
-                freezeFadeIndex_ += rate_;
-            }
-            if (!frozen_ || mustUnfreeze_)
-            {
-                freezeBuffer_[intIndex_] = input;
-            }
         }
 
         /**
@@ -293,18 +500,32 @@ namespace wreath
          */
         void Write(float input)
         {
+            if (undo_)
+            {
+                undo_->Preserve(intIndex_);
+            }
             HandleFreeze(input);
-            buffer_[intIndex_] = input;
+            eraser_->Prepare(intIndex_);
+            Sample(intIndex_) = SampleFormat<T>::Store(input);
+            if (peaks_)
+            {
+                peaks_->Add(intIndex_, input);
+            }
         }
 
         /**
-         * @brief Clears the buffers.
-         *
+         * @brief Clears the buffers. They're silent right away, while the
+         * actual erasing is spread over the next blocks, starting from the
+         * head's position (see BufferEraser).
          */
         void ClearBuffer()
         {
-            memset(buffer_, 0.f, maxBufferSamples_);
-            memset(freezeBuffer_, 0.f, maxBufferSamples_);
+            eraser_->Start(intIndex_);
+            freezeBuffer_->Clear();
+            if (peaks_)
+            {
+                peaks_->Clear();
+            }
         }
 
         /**
@@ -317,9 +538,14 @@ namespace wreath
          */
         bool Buffer(float value)
         {
-            buffer_[intIndex_] = value;
-            freezeBuffer_[intIndex_] = value;
+            eraser_->Prepare(intIndex_);
+            Sample(intIndex_) = SampleFormat<T>::Store(value);
+            if (peaks_)
+            {
+                peaks_->Add(intIndex_, value);
+            }
             bufferSamples_ = intIndex_ + 1;
+            ResetEvents();
 
             // End of available buffer?
             if (intIndex_ >= maxBufferSamples_ - 1)
@@ -327,11 +553,24 @@ namespace wreath
                 return true;
             }
 
-            intIndex_++;
+            MovePhase(phase_ + kPhaseOne);
 
             return false;
         }
 
+        /**
+         * @brief Marks the buffer as written up to the given length, like the
+         * buffering procedure does. This is for when the buffer has been
+         * filled otherwise, for instance restoring a saved loop.
+         *
+         * @param bufferSamples
+         */
+        void SetBufferSamples(int32_t bufferSamples)
+        {
+            bufferSamples_ = std::max(std::min(bufferSamples, maxBufferSamples_), static_cast<int32_t>(1));
+            ResetEvents();
+        }
+
         /**
          * @brief Inits the buffer used by this head by passing its length.
          *
@@ -344,7 +583,8 @@ namespace wreath
             intLoopLength_ = loopLength_;
             loopEnd_ = loopLength_ - 1.f;
             intLoopEnd_ = loopEnd_;
-            samplesToFade_ = std::min(kSamplesToFade, loopLength_ / 2.f);
+            samplesToFade_ = std::min(maxSamplesToFade_, loopLength_ / 2.f);
+            ResetEvents();
         }
 
         /**
@@ -354,14 +594,14 @@ namespace wreath
          */
         int32_t StopBuffering()
         {
-            index_ = 0.f;
-            intIndex_ = 0;
+            MovePhase(0);
             loopLength_ = bufferSamples_;
             intLoopLength_ = loopLength_;
             loopEnd_ = loopLength_ - 1.f;
             intLoopEnd_ = loopEnd_;
             ResetPosition();
-            samplesToFade_ = std::min(kSamplesToFade, loopLength_ / 2.f);
+            samplesToFade_ = std::min(maxSamplesToFade_, loopLength_ / 2.f);
+            ResetEvents();
 
             return bufferSamples_;
         }
@@ -369,6 +609,7 @@ namespace wreath
         inline Direction ToggleDirection()
         {
             direction_ = static_cast<Direction>(direction_ * -1);
+            ResetEvents();
 
             return direction_;
         }
@@ -376,11 +617,13 @@ namespace wreath
         void SetActive(bool active)
         {
             active_ = active;
+            ResetEvents();
         }
 
         void SetLooping(bool looping)
         {
             looping_ = looping;
+            ResetEvents();
         }
 
         void SetLoopSync(bool active)
@@ -388,25 +631,75 @@ namespace wreath
             loopSync_ = active;
         }
 
+        /**
+         * @brief Moves the head to where the given one is, so that the motion
+         * is computed only once for heads that move together (see
+         * IsLinkableWith()).
+         *
+         * @param leader
+         */
+        inline void Follow(const Head &leader)
+        {
+            phase_ = leader.phase_;
+            fraction_ = leader.fraction_;
+            index_ = leader.index_;
+            intIndex_ = leader.intIndex_;
+            integral_ = leader.integral_;
+            offset_ = leader.offset_;
+            direction_ = leader.direction_;
+            stepsToEvent_ = leader.stepsToEvent_;
+            wrapFree_ = leader.wrapFree_;
+        }
+
+        /**
+         * @brief Checks whether the head is in the same place and moves the
+         * same way as the given one, that is whether it can follow it.
+         *
+         * @param other
+         * @return true
+         * @return false
+         */
+        bool IsLinkableWith(const Head &other) const
+        {
+            return phase_ == other.phase_ && offset_ == other.offset_ && rate_ == other.rate_ &&
+                   direction_ == other.direction_ && movement_ == other.movement_ &&
+                   active_ == other.active_ && looping_ == other.looping_ &&
+                   loopStart_ == other.loopStart_ && loopLength_ == other.loopLength_ &&
+                   bufferSamples_ == other.bufferSamples_ && samplesToFade_ == other.samplesToFade_;
+        }
+
         inline int32_t GetBufferSamples() { return bufferSamples_; }
+        inline int32_t GetMaxBufferSamples() { return maxBufferSamples_; }
         inline float GetLoopEnd() { return loopEnd_; }
         inline float GetLoopLength() { return loopLength_; }
         inline float GetRate() { return rate_; }
         inline float GetPosition() { return index_; }
+        inline int64_t GetPhase() { return phase_; }
         inline float GetOffset() { return offset_; }
         inline int32_t GetIntPosition() { return intIndex_; }
+        inline int32_t GetStepsToEvent() { return stepsToEvent_; }
         bool IsGoingForward() { return Direction::FORWARD == direction_; }
 
     private:
         const Type type_;
-        float *buffer_;
-        float *freezeBuffer_;
+        T *buffer_;
+        FreezeBuffer<T> *freezeBuffer_;
+        BufferEraser<T> *eraser_;
+        PeakIndex *peaks_{}; // Where the written samples are indexed, if anywhere
+        UndoHistory<T> *undo_{}; // Where the overwritten samples are saved, if anywhere
+        int32_t stride_{1}; // Distance between consecutive samples in the buffer
 
         int32_t maxBufferSamples_{}; // The whole buffer length in samples
         int32_t bufferSamples_{};    // The written buffer length in samples
 
+        int64_t phase_{};     // The position in 32.32 fixed point
+        uint32_t fraction_{}; // The fractional part of the position
         int32_t intIndex_{};
         float index_{};
+        bool integral_{true}; // Whether the index has no fractional part
+        int64_t step_{};      // The rate in 32.32 fixed point
+        int32_t stepsToEvent_{}; // Positions updates before something may happen
+        bool wrapFree_{};        // Whether the neighbour samples need no wrapping
         float rate_{};
         float fadeIndex_{};
         bool loopSync_{};
@@ -428,15 +721,129 @@ namespace wreath
         bool frozen_{};
 
         bool mustFreeze_{};
-        bool mustUnfreeze_{};
         float freezeFadeIndex_{};
         bool mustFadeInFrozen_{};
         float freezeLoopFadeIndex_{};
 
-        float samplesToFade_{kSamplesToFade};
+        float samplesToFade_{};
+        float maxSamplesToFade_{}; // The fades length when the loop is long enough
 
         float offset_{};
 
+#if defined(WREATH_STAGED_READS)
+        StageWindow<T> *stage_{};
+#endif
+#if defined(WREATH_HOT_LOOPS)
+        HotLoop<T> *hot_{};
+#endif
+
+        inline T &Sample(int32_t index)
+        {
+            return buffer_[index * stride_];
+        }
+
+        /**
+         * @brief Returns the sample to be read, from the mirror of the short
+         * loops or the staging window when it's there.
+         *
+         * @param index
+         * @return T
+         */
+        inline T Fetch(int32_t index)
+        {
+#if defined(WREATH_HOT_LOOPS)
+            if (hot_ && hot_->Contains(index))
+            {
+                return hot_->Get(index);
+            }
+#endif
+#if defined(WREATH_STAGED_READS)
+            if (stage_ && stage_->Contains(index))
+            {
+                return stage_->Get(index);
+            }
+#endif
+            if (eraser_->IsPending(index))
+            {
+                return T{};
+            }
+
+            return Sample(index);
+        }
+
+        /**
+         * @brief Converts a position or a rate to 32.32 fixed point. The
+         * conversion is exact for the magnitudes in use, as a float has fewer
+         * significant bits than a double.
+         *
+         * @param value
+         * @return int64_t
+         */
+        static inline int64_t ToPhase(float value)
+        {
+            return static_cast<int64_t>(std::floor(static_cast<double>(value) * kPhaseOne));
+        }
+
+        inline void MovePhase(int64_t phase)
+        {
+            phase_ = phase;
+            intIndex_ = static_cast<int32_t>(phase_ >> 32);
+            fraction_ = static_cast<uint32_t>(phase_);
+            integral_ = !fraction_;
+            index_ = intIndex_ + fraction_ * kPhaseFraction;
+        }
+
+        /**
+         * @brief Forgets the distance to the next event, call this whenever
+         * the position, the speed or the boundaries change.
+         */
+        inline void ResetEvents()
+        {
+            stepsToEvent_ = 0;
+            wrapFree_ = false;
+        }
+
+        /**
+         * @brief Calculates how many times the position can be updated before
+         * the head reaches one of the points where HandleLoopAction() or the
+         * buffer wrapping may change their outcome. The bound is conservative:
+         * it takes into account the float rounding errors at the current
+         * magnitude. Also, it marks whether the neighbour samples used for the
+         * interpolation lie inside the loop and far from its boundaries.
+         */
+        void CalculateStepsToEvent()
+        {
+            float boundaries[]{loopStart_, loopEnd_, loopStart_ + samplesToFade_, loopEnd_ - samplesToFade_, 0.f, static_cast<float>(bufferSamples_)};
+            float ahead{std::numeric_limits<float>::max()};
+            float behind{std::numeric_limits<float>::max()};
+            for (float boundary : boundaries)
+            {
+                float distance = (boundary - index_) * direction_;
+                if (distance > 0)
+                {
+                    ahead = std::min(ahead, distance);
+                }
+                else
+                {
+                    behind = std::min(behind, -distance);
+                }
+            }
+
+            // A boundary right here, we'll check again at the next update.
+            if (behind <= 0.f)
+            {
+                return;
+            }
+
+            constexpr float kMargin{4.f}; // Enough for the interpolation taps
+            float step = rate_ + std::max(std::abs(index_), static_cast<float>(bufferSamples_)) * std::numeric_limits<float>::epsilon();
+            float steps = (ahead - kMargin) / step - 1.f;
+            stepsToEvent_ = steps > 0 ? static_cast<int32_t>(std::min(steps, static_cast<float>(1 << 30))) : 0;
+
+            bool inside = intLoopEnd_ > intLoopStart_ ? index_ > loopStart_ && index_ < loopEnd_ : index_ < loopEnd_ || index_ > loopStart_;
+            wrapFree_ = inside && ahead >= kMargin && behind >= kMargin;
+        }
+
         /**
          * @brief Checks the head's position relative to the loop boundaries and
          * decides what to do next.
@@ -566,26 +973,45 @@ namespace wreath
         }
 
         /**
-         * @brief Reads the value in the buffer of choice at the given index.
-         * Uses interpolation if the index is not integral.
+         * @brief Reads the value at the head's position, using the sample
+         * function to fetch the values from the buffer of choice. Uses
+         * interpolation if the position is not integral.
          *
-         * @param buffer
-         * @param index
+         * @param sample
          * @return float
          */
-        float ReadAt(float *buffer, float index)
+        template <typename F>
+        float ReadAt(F sample)
         {
-            int32_t intPos = index;
-            float value = buffer[intPos];
-            float frac = index - intPos;
+            return ReadAt(intIndex_, fraction_ * kPhaseFraction, direction_, wrapFree_, sample);
+        }
 
-            // Interpolate value only it the index has a fractional part.
-            if (frac > std::numeric_limits<float>::epsilon())
+        /**
+         * @brief Reads the value at the given position and direction, see
+         * ReadAt(). The neighbour samples are wrapped within the head's loop
+         * unless wrapFree.
+         *
+         * @param intPos
+         * @param frac
+         * @param direction
+         * @param wrapFree
+         * @param sample
+         * @return float
+         */
+        template <typename F>
+        float ReadAt(int32_t intPos, float frac, int32_t direction, bool wrapFree, F sample)
+        {
+            // Far from the boundaries the neighbour samples need no wrapping.
+            if (wrapFree)
             {
-                value = value + (buffer[WrapIndex(intPos + direction_)] - value) * frac;
+                return I::Interpolate([&sample, intPos, direction](int32_t tap)
+                                      { return sample(intPos + tap * direction); },
+                                      frac);
             }
 
-            return value;
+            return I::Interpolate([this, &sample, intPos, direction](int32_t tap)
+                                  { return sample(tap ? WrapIndex(intPos + tap * direction) : intPos); },
+                                  frac);
         }
     };
 } // namespace wreath
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for libDaisy's dev/sdram.h, used by the bench build: on the
+// host the buffers simply live in the regular BSS.
+#define DSY_SDRAM_BSS
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "stage_window.h"
+#include <cstdint>
+
+namespace wreath
+{
+    constexpr int32_t kHotLoopSamples{4096}; // A power of two, enough for the flanger range at 96KHz
+    constexpr int32_t kHotLoopMargin{kStageMargin}; // Around the loop, for the interpolation taps
+
+    /**
+     * @brief A mirror of a short loop in fast internal memory (where the
+     * looper lives), so that the heads cycling through it at audio rate, as
+     * in the note and flanger ranges, don't hit the SDRAM on every read.
+     * Define WREATH_HOT_LOOPS to enable it.
+     *
+     * Once per block the looper tracks its loop: when the loop and a margin
+     * around it fit in kHotLoopSamples the span is mirrored, otherwise the
+     * mirror is off. Each sample of the buffer has its own slot in the ring,
+     * so when the loop moves or changes its length only the samples that
+     * weren't already there are copied. The writes go to both the buffer and
+     * the mirror: the stores to the SDRAM don't stall like the loads do, and
+     * this way the buffer stays up to date for everything else reading it
+     * (the freeze, the undo history, saving the loops). The other changes to
+     * the buffer (clearing it, undoing, restoring the loops) are not seen by
+     * the mirror, which must be invalidated then.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T>
+    class HotLoop
+    {
+    public:
+        HotLoop() {}
+        ~HotLoop() {}
+
+        /**
+         * @brief Mirrors the span of the given loop if it's short enough,
+         * copying the samples that aren't mirrored yet. Inverted loops,
+         * wrapping around the buffer end, are not mirrored.
+         *
+         * @param buffer
+         * @param stride The distance between two consecutive samples
+         * @param loopStart
+         * @param loopEnd The last sample of the loop
+         * @param bufferSamples The written buffer length
+         */
+        void Track(const T *buffer, int32_t stride, int32_t loopStart, int32_t loopEnd, int32_t bufferSamples)
+        {
+            int32_t from = loopStart - kHotLoopMargin;
+            int32_t to = loopEnd + 1 + kHotLoopMargin;
+            from = from < 0 ? 0 : from;
+            to = to > bufferSamples ? bufferSamples : to;
+            if (loopEnd < loopStart || from >= to || to - from > kHotLoopSamples)
+            {
+                Invalidate();
+
+                return;
+            }
+            if (from == start_ && to == end_)
+            {
+                return;
+            }
+
+            for (int32_t i = from; i < to; i++)
+            {
+                if (!Contains(i))
+                {
+                    samples_[i & kMask] = buffer[i * stride];
+                }
+            }
+            start_ = from;
+            end_ = to;
+        }
+
+        /**
+         * @brief Tells whether the given sample is mirrored.
+         *
+         * @param index
+         * @return true
+         * @return false
+         */
+        inline bool Contains(int32_t index)
+        {
+            return static_cast<uint32_t>(index - start_) < static_cast<uint32_t>(end_ - start_);
+        }
+
+        inline T Get(int32_t index)
+        {
+            return samples_[index & kMask];
+        }
+
+        /**
+         * @brief Keeps the mirror coherent with the buffer, call this when
+         * writing the given sample.
+         *
+         * @param index
+         * @param value
+         */
+        inline void Refresh(int32_t index, T value)
+        {
+            if (Contains(index))
+            {
+                samples_[index & kMask] = value;
+            }
+        }
+
+        /**
+         * @brief Turns the mirror off, call this when the buffer is changed
+         * other than by writing.
+         */
+        void Invalidate()
+        {
+            start_ = 0;
+            end_ = 0;
+        }
+
+        inline bool IsActive() { return end_ > start_; }
+
+    private:
+        static constexpr int32_t kMask{kHotLoopSamples - 1};
+        static_assert((kHotLoopSamples & kMask) == 0, "The hot loop size must be a power of two");
+
+        T samples_[kHotLoopSamples]{};
+        int32_t start_{}; // The first sample mirrored
+        int32_t end_{};   // The sample after the last one mirrored
+    };
+} // namespace wreath
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <limits>
+
+namespace wreath
+{
+    /**
+     * @brief Interpolation policies used by the heads when reading at a
+     * fractional position. The sample function returns the value of the given
+     * tap, relative to the integral position and in the direction of the head
+     * (0 is the current sample, 1 the next one, -1 the previous one).
+     */
+
+    /**
+     * @brief No interpolation, the integral position is read. This is the
+     * cheapest one, but it sounds gritty at fractional rates.
+     */
+    struct NoInterpolation
+    {
+        template <typename F>
+        static inline float Interpolate(F sample, float)
+        {
+            return sample(0);
+        }
+    };
+
+    /**
+     * @brief Linear interpolation between the current and the next sample.
+     */
+    struct LinearInterpolation
+    {
+        template <typename F>
+        static inline float Interpolate(F sample, float frac)
+        {
+            float value = sample(0);
+
+            // Interpolate value only it the index has a fractional part.
+            if (frac > std::numeric_limits<float>::epsilon())
+            {
+                value = value + (sample(1) - value) * frac;
+            }
+
+            return value;
+        }
+    };
+
+    /**
+     * @brief 4-point, 3rd-order Hermite interpolation. The most expensive one,
+     * with less aliasing at fractional rates.
+     * @see http://yehar.com/blog/wp-content/uploads/2009/08/deip.pdf
+     */
+    struct HermiteInterpolation
+    {
+        template <typename F>
+        static inline float Interpolate(F sample, float frac)
+        {
+            float x0 = sample(0);
+            if (frac <= std::numeric_limits<float>::epsilon())
+            {
+                return x0;
+            }
+
+            float xm1 = sample(-1);
+            float x1 = sample(1);
+            float x2 = sample(2);
+            float c1 = 0.5f * (x1 - xm1);
+            float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+            float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+
+            return ((c3 * frac + c2) * frac + c1) * frac + x0;
+        }
+    };
+} // namespace wreath
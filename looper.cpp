@@ -4,12 +4,30 @@
 using namespace wreath;
 using namespace daisysp;
 
-void Looper::Init(int32_t sampleRate, float *buffer, float *buffer2, int32_t maxBufferSamples)
+template <typename T, typename I>
+void Looper<T, I>::Init(int32_t sampleRate, T *buffer, T *freezeBuffer, int32_t maxBufferSamples, int32_t maxFreezeSamples, int32_t bufferStride)
 {
     sampleRate_ = sampleRate;
-    readHeads_[0].Init(buffer, buffer2, maxBufferSamples);
-    readHeads_[1].Init(buffer, buffer2, maxBufferSamples);
-    writeHead_.Init(buffer, buffer2, maxBufferSamples);
+    buffer_ = buffer;
+    eraser_.Init(buffer, maxBufferSamples, bufferStride);
+    freezeBuffer_.Init(buffer, &eraser_, freezeBuffer, freezeBuffer ? (maxFreezeSamples > 0 ? maxFreezeSamples : maxBufferSamples) : 0, bufferStride);
+    bufferStride_ = bufferStride;
+    timing_.Init(sampleRate_);
+    readHeads_[0].Init(buffer, &freezeBuffer_, &eraser_, maxBufferSamples, timing_.samplesToFade, bufferStride);
+    readHeads_[1].Init(buffer, &freezeBuffer_, &eraser_, maxBufferSamples, timing_.samplesToFade, bufferStride);
+    writeHead_.Init(buffer, &freezeBuffer_, &eraser_, maxBufferSamples, timing_.samplesToFade, bufferStride);
+    InitPeaks(nullptr);
+    InitUndo(nullptr, nullptr, 0);
+    grains_.Init(sampleRate_, &random_);
+#if defined(WREATH_STAGED_READS)
+    readHeads_[0].SetStage(&stages_[0]);
+    readHeads_[1].SetStage(&stages_[1]);
+#endif
+#if defined(WREATH_HOT_LOOPS)
+    readHeads_[0].SetHot(&hot_);
+    readHeads_[1].SetHot(&hot_);
+    writeHead_.SetHot(&hot_);
+#endif
     Reset();
     movement_ = Movement::NORMAL;
     direction_ = Direction::FORWARD;
@@ -29,13 +47,16 @@ void Looper::Init(int32_t sampleRate, float *buffer, float *buffer2, int32_t max
     writeHead_.SetLooping(true);
 }
 
-void Looper::Reset()
+template <typename T, typename I>
+void Looper<T, I>::Reset()
 {
-    std::srand(static_cast<unsigned>(time(0)));
-    eRand_ = std::rand() / (float)RAND_MAX;
+    eRand_ = random_.NextFloat();
     readHeads_[0].Reset();
     readHeads_[1].Reset();
     writeHead_.Reset();
+    freezeBuffer_.Release();
+    grains_.Reset();
+    grainsMix_ = 0.f;
     bufferSamples_ = 0;
     bufferSeconds_ = 0.f;
     loopStart_ = 0;
@@ -50,12 +71,58 @@ void Looper::Reset()
     writePos_ = 0.f;
 }
 
-void Looper::ClearBuffer()
+template <typename T, typename I>
+void Looper<T, I>::SetSeed(uint32_t seed)
+{
+    random_.Seed(seed);
+}
+
+template <typename T, typename I>
+void Looper<T, I>::Update(int32_t samples)
+{
+    eraser_.Erase(samples);
+    peaks_.SetLength(bufferSamples_);
+    peaks_.Publish();
+    undo_.Restore(samples, [this](int32_t from, int32_t to)
+                  { Reload(from, to); });
+    freezeBuffer_.Copy(samples);
+    if (grains_.IsEnabled() || grains_.GetActive())
+    {
+        grains_.Schedule(samples, readPos_, readRate_, direction_, loopStart_, loopLength_, bufferSamples_);
+    }
+#if defined(WREATH_STAGED_READS)
+    readHeads_[0].Stage(samples);
+    readHeads_[1].Stage(samples);
+#endif
+#if defined(WREATH_HOT_LOOPS)
+    // While erasing the buffer, the heads read from it directly.
+    if (eraser_.IsErasing())
+    {
+        hot_.Invalidate();
+    }
+    else
+    {
+        hot_.Track(buffer_, bufferStride_, intLoopStart_, intLoopEnd_, bufferSamples_);
+    }
+#endif
+}
+
+template <typename T, typename I>
+void Looper<T, I>::ClearBuffer()
 {
     writeHead_.ClearBuffer();
+    undo_.Clear();
+#if defined(WREATH_STAGED_READS)
+    stages_[0].Invalidate();
+    stages_[1].Invalidate();
+#endif
+#if defined(WREATH_HOT_LOOPS)
+    hot_.Invalidate();
+#endif
 }
 
-bool Looper::Buffer(float value)
+template <typename T, typename I>
+bool Looper<T, I>::Buffer(float value)
 {
     bool end = writeHead_.Buffer(value);
     bufferSamples_ = writeHead_.GetBufferSamples();
@@ -64,9 +131,39 @@ bool Looper::Buffer(float value)
     return end;
 }
 
-void Looper::StopBuffering()
+template <typename T, typename I>
+void Looper<T, I>::Restore(int32_t samples)
+{
+    writeHead_.SetBufferSamples(samples);
+    bufferSamples_ = writeHead_.GetBufferSamples();
+    bufferSeconds_ = bufferSamples_ / static_cast<float>(sampleRate_);
+    StopBuffering();
+}
+
+template <typename T, typename I>
+void Looper<T, I>::Reload(int32_t from, int32_t to)
+{
+    IndexPeaks(from, to);
+#if defined(WREATH_STAGED_READS)
+    stages_[0].Invalidate();
+    stages_[1].Invalidate();
+#endif
+#if defined(WREATH_HOT_LOOPS)
+    hot_.Invalidate();
+#endif
+}
+
+template <typename T, typename I>
+void Looper<T, I>::StopBuffering()
 {
     float samples = writeHead_.StopBuffering();
+#if defined(WREATH_STAGED_READS)
+    stages_[0].Invalidate();
+    stages_[1].Invalidate();
+#endif
+#if defined(WREATH_HOT_LOOPS)
+    hot_.Invalidate();
+#endif
     readHeads_[0].InitBuffer(samples);
     readHeads_[1].InitBuffer(samples);
     loopStart_ = 0;
@@ -78,7 +175,8 @@ void Looper::StopBuffering()
     loopLengthSeconds_ = loopLength_ / sampleRate_;
 }
 
-void Looper::StartReading(bool now)
+template <typename T, typename I>
+void Looper<T, I>::StartReading(bool now)
 {
     if (readingActive_)
     {
@@ -90,11 +188,12 @@ void Looper::StartReading(bool now)
     readingActive_ = true;
     if (!now)
     {
-        startReadingFade.Init(Fader::FadeType::FADE_SINGLE, kSamplesToFadeTrigger, readRate_);
+        startReadingFade.Init(Fader::FadeType::FADE_SINGLE, timing_.samplesToFadeTrigger, readRate_);
     }
 }
 
-void Looper::StopReading(bool now)
+template <typename T, typename I>
+void Looper<T, I>::StopReading(bool now)
 {
     if (!readingActive_)
     {
@@ -109,11 +208,12 @@ void Looper::StopReading(bool now)
     }
     else
     {
-        stopReadingFade.Init(Fader::FadeType::FADE_SINGLE, kSamplesToFadeTrigger, readRate_);
+        stopReadingFade.Init(Fader::FadeType::FADE_SINGLE, timing_.samplesToFadeTrigger, readRate_);
     }
 }
 
-void Looper::StartWriting(bool now)
+template <typename T, typename I>
+void Looper<T, I>::StartWriting(bool now)
 {
     if (writingActive_)
     {
@@ -123,11 +223,12 @@ void Looper::StartWriting(bool now)
     writingActive_ = true;
     if (!now)
     {
-        startWritingFade.Init(Fader::FadeType::FADE_SINGLE, kSamplesToFadeTrigger, writeRate_);
+        startWritingFade.Init(Fader::FadeType::FADE_SINGLE, timing_.samplesToFadeTrigger, writeRate_);
     }
 }
 
-void Looper::StopWriting(bool now)
+template <typename T, typename I>
+void Looper<T, I>::StopWriting(bool now)
 {
     if (!writingActive_)
     {
@@ -140,11 +241,12 @@ void Looper::StopWriting(bool now)
     }
     else
     {
-        stopWritingFade.Init(Fader::FadeType::FADE_SINGLE, kSamplesToFadeTrigger, writeRate_);
+        stopWritingFade.Init(Fader::FadeType::FADE_SINGLE, timing_.samplesToFadeTrigger, writeRate_);
     }
 }
 
-void Looper::Trigger(bool restart)
+template <typename T, typename I>
+void Looper<T, I>::Trigger(bool restart)
 {
     // Update the loop start
     readHeads_[0].SetLoopStart(loopStart_);
@@ -168,19 +270,22 @@ void Looper::Trigger(bool restart)
         }
         StartReading(false);
     }
+    ResetCrossPoint();
 }
 
-void Looper::SetSamplesToFade(float samples)
+template <typename T, typename I>
+void Looper<T, I>::SetSamplesToFade(float samples)
 {
     readHeads_[0].SetSamplesToFade(samples);
     readHeads_[1].SetSamplesToFade(samples);
     writeHead_.SetSamplesToFade(samples);
 }
 
-void Looper::SetLoopStart(float start)
+template <typename T, typename I>
+void Looper<T, I>::SetLoopStart(float start)
 {
     // Do not change value if there's a loop fade going.
-    if (loopFade.IsActive() && loopLength_ > kMinSamplesForFlanger)
+    if (loopFade.IsActive() && loopLength_ > timing_.minSamplesForFlanger)
     {
         return;
     }
@@ -192,10 +297,10 @@ void Looper::SetLoopStart(float start)
     loopStart_ = readHeads_[!activeReadHead_].SetLoopStart(start);
 
     // Also change the active one if the loop is short or we are not reading.
-    if (loopLength_ <= kMinSamplesForFlanger || !readingActive_)
+    if (loopLength_ <= timing_.minSamplesForFlanger || !readingActive_)
     {
         readHeads_[activeReadHead_].SetLoopStart(loopStart_);
-        if (loopLength_ <= kMinSamplesForFlanger)
+        if (loopLength_ <= timing_.minSamplesForFlanger)
         {
             // Keep the heads inside the loop.
             readHeads_[0].ResetPosition();
@@ -211,7 +316,7 @@ void Looper::SetLoopStart(float start)
     loopStartSeconds_ = loopStart_ / static_cast<float>(sampleRate_);
     loopEnd_ = readHeads_[!activeReadHead_].GetLoopEnd();
     intLoopEnd_ = loopEnd_;
-    crossPointFound_ = false;
+    ResetCrossPoint();
 
     // In delay mode, keep the loop synched.
     if (loopSync_)
@@ -220,10 +325,11 @@ void Looper::SetLoopStart(float start)
     }
 }
 
-void Looper::SetLoopLength(float length)
+template <typename T, typename I>
+void Looper<T, I>::SetLoopLength(float length)
 {
     // Do not change value if there's a loop fade going.
-    if (loopFade.IsActive() && loopLength_ > kMinSamplesForFlanger)
+    if (loopFade.IsActive() && loopLength_ > timing_.minSamplesForFlanger)
     {
         return;
     }
@@ -235,7 +341,7 @@ void Looper::SetLoopLength(float length)
     loopLength_ = readHeads_[!activeReadHead_].SetLoopLength(length);
 
     // Also change the active one if the loop is short or we are not reading.
-    if (length <= kMinSamplesForFlanger || !readingActive_)
+    if (length <= timing_.minSamplesForFlanger || !readingActive_)
     {
         readHeads_[activeReadHead_].SetLoopLength(loopLength_);
     }
@@ -244,7 +350,7 @@ void Looper::SetLoopLength(float length)
     loopLengthSeconds_ = loopLength_ / sampleRate_;
     loopEnd_ = readHeads_[!activeReadHead_].GetLoopEnd();
     intLoopEnd_ = loopEnd_;
-    crossPointFound_ = false;
+    ResetCrossPoint();
 
     // In delay mode, keep the loop synched.
     if (loopSync_)
@@ -253,14 +359,15 @@ void Looper::SetLoopLength(float length)
     }
 }
 
-void Looper::SetReadRate(float rate)
+template <typename T, typename I>
+void Looper<T, I>::SetReadRate(float rate)
 {
     readHeads_[0].SetRate(rate);
     readHeads_[1].SetRate(rate);
     readRate_ = rate;
     readSpeed_ = sampleRate_ * readRate_;
     sampleRateSpeed_ = static_cast<int32_t>(sampleRate_ / readRate_);
-    crossPointFound_ = false;
+    ResetCrossPoint();
     // In delay mode, when setting the rate back to 1 we flag for a realignment
     // of the heads at the next loop to keep the correct delay time.
     if (loopSync_ && rate == 1.f)
@@ -269,53 +376,84 @@ void Looper::SetReadRate(float rate)
     }
 }
 
-void Looper::SetWriteRate(float rate)
+template <typename T, typename I>
+void Looper<T, I>::SetWriteRate(float rate)
 {
     writeHead_.SetRate(rate);
     writeRate_ = rate;
     writeSpeed_ = sampleRate_ * writeRate_;
-    crossPointFound_ = false;
+    ResetCrossPoint();
+}
+
+template <typename T, typename I>
+void Looper<T, I>::SetGrainDensity(float density)
+{
+    grains_.SetDensity(density);
+}
+
+template <typename T, typename I>
+void Looper<T, I>::SetGrainSize(float size)
+{
+    grains_.SetSize(size);
+}
+
+template <typename T, typename I>
+void Looper<T, I>::SetGrainSpread(float spread)
+{
+    grains_.SetSpread(spread);
+}
+
+template <typename T, typename I>
+void Looper<T, I>::SetGrainVoices(int32_t voices)
+{
+    grains_.SetVoices(voices);
 }
 
-void Looper::SetMovement(Movement movement)
+template <typename T, typename I>
+void Looper<T, I>::SetMovement(Movement movement)
 {
     readHeads_[0].SetMovement(movement);
     readHeads_[1].SetMovement(movement);
     movement_ = movement;
 }
 
-void Looper::SetDirection(Direction direction)
+template <typename T, typename I>
+void Looper<T, I>::SetDirection(Direction direction)
 {
     readHeads_[0].SetDirection(direction);
     readHeads_[1].SetDirection(direction);
     direction_ = direction;
-    crossPointFound_ = false;
+    ResetCrossPoint();
 }
 
-void Looper::SetReadPos(float position)
+template <typename T, typename I>
+void Looper<T, I>::SetReadPos(float position)
 {
     readHeads_[0].SetIndex(position);
     readHeads_[1].SetIndex(position);
     readPos_ = position;
-    crossPointFound_ = false;
+    ResetCrossPoint();
 }
 
-void Looper::SetWritePos(float position)
+template <typename T, typename I>
+void Looper<T, I>::SetWritePos(float position)
 {
     writeHead_.SetIndex(position);
     writePos_ = position;
-    crossPointFound_ = false;
+    ResetCrossPoint();
 }
 
-void Looper::SetLooping(bool looping)
+template <typename T, typename I>
+void Looper<T, I>::SetLooping(bool looping)
 {
     readHeads_[0].SetLooping(looping);
     readHeads_[1].SetLooping(looping);
     looping_ = looping;
-    crossPointFound_ = false;
+    ResetCrossPoint();
 }
 
-void Looper::SetLoopSync(bool loopSync)
+template <typename T, typename I>
+void Looper<T, I>::SetLoopSync(bool loopSync)
 {
     // If loopSync = true it means we're in delay mode, so the writing head must
     // loop when the reading head does.
@@ -331,12 +469,14 @@ void Looper::SetLoopSync(bool loopSync)
     readHeads_[0].SetLoopSync(loopSync_);
     readHeads_[1].SetLoopSync(loopSync_);
     writeHead_.SetLoopSync(loopSync_);
-    crossPointFound_ = false;
+    ResetCrossPoint();
 }
 
-float Looper::Read()
+template <typename T, typename I>
+float Looper<T, I>::Read()
 {
-    float value = readHeads_[activeReadHead_].Read();
+    // Once the grains have faded in, the head is no longer heard.
+    float value = grainsMix_ < 1.f ? readHeads_[activeReadHead_].Read() : 0.f;
 
     // Fade in reading.
     if (startReadingFade.IsActive())
@@ -364,6 +504,7 @@ float Looper::Read()
                 }
                 StartReading(false);
                 triggered_ = false;
+                ResetCrossPoint();
             }
         }
         value = stopReadingFade.GetOutput();
@@ -375,18 +516,29 @@ float Looper::Read()
 
     if (loopFade.IsActive())
     {
-        if (Fader::FadeStatus::ENDED == loopFade.Process(readHeads_[!activeReadHead_].Read(), value))
+        float other = grainsMix_ < 1.f ? readHeads_[!activeReadHead_].Read() : 0.f;
+        if (Fader::FadeStatus::ENDED == loopFade.Process(other, value))
         {
             readHeads_[!activeReadHead_].SetLoopStartAndLength(loopStart_, loopLength_);
             readHeads_[!activeReadHead_].SetIndex(readPos_);
             if (loopSync_)
             {
                 writeHead_.SetIndex(readPos_);
+                ResetCrossPoint();
             }
         }
         value = loopFade.GetOutput();
     }
 
+    if (grains_.IsEnabled() || grains_.GetActive() || grainsMix_ > 0.f)
+    {
+        // The head fades out while the grains come in, and back in when they
+        // are turned off, the grains playing are let end.
+        float step = 1.f / timing_.samplesToFade;
+        grainsMix_ = grains_.IsEnabled() ? std::min(grainsMix_ + step, 1.f) : std::max(grainsMix_ - step, 0.f);
+        value = value * (1.f - grainsMix_) + grains_.Process(readHeads_[activeReadHead_]);
+    }
+
     if (freeze_ > 0)
     {
         // Crossfade with the frozen buffer.
@@ -403,7 +555,8 @@ float Looper::Read()
     return value;
 }
 
-void Looper::Write(float input)
+template <typename T, typename I>
+void Looper<T, I>::Write(float input)
 {
     // Fade in writing.
     if (startWritingFade.IsActive())
@@ -432,13 +585,23 @@ void Looper::Write(float input)
     }
 
     writeHead_.Write(input);
+#if defined(WREATH_STAGED_READS)
+    // Keep the staged spans coherent with the buffer.
+    T value = SampleFormat<T>::Store(input);
+    stages_[0].Refresh(writeHead_.GetIntPosition(), value);
+    stages_[1].Refresh(writeHead_.GetIntPosition(), value);
+#endif
+#if defined(WREATH_HOT_LOOPS)
+    hot_.Refresh(writeHead_.GetIntPosition(), SampleFormat<T>::Store(input));
+#endif
 }
 
-float Looper::Degrade(float input)
+template <typename T, typename I>
+float Looper<T, I>::Degrade(float input)
 {
     if (degradation_ > 0.f)
     {
-        float d = 1.f - ((std::rand() / (float)RAND_MAX) * degradation_) * 0.5f;
+        float d = 1.f - (random_.NextFloat() * degradation_) * 0.5f;
 
         // Use an Euclidean rhythm generator to apply degradation at fixed
         // buffer points
@@ -448,7 +611,8 @@ float Looper::Degrade(float input)
     return input;
 }
 
-void Looper::FadeReadingToResetPosition()
+template <typename T, typename I>
+void Looper<T, I>::FadeReadingToResetPosition()
 {
     if (loopFade.IsActive())
     {
@@ -485,9 +649,10 @@ void Looper::FadeReadingToResetPosition()
     activeReadHead_ = !activeReadHead_;
 }
 
-void Looper::UpdateReadPos()
+template <typename T, typename I>
+void Looper<T, I>::UpdateReadPos()
 {
-    Head::Action action = readHeads_[activeReadHead_].UpdatePosition();
+    Action action = readHeads_[activeReadHead_].UpdatePosition();
 
     // When the loop length shrunk, the inactive reading head dictates when
     // looping occurs, so we need to update its position as well.
@@ -498,29 +663,32 @@ void Looper::UpdateReadPos()
     // Otherwise, just sync it with the active reading head.
     else
     {
-        readHeads_[!activeReadHead_].SetIndex(readHeads_[activeReadHead_].GetPosition());
+        readHeads_[!activeReadHead_].SetPhase(readHeads_[activeReadHead_].GetPhase());
         readHeads_[!activeReadHead_].SetOffset(readHeads_[activeReadHead_].GetOffset());
     }
 
+    // Anything beside the heads' motion only happens on these conditions.
+    readEvent_ = Action::NO_ACTION != action || loopChanged_;
+
     // Note that in delay mode we don't need to fade the loop, and we wouldn't do
     // it anyway because it'd need a few samples from outside the loop and these
     // samples are probably unrelated.Fading when the loop changes yields the
     // same problem, but it sounds better than if we don't.
     // Also note that when going backwards, when the loop changes we fade right
     // away.
-    if ((loopChanged_ && !IsGoingForward()) || (Head::Action::LOOP == action && loopLength_ > kMinSamplesForFlanger && (loopChanged_ || (!loopSync_ && loopLength_ < bufferSamples_))))
+    if ((loopChanged_ && !IsGoingForward()) || (Action::LOOP == action && loopLength_ > timing_.minSamplesForFlanger && (loopChanged_ || (!loopSync_ && loopLength_ < bufferSamples_))))
     {
         FadeReadingToResetPosition();
         loopChanged_ = false;
     }
     // Here we handle normal looping in delay mode or when the loop length is
     // small.
-    else if (Head::Action::LOOP == action && (loopLength_ <= kMinSamplesForFlanger || loopSync_) && loopLength_ < bufferSamples_)
+    else if (Action::LOOP == action && (loopLength_ <= timing_.minSamplesForFlanger || loopSync_) && loopLength_ < bufferSamples_)
     {
         readHeads_[0].ResetPosition();
         readHeads_[1].ResetPosition();
     }
-    else if (Head::Action::STOP == action)
+    else if (Action::STOP == action)
     {
         StopReading(false);
     }
@@ -529,12 +697,14 @@ void Looper::UpdateReadPos()
     readPosSeconds_ = readPos_ / sampleRate_;
 }
 
-void Looper::UpdateWritePos()
+template <typename T, typename I>
+void Looper<T, I>::UpdateWritePos()
 {
-    Head::Action action = writeHead_.UpdatePosition();
+    Action action = writeHead_.UpdatePosition();
     writePos_ = writeHead_.GetIntPosition();
+    writeEvent_ = false;
 
-    if (Head::Action::LOOP == action && loopSync_)
+    if (Action::LOOP == action && loopSync_)
     {
         // Loop the writing head.
         if (loopLength_ < bufferSamples_)
@@ -550,6 +720,7 @@ void Looper::UpdateWritePos()
             readHeads_[0].ResetPosition();
             readHeads_[1].ResetPosition();
             mustSyncHeads_ = false;
+            writeEvent_ = true;
         }
     }
 
@@ -558,6 +729,19 @@ void Looper::UpdateWritePos()
     // fade at that point.
     if (freeze_ < 1.f && !headsCrossFade.IsActive() && (readSpeed_ != writeSpeed_ || !IsGoingForward()))
     {
+        // Nothing can happen until the countdown expires, as long as the heads
+        // keep moving steadily.
+        if (readEvent_ || Action::NO_ACTION != action)
+        {
+            crossPointCountdown_ = 0;
+        }
+        if (crossPointCountdown_ > 0 && readHeads_[activeReadHead_].GetStepsToEvent() > 0 && writeHead_.GetStepsToEvent() > 0)
+        {
+            crossPointCountdown_--;
+
+            return;
+        }
+
         headsDistance_ = CalculateDistance(readPos_, writePos_, readSpeed_, writeSpeed_, direction_);
 
         // Calculate the cross point when the two heads are close enough.
@@ -574,31 +758,194 @@ void Looper::UpdateWritePos()
             {
                 crossPointFound_ = false;
                 headsCrossFade.Init(Fader::FadeType::FADE_OUT_IN, samples * 2, writeRate_);
+                writeEvent_ = true;
             }
+            else
+            {
+                ScheduleCrossPoint(writePos_, crossPoint_, samples, writeHead_.GetSamplesToFade(), writeHead_.GetRate());
+            }
+        }
+        else
+        {
+            ScheduleCrossPoint(readPos_, writePos_, headsDistance_, writeHead_.GetSamplesToFade() * 2, readHeads_[activeReadHead_].GetRate() + writeHead_.GetRate());
+        }
+    }
+    else
+    {
+        crossPointCountdown_ = 0;
+    }
+}
+
+template <typename T, typename I>
+void Looper<T, I>::ScheduleCrossPoint(float a, float b, float distance, float threshold, float rate)
+{
+    // The distance stays a linear function of time as long as the points
+    // don't cross each other or the loop boundaries and the heads don't meet
+    // one of theirs. Until then, it can't change faster than the points'
+    // combined rate (plus the writing head's rounding to the integer
+    // position), so we count the updates it takes to enter the range where
+    // something must be done. Two of them are spared for the rounding errors.
+    float margin = distance > threshold ? distance - threshold : -distance;
+    float gaps[]{a - b, a - loopStart_, a - loopEnd_, b - loopStart_, b - loopEnd_};
+    for (float gap : gaps)
+    {
+        margin = std::min(margin, std::abs(gap));
+    }
+    float steps = margin / (rate + 1.f) - 2.f;
+    steps = std::min(steps, static_cast<float>(std::min(readHeads_[activeReadHead_].GetStepsToEvent(), writeHead_.GetStepsToEvent())));
+    crossPointCountdown_ = steps > 0 ? static_cast<int32_t>(steps) : 0;
+}
+
+template <typename T, typename I>
+void Looper<T, I>::FollowReadPos(const Looper &leader)
+{
+    readHeads_[0].Follow(leader.readHeads_[0]);
+    readHeads_[1].Follow(leader.readHeads_[1]);
+
+    // Replay what the leader did besides moving: switching heads, starting a
+    // fade.
+    if (leader.readEvent_)
+    {
+        activeReadHead_ = leader.activeReadHead_;
+        loopChanged_ = leader.loopChanged_;
+        loopLengthGrown_ = leader.loopLengthGrown_;
+        loopFade = leader.loopFade;
+        stopReadingFade = leader.stopReadingFade;
+    }
+
+    readPos_ = leader.readPos_;
+    readPosSeconds_ = leader.readPosSeconds_;
+}
+
+template <typename T, typename I>
+void Looper<T, I>::FollowWritePos(const Looper &leader)
+{
+    writeHead_.Follow(leader.writeHead_);
+    writePos_ = leader.writePos_;
+
+    if (leader.writeEvent_)
+    {
+        readHeads_[0].Follow(leader.readHeads_[0]);
+        readHeads_[1].Follow(leader.readHeads_[1]);
+        mustSyncHeads_ = leader.mustSyncHeads_;
+        headsCrossFade = leader.headsCrossFade;
+    }
+
+    headsDistance_ = leader.headsDistance_;
+    crossPoint_ = leader.crossPoint_;
+    crossPointFound_ = leader.crossPointFound_;
+    crossPointCountdown_ = leader.crossPointCountdown_;
+}
+
+template <typename T, typename I>
+bool Looper<T, I>::IsLinkableWith(const Looper &other) const
+{
+    const Fader *fades[]{&loopFade, &triggerFade, &headsCrossFade, &loopLengthFade, &frozenFade, &startReadingFade, &stopReadingFade, &startWritingFade, &stopWritingFade,
+                         &other.loopFade, &other.triggerFade, &other.headsCrossFade, &other.loopLengthFade, &other.frozenFade, &other.startReadingFade, &other.stopReadingFade, &other.startWritingFade, &other.stopWritingFade};
+    for (const Fader *fade : fades)
+    {
+        if (fade->IsActive())
+        {
+            return false;
         }
     }
+
+    return bufferSamples_ == other.bufferSamples_ && loopStart_ == other.loopStart_ && loopLength_ == other.loopLength_ &&
+           readRate_ == other.readRate_ && writeRate_ == other.writeRate_ && readSpeed_ == other.readSpeed_ && writeSpeed_ == other.writeSpeed_ &&
+           direction_ == other.direction_ && movement_ == other.movement_ && freeze_ == other.freeze_ &&
+           looping_ == other.looping_ && loopSync_ == other.loopSync_ && mustSyncHeads_ == other.mustSyncHeads_ &&
+           readingActive_ == other.readingActive_ && writingActive_ == other.writingActive_ &&
+           loopChanged_ == other.loopChanged_ && loopLengthGrown_ == other.loopLengthGrown_ && triggered_ == other.triggered_ &&
+           crossPoint_ == other.crossPoint_ && crossPointFound_ == other.crossPointFound_ && headsDistance_ == other.headsDistance_ &&
+           activeReadHead_ == other.activeReadHead_ && readPos_ == other.readPos_ && writePos_ == other.writePos_ &&
+           writeHead_.IsLinkableWith(other.writeHead_) && readHeads_[0].IsLinkableWith(other.readHeads_[0]) && readHeads_[1].IsLinkableWith(other.readHeads_[1]);
+}
+
+template <typename T, typename I>
+void Looper<T, I>::InitPeaks(PeakIndex::Bucket *buckets)
+{
+    peaks_.Init(buckets, writeHead_.GetMaxBufferSamples());
+    writeHead_.SetPeaks(buckets ? &peaks_ : nullptr);
+}
+
+template <typename T, typename I>
+void Looper<T, I>::InitUndo(T *pool, typename UndoHistory<T>::Record *records, int32_t pages)
+{
+    undo_.Init(buffer_, &eraser_, &freezeBuffer_, writeHead_.GetMaxBufferSamples(), pool, records, pages, bufferStride_);
+    writeHead_.SetUndo(pool ? &undo_ : nullptr);
+}
+
+template <typename T, typename I>
+bool Looper<T, I>::Undo()
+{
+    return undo_.Undo();
+}
+
+template <typename T, typename I>
+bool Looper<T, I>::Redo()
+{
+    return undo_.Redo();
+}
+
+template <typename T, typename I>
+void Looper<T, I>::GetPeaks(float start, float length, PeakIndex::Peak *peaks, int32_t pixels)
+{
+    peaks_.GetPeaks(start, length, bufferSamples_, peaks, pixels,
+                    [this](int32_t i)
+                    { return eraser_.IsPending(i) ? 0.f : SampleFormat<T>::Load(buffer_[i * bufferStride_]); });
+}
+
+template <typename T, typename I>
+void Looper<T, I>::IndexPeaks(int32_t from, int32_t to)
+{
+    peaks_.Index(from, std::min(to, writeHead_.GetMaxBufferSamples()),
+                 [this](int32_t i)
+                 { return SampleFormat<T>::Load(buffer_[i * bufferStride_]); });
+}
+
+template <typename T, typename I>
+uint32_t Looper<T, I>::GetFades() const
+{
+    return (loopFade.IsActive() ? FADING_LOOP : 0u) | (triggerFade.IsActive() ? FADING_TRIGGER : 0u) |
+           (headsCrossFade.IsActive() ? FADING_HEADS_CROSS : 0u) | (loopLengthFade.IsActive() ? FADING_LOOP_LENGTH : 0u) |
+           (frozenFade.IsActive() ? FADING_FROZEN : 0u) |
+           (startReadingFade.IsActive() || stopReadingFade.IsActive() ? FADING_READING : 0u) |
+           (startWritingFade.IsActive() || stopWritingFade.IsActive() ? FADING_WRITING : 0u);
 }
 
-void Looper::ToggleDirection()
+template <typename T, typename I>
+void Looper<T, I>::ToggleDirection()
 {
     direction_ = readHeads_[0].ToggleDirection();
     readHeads_[1].ToggleDirection();
 }
 
-void Looper::SetFreeze(float amount)
+template <typename T, typename I>
+void Looper<T, I>::SetFreeze(float amount)
 {
+    // The snapshot is taken when freezing and released when unfreezing.
+    if (amount > 0 && freeze_ <= 0)
+    {
+        freezeBuffer_.Snapshot(bufferSamples_, intLoopStart_, intLoopLength_, writeHead_.GetIntPosition());
+    }
+    else if (amount <= 0 && freeze_ > 0)
+    {
+        freezeBuffer_.Release();
+    }
     freeze_ = amount;
     readHeads_[0].SetFreeze(amount);
     readHeads_[1].SetFreeze(amount);
     writeHead_.SetFreeze(amount);
 }
 
-void Looper::SetDegradation(float amount)
+template <typename T, typename I>
+void Looper<T, I>::SetDegradation(float amount)
 {
     degradation_ = amount;
 }
 
-float Looper::CalculateDistance(float a, float b, float aSpeed, float bSpeed, Direction direction)
+template <typename T, typename I>
+float Looper<T, I>::CalculateDistance(float a, float b, float aSpeed, float bSpeed, Direction direction)
 {
     if (a == b)
     {
@@ -628,7 +975,8 @@ float Looper::CalculateDistance(float a, float b, float aSpeed, float bSpeed, Di
     return (!IsGoingForward() || bSpeed > aSpeed) ? loopLength_ - (b - a) : b - a;
 }
 
-void Looper::CalculateCrossPoint()
+template <typename T, typename I>
+void Looper<T, I>::CalculateCrossPoint()
 {
     // Do not calculate the cross point if the write head is outside of
     // the loop (this is especially true in looper mode, when it roams
@@ -679,4 +1027,12 @@ void Looper::CalculateCrossPoint()
     crossPoint_ = std::floor(crossPoint_);
 
     crossPointFound_ = true;
-}
\ No newline at end of file
+}
+
+// The supported buffer storage formats and interpolations.
+template class wreath::Looper<float, NoInterpolation>;
+template class wreath::Looper<float, LinearInterpolation>;
+template class wreath::Looper<float, HermiteInterpolation>;
+template class wreath::Looper<int16_t, NoInterpolation>;
+template class wreath::Looper<int16_t, LinearInterpolation>;
+template class wreath::Looper<int16_t, HermiteInterpolation>;
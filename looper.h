@@ -1,34 +1,113 @@
 #pragma once
 
+#include "grain_cloud.h"
 #include "head.h"
-#include <ctime>
+#include "peak_index.h"
+#include "random.h"
 #include <cstdint>
 
 namespace wreath
 {
     /**
      * @brief Represents the main looper, with a reading and a writing head.
+     * The template parameters are the buffer storage format (see SampleFormat)
+     * and the interpolation used by the reading heads (see interpolation.h).
      * @author Roberto Noris
      * @date Nov 2021
      */
+    template <typename T, typename I = LinearInterpolation>
     class Looper
     {
     public:
         Looper() {}
         ~Looper() {}
 
+        /**
+         * @brief The fades that may be in progress, see GetFades().
+         */
+        enum FadeFlag : uint32_t
+        {
+            FADING_LOOP = 1 << 0, // Between the reading heads, at the loop's boundaries
+            FADING_TRIGGER = 1 << 1,
+            FADING_HEADS_CROSS = 1 << 2,
+            FADING_LOOP_LENGTH = 1 << 3,
+            FADING_FROZEN = 1 << 4,
+            FADING_READING = 1 << 5, // Starting or stopping reading
+            FADING_WRITING = 1 << 6, // Starting or stopping writing
+        };
+
         /**
          * @brief Initializes the looper the first time.
          *
          * @param sampleRate
          * @param buffer
+         * @param freezeBuffer
          * @param maxBufferSamples
+         * @param maxFreezeSamples The freeze buffer length, if 0 it's the same
+         * as the buffer's. If shorter than the buffer only the loop is frozen.
+         * With no freeze buffer at all (nullptr) freezing holds nothing.
+         * @param bufferStride The distance between two consecutive samples in
+         * the buffer, 2 when it's shared with another looper (interleaved)
+         */
+        void Init(int32_t sampleRate, T *buffer, T *freezeBuffer, int32_t maxBufferSamples, int32_t maxFreezeSamples = 0, int32_t bufferStride = 1);
+        /**
+         * @brief Enables the waveform peak index of the buffer, see
+         * PeakIndex. Call this after Init().
+         *
+         * @param buckets PeakIndex::CountBuckets() of the max buffer length,
+         * nullptr to disable the index
+         */
+        void InitPeaks(PeakIndex::Bucket *buckets);
+        /**
+         * @brief Enables the undo history of the overdubs, see UndoHistory.
+         * Call this after Init().
+         *
+         * @param pool The pages memory, nullptr to disable the history
+         * @param records The records of the pages
+         * @param pages UndoHistory::CountPages() of the pool
+         */
+        void InitUndo(T *pool, typename UndoHistory<T>::Record *records, int32_t pages);
+        /**
+         * @brief Starts undoing the last overdub take, the buffer is restored
+         * by Update() over the next blocks.
+         *
+         * @return true
+         * @return false if there's nothing to undo
          */
-        void Init(int32_t sampleRate, float *buffer, float *buffer2, int32_t maxBufferSamples);
+        bool Undo();
+        /**
+         * @brief Starts redoing the last overdub take undone, see Undo().
+         *
+         * @return true
+         * @return false if there's nothing to redo
+         */
+        bool Redo();
         /**
          * @brief Resets the looper when needed.
          */
         void Reset();
+        /**
+         * @brief Performs the work that is spread over several blocks, like
+         * clearing the buffer and taking the freeze snapshot. It also stages
+         * the buffer for the reading heads when WREATH_STAGED_READS is
+         * defined. It mirrors the short loops when WREATH_HOT_LOOPS is. Call
+         * this once per block.
+         *
+         * @param samples The number of samples in the block
+         */
+        void Update(int32_t samples);
+        /**
+         * @brief Restarts the random sequence used for degradation from the
+         * given seed. It's not affected by Reset(), so the same seed gives the
+         * same results.
+         *
+         * @param seed
+         */
+        void SetSeed(uint32_t seed);
+        /**
+         * @brief Clears the buffer. It's silent right away, the actual erasing
+         * is done by Update() over the next blocks.
+         */
         void ClearBuffer();
         /**
          * @brief Writes the given value in the buffer during the buffering procedure.
@@ -42,6 +121,24 @@ namespace wreath
          * @brief Completes the buffering procedure.
          */
         void StopBuffering();
+        /**
+         * @brief Completes the buffering procedure for a buffer that has been
+         * filled externally (for instance, restoring a saved loop), as if the
+         * given number of samples had been buffered.
+         *
+         * @param samples
+         */
+        void Restore(int32_t samples);
+        /**
+         * @brief Takes into account a span of the buffer that has been filled
+         * otherwise than by the writing head, after Restore() or undoing. The
+         * span is added to the peak index and the copies of the buffer kept
+         * for the reading heads (staged or mirrored) are dropped.
+         *
+         * @param from
+         * @param to The sample after the last one
+         */
+        void Reload(int32_t from, int32_t to);
         /**
          * @brief Starts the reading operation, either with a fade in or immediately
          * depending on the parameter.
@@ -107,6 +204,34 @@ namespace wreath
          * @param rate
          */
         void SetWriteRate(float rate);
+        /**
+         * @brief Sets how many grains start per second in granular mode, 0
+         * turns it off. In granular mode the loop is played by a cloud of
+         * grains around the reading head, see GrainCloud.
+         *
+         * @param density
+         */
+        void SetGrainDensity(float density);
+        /**
+         * @brief Sets the length of the grains, in samples.
+         *
+         * @param size
+         */
+        void SetGrainSize(float size);
+        /**
+         * @brief Sets how far from the reading head the grains start, as a
+         * share of the loop length.
+         *
+         * @param spread
+         */
+        void SetGrainSpread(float spread);
+        /**
+         * @brief Sets how many grains may play at the same time, at most
+         * kMaxGrains.
+         *
+         * @param voices
+         */
+        void SetGrainVoices(int32_t voices);
         /**
          * @brief Sets the reading head movement type.
          *
@@ -174,6 +299,59 @@ namespace wreath
          * @brief Updates the writing position.
          */
         void UpdateWritePos();
+        /**
+         * @brief Updates the reading position following the given looper,
+         * which must have just updated its own. Only the outcome of the
+         * motion is copied, so the two loopers must be linkable.
+         *
+         * @param leader
+         */
+        void FollowReadPos(const Looper &leader);
+        /**
+         * @brief Updates the writing position following the given looper,
+         * which must have just updated its own.
+         *
+         * @param leader
+         */
+        void FollowWritePos(const Looper &leader);
+        /**
+         * @brief Checks whether the looper is in the same state and has the
+         * same parameters as the given one, so that the heads of both can be
+         * moved by a single motion computation. Fades in progress are not
+         * compared, so the loopers are never linkable during one.
+         *
+         * @param other
+         * @return true
+         * @return false
+         */
+        bool IsLinkableWith(const Looper &other) const;
+        /**
+         * @brief Fills the waveform of a window of the buffer, the minimum and
+         * maximum values of each pixel, in O(pixels) when the peak index is
+         * enabled. It can be called outside of the audio callback, a pixel
+         * being written in the meantime may show the peaks before or after.
+         *
+         * @param start The first sample of the window, usually the loop start
+         * @param length The window length, usually the loop length
+         * @param peaks
+         * @param pixels
+         */
+        void GetPeaks(float start, float length, PeakIndex::Peak *peaks, int32_t pixels);
+        /**
+         * @brief Adds a span of the buffer to the peak index, for when the
+         * buffer has been filled otherwise than by the writing head. Call this
+         * from the audio callback, see Reload().
+         *
+         * @param from
+         * @param to The sample after the last one
+         */
+        void IndexPeaks(int32_t from, int32_t to);
+        /**
+         * @brief Returns the fades in progress.
+         *
+         * @return uint32_t A combination of FadeFlag
+         */
+        uint32_t GetFades() const;
         /**
          * @brief Toggles the playback direction between forward and backwards.
          */
@@ -209,7 +387,9 @@ namespace wreath
 
         inline float GetSamplesToFade() { return readHeads_[activeReadHead_].GetSamplesToFade(); }
 
+        inline T *GetBuffer() { return buffer_; }
         inline int32_t GetBufferSamples() { return bufferSamples_; }
+        inline int32_t GetMaxBufferSamples() { return writeHead_.GetMaxBufferSamples(); }
         inline float GetBufferSeconds() { return bufferSeconds_; }
 
         inline float GetLoopStart() { return loopStart_; }
@@ -230,20 +410,30 @@ namespace wreath
         inline float GetReadRate() { return readRate_; }
         inline float GetWriteRate() { return writeRate_; }
         inline int32_t GetSampleRateSpeed() { return sampleRateSpeed_; }
+        inline const Timing &GetTiming() { return timing_; }
 
         inline Movement GetMovement() { return movement_; }
         inline Direction GetDirection() { return direction_; }
         inline bool IsDrunkMovement() { return Movement::DRUNK == movement_; }
         inline bool IsGoingForward() { return Direction::FORWARD == direction_; }
 
-        inline float GetHeadsDistance() { return headsDistance_; }
+        inline float GetHeadsDistance() { return CalculateDistance(readPos_, writePos_, readSpeed_, writeSpeed_, direction_); }
         inline float GetCrossPoint() { return crossPoint_; }
         inline bool CrossPointFound() { return crossPointFound_; }
 
+        inline bool IsGranular() const { return grains_.IsEnabled(); }
+        inline int32_t GetActiveGrains() const { return grains_.GetActive(); }
+
+        inline bool CanUndo() const { return undo_.CanUndo(); }
+        inline bool CanRedo() const { return undo_.CanRedo(); }
+        inline bool IsRestoring() const { return undo_.IsRestoring(); }
+
         bool IsReading() { return readingActive_; }
         bool IsWriting() { return writingActive_; }
 
     private:
+        using Action = typename Head<T, I>::Action;
+
         enum Fade
         {
             NO_FADE,
@@ -259,8 +449,31 @@ namespace wreath
          */
         void CalculateCrossPoint();
 
-        float *buffer_{};           // The buffer
-        float *freezeBuffer_{};     // The buffer
+        /**
+         * @brief Sets how many updates the search for the cross point can be
+         * skipped for, given the current distance and how fast it may change.
+         *
+         * @param a The moving point
+         * @param b The point the distance is measured to
+         * @param distance
+         * @param threshold The distance under which something must be done
+         * @param rate The heads' combined rate
+         */
+        void ScheduleCrossPoint(float a, float b, float distance, float threshold, float rate);
+
+        /**
+         * @brief Forgets the cross point, call this whenever the heads' speed,
+         * direction or the loop change.
+         */
+        inline void ResetCrossPoint()
+        {
+            crossPointFound_ = false;
+            crossPointCountdown_ = 0;
+        }
+
+        T *buffer_{};               // The buffer
+        FreezeBuffer<T> freezeBuffer_{}; // The snapshot taken when freezing
+        BufferEraser<T> eraser_{};       // Clears the buffer a bit at a time
         float bufferSeconds_{};     // Written buffer length in seconds
         float readPos_{};           // The read position
         float readPosSeconds_{};    // Read position in seconds
@@ -280,6 +493,7 @@ namespace wreath
         int32_t intLoopEnd_{};   // Loop end position
         float headsDistance_{};
         int32_t sampleRate_{}; // The sample rate
+        Timing timing_{};      // The time constants at the sample rate
         Direction direction_{};
         float freeze_{};
         float degradation_{};
@@ -289,17 +503,33 @@ namespace wreath
         bool mustSyncHeads_{};
         float crossPoint_{};
         bool crossPointFound_{};
+        int32_t crossPointCountdown_{}; // Updates before the heads may get close
         bool readingActive_{true};
         bool writingActive_{true};
         float lengthFadePos_{};
         bool loopChanged_{};
         bool loopLengthGrown_{};
         bool triggered_{};
+        bool readEvent_{};  // Whether the last reading update did more than moving
+        bool writeEvent_{}; // Whether the last writing update did more than moving
 
         float eRand_{};
+        Random random_;
+
+        PeakIndex peaks_;
+        UndoHistory<T> undo_;
+        GrainCloud<T, I> grains_;
+        float grainsMix_{}; // How much the grains replace the reading head
+        int32_t bufferStride_{1};
 
-        Head writeHead_{Type::WRITE};
-        Head readHeads_[2]{{Type::READ}, {Type::READ}};
+        Head<T, I> writeHead_{Type::WRITE};
+        Head<T, I> readHeads_[2]{{Type::READ}, {Type::READ}};
+#if defined(WREATH_STAGED_READS)
+        StageWindow<T> stages_[2]; // Where the reading heads' spans are staged
+#endif
+#if defined(WREATH_HOT_LOOPS)
+        HotLoop<T> hot_; // The mirror of the loop when it's short
+#endif
 
         short activeReadHead_{};
 
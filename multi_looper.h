@@ -0,0 +1,588 @@
+#pragma once
+
+#include "buffers.h"
+#include "looper.h"
+#include "command_queue.h"
+#include "Utility/dsp.h"
+#include <cmath>
+#include <stddef.h>
+
+namespace wreath
+{
+    using namespace daisysp;
+
+    /**
+     * @brief A multi-track looper, running up to kMaxTracks synchronized mono
+     * tracks: they buffer, start and retrigger together, each with its own
+     * loop, rates and levels. It's a plain wrapper around one Looper per
+     * track, each advancing its own heads: the work grows linearly with the
+     * tracks, sharing only the command handling and the per-frame state
+     * machine.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <size_t kMaxTracks>
+    class MultiLooper
+    {
+    public:
+        MultiLooper() {}
+        ~MultiLooper() {}
+
+        static constexpr int ALL_TRACKS{-1};
+
+        enum State
+        {
+            BUFFERING,
+            READY,
+            RUNNING,
+        };
+
+        struct Conf
+        {
+            int32_t tracks;
+            Movement movement;
+            Direction direction;
+            uint32_t seed{};           // Random seed, the same seed gives the same results
+            float bufferSeconds{};     // Buffer length per track, 0 to split all the memory available
+            bool freezeBuffers{true};  // Whether to allocate the freeze buffers
+            float freezeSeconds{};     // Freeze buffer length per track, 0 for the same as the buffer
+        };
+
+        /**
+         * @brief A command sent by the control code to the audio callback.
+         * Commands are queued and handled at the beginning of the next block.
+         */
+        struct Command
+        {
+            enum Type
+            {
+                START,
+                RESET_LOOPER,
+                STOP_BUFFERING,
+                RETRIGGER,
+                RESTART,
+                SET_LOOP_SYNC,
+                SET_DEGRADATION,
+                SET_MOVEMENT,
+                SET_DIRECTION,
+                SET_LOOP_START,
+                SET_LOOP_LENGTH,
+                SET_FREEZE,
+                SET_READ_RATE,
+                SET_WRITE_RATE,
+            };
+
+            Type type;
+            int track; // The track index or ALL_TRACKS
+            float value;
+        };
+
+        // Per-track levels, set them directly.
+        float inputGain[kMaxTracks];
+        float dryLevel[kMaxTracks];
+        float feedback[kMaxTracks];
+        float outputLevel[kMaxTracks];
+        float rateSlew{0.f};
+
+        inline int32_t GetTracks() { return tracks_; }
+        inline Looper<BufferSample, BufferInterpolation> &GetTrack(int track) { return loopers_[track]; }
+        inline bool IsBuffering() { return State::BUFFERING == state_; }
+        inline bool IsReady() { return State::READY == state_; }
+        inline bool IsRunning() { return State::RUNNING == state_; }
+
+        /**
+         * @brief Inits the looper, carving the buffers of the tracks from the
+         * given arena. Call this before setting up the AudioCallback.
+         *
+         * @param sampleRate
+         * @param conf
+         * @param arena
+         * @return true
+         * @return false if the tracks are too many or don't fit in the arena
+         */
+        bool Init(int32_t sampleRate, Conf conf, Arena &arena)
+        {
+            if (conf.tracks <= 0 || conf.tracks > static_cast<int32_t>(kMaxTracks))
+            {
+                return false;
+            }
+
+            int32_t bufferSamples = conf.bufferSeconds * sampleRate;
+            int32_t freezeSamples = conf.freezeSeconds * sampleRate;
+            if (bufferSamples <= 0)
+            {
+                // Split what's left between the tracks, considering that the
+                // freeze buffers, if present, are as long as the buffers unless
+                // specified.
+                size_t available = arena.Available<BufferSample>() / conf.tracks;
+                if (!conf.freezeBuffers)
+                {
+                    bufferSamples = available;
+                }
+                else if (freezeSamples > 0)
+                {
+                    // Leave room for aligning the freeze buffers.
+                    bufferSamples = available - freezeSamples - kArenaAlignment;
+                }
+                else
+                {
+                    bufferSamples = available / 2;
+                }
+                // This way the buffers need no padding between them.
+                bufferSamples &= ~(kArenaAlignment - 1);
+            }
+            if (freezeSamples <= 0 || freezeSamples > bufferSamples)
+            {
+                freezeSamples = bufferSamples;
+            }
+            if (bufferSamples <= 0)
+            {
+                return false;
+            }
+
+            BufferSample *buffers[kMaxTracks]{};
+            BufferSample *freezeBuffers[kMaxTracks]{};
+            for (int32_t track = 0; track < conf.tracks; track++)
+            {
+                buffers[track] = arena.Allocate<BufferSample>(bufferSamples);
+                if (conf.freezeBuffers)
+                {
+                    freezeBuffers[track] = arena.Allocate<BufferSample>(freezeSamples);
+                    if (!freezeBuffers[track])
+                    {
+                        return false;
+                    }
+                }
+                if (!buffers[track])
+                {
+                    return false;
+                }
+            }
+
+            sampleRate_ = sampleRate;
+            tracks_ = conf.tracks;
+            conf_ = conf;
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].Init(sampleRate_, buffers[track], freezeBuffers[track], bufferSamples, freezeSamples);
+                loopers_[track].SetSeed(conf_.seed + track);
+                inputGain[track] = 1.f;
+                dryLevel[track] = 1.f;
+                feedback[track] = 0.f;
+                outputLevel[track] = 1.f;
+            }
+            Reset();
+
+            return true;
+        }
+
+        /**
+         * @brief Sends a command to the audio callback. This is what all the
+         * setters below use, call it from one thread only.
+         *
+         * @param command
+         * @return true
+         * @return false if the queue is full and the command has been dropped
+         */
+        bool Send(const Command &command)
+        {
+            return commands_.Push(command);
+        }
+
+        bool Start() { return Send({Command::START, ALL_TRACKS, 0.f}); }
+        bool ResetLooper() { return Send({Command::RESET_LOOPER, ALL_TRACKS, 0.f}); }
+        bool StopBuffering() { return Send({Command::STOP_BUFFERING, ALL_TRACKS, 0.f}); }
+        bool Retrigger() { return Send({Command::RETRIGGER, ALL_TRACKS, 0.f}); }
+        bool Restart() { return Send({Command::RESTART, ALL_TRACKS, 0.f}); }
+        bool SetLoopSync(int track, bool loopSync) { return Send({Command::SET_LOOP_SYNC, track, static_cast<float>(loopSync)}); }
+        bool SetDegradation(int track, float value) { return Send({Command::SET_DEGRADATION, track, value}); }
+        bool SetMovement(int track, Movement movement) { return Send({Command::SET_MOVEMENT, track, static_cast<float>(movement)}); }
+        bool SetDirection(int track, Direction direction) { return Send({Command::SET_DIRECTION, track, static_cast<float>(direction)}); }
+        bool SetLoopStart(int track, float value) { return Send({Command::SET_LOOP_START, track, value}); }
+        bool SetLoopLength(int track, float length) { return Send({Command::SET_LOOP_LENGTH, track, length}); }
+        bool SetFreeze(int track, float amount) { return Send({Command::SET_FREEZE, track, amount}); }
+        bool SetReadRate(int track, float rate) { return Send({Command::SET_READ_RATE, track, rate}); }
+        bool SetWriteRate(int track, float rate) { return Send({Command::SET_WRITE_RATE, track, rate}); }
+
+        /**
+         * @brief Processes a frame, one sample per track.
+         *
+         * @param in The input of each track
+         * @param out The output of each track
+         */
+        void Process(const float *in, float *out)
+        {
+            HandleCommands();
+            if (pending_)
+            {
+                pending_ = UpdateParameters();
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].Update(1);
+            }
+            ProcessFrame(in, out);
+        }
+
+        /**
+         * @brief Processes a block of samples. The commands are handled once
+         * per block, the output is the same as calling Process() for each
+         * frame, given that the commands are only sent in between blocks.
+         *
+         * @param in The input block of each track
+         * @param out The output block of each track
+         * @param size
+         */
+        void ProcessBlock(const float *const *in, float *const *out, size_t size)
+        {
+            HandleCommands();
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].Update(size);
+            }
+
+            float frameIn[kMaxTracks];
+            float frameOut[kMaxTracks];
+            for (size_t i = 0; i < size; i++)
+            {
+                if (pending_)
+                {
+                    pending_ = UpdateParameters();
+                }
+                for (int32_t track = 0; track < tracks_; track++)
+                {
+                    frameIn[track] = in[track][i];
+                }
+                ProcessFrame(frameIn, frameOut);
+                for (int32_t track = 0; track < tracks_; track++)
+                {
+                    out[track][i] = frameOut[track];
+                }
+            }
+        }
+
+    private:
+        Looper<BufferSample, BufferInterpolation> loopers_[kMaxTracks];
+        State state_{};
+        int32_t sampleRate_{};
+        int32_t tracks_{};
+        Conf conf_{};
+        CommandQueue<Command, 128> commands_;
+        bool pending_{}; // Whether the parameters are still changing
+        bool mustStopBuffering_{};
+
+        // Per-track parameters, applied by UpdateParameters().
+        float nextReadRate_[kMaxTracks]{};
+        float nextWriteRate_[kMaxTracks]{};
+        float nextLoopStart_[kMaxTracks]{};
+        float nextLoopLength_[kMaxTracks]{};
+        float nextFreeze_[kMaxTracks]{};
+        Direction nextDirection_[kMaxTracks]{};
+
+        // Per-track signals of the current frame.
+        float dry_[kMaxTracks]{};
+        float wet_[kMaxTracks]{};
+        float fed_[kMaxTracks]{}; // What's written in the buffer
+
+        /**
+         * @brief Processes a frame, stage by stage.
+         *
+         * @param in
+         * @param out
+         */
+        void ProcessFrame(const float *in, float *out)
+        {
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                dry_[track] = SoftClip(in[track] * inputGain[track]);
+            }
+
+            switch (state_)
+            {
+            case State::BUFFERING:
+            {
+                bool done{true};
+                for (int32_t track = 0; track < tracks_; track++)
+                {
+                    done &= loopers_[track].Buffer(dry_[track]);
+                }
+                if (done || mustStopBuffering_)
+                {
+                    mustStopBuffering_ = false;
+                    for (int32_t track = 0; track < tracks_; track++)
+                    {
+                        loopers_[track].StopBuffering();
+                    }
+                    ResetParameters();
+                    state_ = State::READY;
+                }
+                // Pass the audio through.
+                for (int32_t track = 0; track < tracks_; track++)
+                {
+                    out[track] = dry_[track];
+                }
+
+                return;
+            }
+            case State::READY:
+            {
+                for (int32_t track = 0; track < tracks_; track++)
+                {
+                    out[track] = 0.f;
+                }
+
+                return;
+            }
+            default:
+                break;
+            }
+
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                wet_[track] = loopers_[track].Read();
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                fed_[track] = wet_[track] * feedback[track];
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                fed_[track] = loopers_[track].Degrade(fed_[track]);
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                fed_[track] = SoftClip(dry_[track] * dryLevel[track] + fed_[track]);
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].UpdateReadPos();
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].Write(fed_[track]);
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].UpdateWritePos();
+            }
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                out[track] = SoftClip(wet_[track] * outputLevel[track]);
+            }
+        }
+
+        /**
+         * @brief Resets the tracks and starts buffering again.
+         */
+        void Reset()
+        {
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                loopers_[track].Reset();
+                loopers_[track].SetMovement(conf_.movement);
+                nextDirection_[track] = conf_.direction;
+            }
+            mustStopBuffering_ = false;
+            state_ = State::BUFFERING;
+        }
+
+        /**
+         * @brief Aligns the next parameters with the current ones once the
+         * buffering is done.
+         */
+        void ResetParameters()
+        {
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                nextReadRate_[track] = 1.f;
+                nextWriteRate_[track] = 1.f;
+                nextLoopStart_[track] = loopers_[track].GetLoopStart();
+                nextLoopLength_[track] = loopers_[track].GetLoopLength();
+                nextFreeze_[track] = 0.f;
+            }
+            pending_ = true;
+        }
+
+        /**
+         * @brief Handles the commands sent by the control code since the last
+         * call.
+         */
+        void HandleCommands()
+        {
+            Command command;
+            while (commands_.Pop(command))
+            {
+                int first = ALL_TRACKS == command.track ? 0 : command.track;
+                int last = ALL_TRACKS == command.track ? tracks_ - 1 : command.track;
+                if (first < 0 || last >= tracks_)
+                {
+                    continue;
+                }
+                for (int track = first; track <= last; track++)
+                {
+                    HandleCommand(command, track);
+                }
+                HandleCommand(command);
+            }
+        }
+
+        /**
+         * @brief Handles the part of a command that applies to all the tracks
+         * at once.
+         *
+         * @param command
+         */
+        void HandleCommand(const Command &command)
+        {
+            switch (command.type)
+            {
+            case Command::START:
+            {
+                if (State::READY == state_)
+                {
+                    for (int32_t track = 0; track < tracks_; track++)
+                    {
+                        loopers_[track].StartReading(true);
+                    }
+                    state_ = State::RUNNING;
+                }
+                break;
+            }
+            case Command::RESET_LOOPER:
+            {
+                for (int32_t track = 0; track < tracks_; track++)
+                {
+                    loopers_[track].StopReading(true);
+                }
+                Reset();
+                break;
+            }
+            case Command::STOP_BUFFERING:
+                mustStopBuffering_ = State::BUFFERING == state_;
+                break;
+            default:
+                break;
+            }
+        }
+
+        /**
+         * @brief Handles the part of a command that applies to a track.
+         *
+         * @param command
+         * @param track
+         */
+        void HandleCommand(const Command &command, int track)
+        {
+            float value = command.value;
+            Looper<BufferSample, BufferInterpolation> &looper = loopers_[track];
+
+            switch (command.type)
+            {
+            case Command::RETRIGGER:
+            case Command::RESTART:
+            {
+                if (State::RUNNING == state_)
+                {
+                    looper.Trigger(Command::RESTART == command.type);
+                }
+                break;
+            }
+            case Command::SET_LOOP_SYNC:
+                looper.SetLoopSync(value);
+                break;
+            case Command::SET_DEGRADATION:
+                looper.SetDegradation(value);
+                break;
+            case Command::SET_MOVEMENT:
+                looper.SetMovement(static_cast<Movement>(value));
+                break;
+            case Command::SET_DIRECTION:
+            {
+                nextDirection_[track] = static_cast<Direction>(value);
+                // Before the looper starts, if the direction is backwards set
+                // the reading head at the end of the loop.
+                if (State::READY == state_ && Direction::BACKWARDS == nextDirection_[track])
+                {
+                    looper.SetReadPos(looper.GetLoopEnd());
+                }
+                break;
+            }
+            case Command::SET_LOOP_START:
+                nextLoopStart_[track] = std::min(std::max(value, 0.f), looper.GetBufferSamples() - 1.f);
+                break;
+            case Command::SET_LOOP_LENGTH:
+                nextLoopLength_[track] = std::min(std::max(value, looper.GetTiming().minLoopLength), static_cast<float>(looper.GetBufferSamples()));
+                break;
+            case Command::SET_FREEZE:
+                nextFreeze_[track] = value;
+                break;
+            case Command::SET_READ_RATE:
+                nextReadRate_[track] = value;
+                break;
+            case Command::SET_WRITE_RATE:
+                nextWriteRate_[track] = value;
+                break;
+            default:
+                return;
+            }
+            pending_ = true;
+        }
+
+        /**
+         * @brief Moves the tracks' parameters towards the next ones.
+         *
+         * @return true
+         * @return false if all the parameters have reached the next ones
+         */
+        bool UpdateParameters()
+        {
+            if (State::RUNNING != state_)
+            {
+                return State::BUFFERING != state_;
+            }
+
+            float coeff = rateSlew > 0 ? 1.f / (rateSlew * sampleRate_) : 1.f;
+            bool pending{};
+            for (int32_t track = 0; track < tracks_; track++)
+            {
+                Looper<BufferSample, BufferInterpolation> &looper = loopers_[track];
+                if (nextDirection_[track] != looper.GetDirection())
+                {
+                    looper.SetDirection(nextDirection_[track]);
+                }
+
+                float readRate = looper.GetReadRate();
+                if (readRate != nextReadRate_[track])
+                {
+                    fonepole(readRate, nextReadRate_[track], coeff);
+                    looper.SetReadRate(readRate);
+                }
+                float writeRate = looper.GetWriteRate();
+                if (writeRate != nextWriteRate_[track])
+                {
+                    fonepole(writeRate, nextWriteRate_[track], coeff);
+                    looper.SetWriteRate(writeRate);
+                }
+                if (looper.GetLoopLength() != nextLoopLength_[track])
+                {
+                    looper.SetLoopLength(nextLoopLength_[track]);
+                }
+                if (looper.GetLoopStart() != nextLoopStart_[track])
+                {
+                    looper.SetLoopStart(nextLoopStart_[track]);
+                }
+                if (looper.GetFreeze() != nextFreeze_[track])
+                {
+                    looper.SetFreeze(nextFreeze_[track]);
+                }
+
+                // Rates may be slewing, while the loop start and length are
+                // not changed during a loop fade.
+                pending |= looper.GetReadRate() != nextReadRate_[track] || looper.GetWriteRate() != nextWriteRate_[track] ||
+                           looper.GetLoopLength() != nextLoopLength_[track] || looper.GetLoopStart() != nextLoopStart_[track];
+            }
+
+            return pending;
+        }
+    };
+} // namespace wreath
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace wreath
+{
+    constexpr int32_t kPeakBucketShift{8};  // 256 samples per bucket in the finest level
+    constexpr int32_t kMaxPeakLevels{24};   // Enough for any buffer length
+    constexpr int32_t kPeakBucketSlack{8};  // Samples a bucket may miss and still be fully written, see Publish()
+    constexpr float kPeakScale{32767.f};    // The peaks are stored in 16 bit
+
+    /**
+     * @brief A multi-resolution index of the minimum and maximum values of a
+     * buffer, used to draw its waveform in O(pixels) instead of scanning the
+     * samples. Level 0 holds a bucket every 256 samples, each upper level
+     * merges two buckets of the one below, up to a single bucket for the
+     * whole buffer.
+     *
+     * The writing head adds the samples as they land. The bucket being
+     * written is accumulated aside and published each time the head leaves it
+     * and once per block: a bucket written from end to end replaces the old
+     * peaks, one written in part is merged with them. Publishing updates the
+     * path of buckets up to the top level, the rest of the index is left
+     * untouched. Clearing is O(1): each bucket carries the epoch it was
+     * written in, the ones of an older epoch are empty.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    class PeakIndex
+    {
+    public:
+        PeakIndex() {}
+        ~PeakIndex() {}
+
+        struct Bucket
+        {
+            int16_t min;
+            int16_t max;
+            uint16_t epoch;
+        };
+
+        struct Peak
+        {
+            float min;
+            float max;
+        };
+
+        /**
+         * @brief Returns the number of buckets needed to index a buffer of the
+         * given length, so that their memory can be allocated.
+         *
+         * @param maxSamples
+         * @return int32_t
+         */
+        static constexpr int32_t CountBuckets(int32_t maxSamples)
+        {
+            int32_t total{};
+            for (int32_t count = maxSamples > 0 ? ((maxSamples - 1) >> kPeakBucketShift) + 1 : 0; count > 0; count = (count + 1) / 2)
+            {
+                total += count;
+                if (1 == count)
+                {
+                    break;
+                }
+            }
+
+            return total;
+        }
+
+        /**
+         * @brief Initializes the index over the given buckets, that must be
+         * CountBuckets(maxSamples). Without buckets the index is disabled.
+         *
+         * @param buckets
+         * @param maxSamples The whole buffer length
+         */
+        void Init(Bucket *buckets, int32_t maxSamples)
+        {
+            buckets_ = buckets;
+            levels_ = 0;
+            int32_t offset{};
+            for (int32_t count = maxSamples > 0 ? ((maxSamples - 1) >> kPeakBucketShift) + 1 : 0; count > 0 && levels_ < kMaxPeakLevels; count = (count + 1) / 2)
+            {
+                offsets_[levels_] = offset;
+                counts_[levels_] = count;
+                offset += count;
+                levels_++;
+                if (1 == count)
+                {
+                    break;
+                }
+            }
+            if (buckets_)
+            {
+                memset(buckets_, 0, offset * sizeof(Bucket));
+            }
+            length_ = maxSamples;
+            epoch_ = 1;
+            current_ = -1;
+        }
+
+        inline bool IsEnabled() const { return buckets_ != nullptr; }
+
+        /**
+         * @brief Sets the written buffer length, the last bucket of the
+         * buffer is fully written when the head reaches its end.
+         *
+         * @param length
+         */
+        inline void SetLength(int32_t length) { length_ = length; }
+
+        /**
+         * @brief Adds a sample written in the buffer.
+         *
+         * @param index
+         * @param value
+         */
+        inline void Add(int32_t index, float value)
+        {
+            int32_t bucket = index >> kPeakBucketShift;
+            if (bucket != current_)
+            {
+                Publish();
+                current_ = bucket;
+                min_ = value;
+                max_ = value;
+                first_ = index;
+                last_ = index;
+            }
+            min_ = std::min(min_, value);
+            max_ = std::max(max_, value);
+            first_ = std::min(first_, index);
+            last_ = std::max(last_, index);
+        }
+
+        /**
+         * @brief Publishes the bucket being written, so that its peaks can be
+         * read. Call this once per block.
+         */
+        void Publish()
+        {
+            if (current_ >= 0)
+            {
+                Update(current_, min_, max_, last_ - first_ + 1 >= BucketSamples(current_) - kPeakBucketSlack);
+            }
+        }
+
+        /**
+         * @brief Indexes a span of the buffer that has been filled otherwise
+         * than by the writing head, for instance restoring a saved loop. The
+         * bucket being written is left alone. Call this from the audio
+         * callback: it updates the upper levels like Publish() does.
+         *
+         * @param from
+         * @param to The sample after the last one
+         * @param read float(int32_t index), returns a sample of the buffer
+         */
+        template <typename R>
+        void Index(int32_t from, int32_t to, R read)
+        {
+            for (int32_t bucket = from >> kPeakBucketShift; buckets_ && from < to; bucket++)
+            {
+                int32_t end = std::min(to, (bucket + 1) << kPeakBucketShift);
+                bool whole = end - from >= BucketSamples(bucket);
+                float min = read(from);
+                float max = min;
+                for (; from < end; from++)
+                {
+                    float value = read(from);
+                    min = std::min(min, value);
+                    max = std::max(max, value);
+                }
+                Update(bucket, min, max, whole);
+            }
+        }
+
+        /**
+         * @brief Empties the index, when the buffer is cleared.
+         */
+        void Clear()
+        {
+            current_ = -1;
+            if (!++epoch_ && buckets_)
+            {
+                // The epochs wrapped around, the old ones must go for real.
+                memset(buckets_, 0, (offsets_[levels_ - 1] + counts_[levels_ - 1]) * sizeof(Bucket));
+                epoch_ = 1;
+            }
+        }
+
+        /**
+         * @brief Fills the peaks of a window of the buffer, one per pixel. The
+         * window may wrap around the end of the written buffer, as inverted
+         * loops do. The level used is the coarsest one with buckets no larger
+         * than a pixel, so that each pixel takes a few buckets. When a pixel
+         * is smaller than a bucket the samples are read instead, which takes
+         * at most a bucket per pixel. Without buckets the samples are always
+         * read.
+         *
+         * @param start The first sample of the window
+         * @param length The window length in samples
+         * @param bufferSamples The written buffer length
+         * @param peaks
+         * @param pixels
+         * @param read float(int32_t index), returns a sample of the buffer
+         */
+        template <typename R>
+        void GetPeaks(float start, float length, int32_t bufferSamples, Peak *peaks, int32_t pixels, R read) const
+        {
+            if (pixels <= 0 || bufferSamples <= 0)
+            {
+                return;
+            }
+
+            float samplesPerPixel = std::max(length, 1.f) / pixels;
+            int32_t level{-1};
+            while (buckets_ && level + 1 < levels_ && (1 << (kPeakBucketShift + level + 1)) <= samplesPerPixel)
+            {
+                level++;
+            }
+
+            for (int32_t pixel = 0; pixel < pixels; pixel++)
+            {
+                int32_t from = static_cast<int32_t>(start + pixel * samplesPerPixel);
+                int32_t width = std::max(static_cast<int32_t>(start + (pixel + 1) * samplesPerPixel) - from, static_cast<int32_t>(1));
+                from %= bufferSamples;
+                int32_t to = from + std::min(width, bufferSamples);
+                Peak peak{0.f, 0.f};
+                bool empty{true};
+                // A pixel wraps around the buffer end at most once.
+                for (int32_t segment = 0; segment < 2 && from < to; segment++)
+                {
+                    int32_t end = std::min(to, bufferSamples);
+                    Scan(level, from, end, peak, empty, read);
+                    to -= bufferSamples;
+                    from = 0;
+                }
+                peaks[pixel] = peak;
+            }
+        }
+
+    private:
+        Bucket *buckets_{};
+        int32_t levels_{};
+        int32_t offsets_[kMaxPeakLevels]{}; // Where each level starts
+        int32_t counts_[kMaxPeakLevels]{};  // The buckets in each level
+        uint16_t epoch_{1};
+        int32_t current_{-1}; // The level 0 bucket being written
+        int32_t length_{}; // The written buffer length
+        float min_{};
+        float max_{};
+        int32_t first_{}; // The span written in the current bucket
+        int32_t last_{};
+
+        /**
+         * @brief Returns how many samples of the written buffer the given
+         * level 0 bucket holds, fewer than the others for the last one.
+         *
+         * @param index
+         * @return int32_t
+         */
+        inline int32_t BucketSamples(int32_t index) const
+        {
+            return std::max(std::min(1 << kPeakBucketShift, length_ - (index << kPeakBucketShift)), static_cast<int32_t>(1));
+        }
+
+        /**
+         * @brief Stores the peaks of a level 0 bucket, replacing the ones
+         * already there only when the whole bucket has been written, and
+         * updates the buckets above it.
+         *
+         * @param index
+         * @param min
+         * @param max
+         * @param whole
+         */
+        void Update(int32_t index, float min, float max, bool whole)
+        {
+            if (index >= counts_[0])
+            {
+                return;
+            }
+
+            Bucket &bucket = buckets_[index];
+            Bucket peaks{Quantize(min, false), Quantize(max, true), epoch_};
+            if (bucket.epoch == epoch_ && !whole)
+            {
+                peaks.min = std::min(peaks.min, bucket.min);
+                peaks.max = std::max(peaks.max, bucket.max);
+            }
+            bucket = peaks;
+
+            for (int32_t level = 1; level < levels_; level++)
+            {
+                index >>= 1;
+                const Bucket *below = buckets_ + offsets_[level - 1];
+                Bucket merged = Get(below, index * 2, counts_[level - 1]);
+                Bucket other = Get(below, index * 2 + 1, counts_[level - 1]);
+                merged.min = std::min(merged.min, other.min);
+                merged.max = std::max(merged.max, other.max);
+                merged.epoch = epoch_;
+                buckets_[offsets_[level] + index] = merged;
+            }
+        }
+
+        /**
+         * @brief Converts a peak to 16 bit, rounding it outwards so that the
+         * peaks never fall short of the samples.
+         *
+         * @param value
+         * @param up
+         * @return int16_t
+         */
+        static inline int16_t Quantize(float value, bool up)
+        {
+            float scaled = std::max(-1.f, std::min(value, 1.f)) * kPeakScale;
+
+            return static_cast<int16_t>(up ? std::ceil(scaled) : std::floor(scaled));
+        }
+
+        inline Bucket Get(const Bucket *level, int32_t index, int32_t count) const
+        {
+            if (index >= count || level[index].epoch != epoch_)
+            {
+                return {0, 0, epoch_};
+            }
+
+            return level[index];
+        }
+
+        template <typename R>
+        void Scan(int32_t level, int32_t from, int32_t to, Peak &peak, bool &empty, R read) const
+        {
+            if (level < 0)
+            {
+                for (int32_t i = from; i < to; i++)
+                {
+                    float value = read(i);
+                    peak.min = empty ? value : std::min(peak.min, value);
+                    peak.max = empty ? value : std::max(peak.max, value);
+                    empty = false;
+                }
+
+                return;
+            }
+
+            int32_t shift = kPeakBucketShift + level;
+            for (int32_t i = from >> shift; i <= (to - 1) >> shift; i++)
+            {
+                Bucket bucket = Get(buckets_ + offsets_[level], i, counts_[level]);
+                float min = bucket.min * (1.f / kPeakScale);
+                float max = bucket.max * (1.f / kPeakScale);
+                peak.min = empty ? min : std::min(peak.min, min);
+                peak.max = empty ? max : std::max(peak.max, max);
+                empty = false;
+            }
+        }
+    };
+} // namespace wreath
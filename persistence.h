@@ -0,0 +1,397 @@
+#pragma once
+
+#include "stereo_looper.h"
+#include "sample_format.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace wreath
+{
+    constexpr uint32_t kPersistenceMagic{0x48545257}; // "WRTH"
+    constexpr uint16_t kPersistenceVersion{1};
+    constexpr uint32_t kPersistenceHeaderBytes{512}; // A SD card sector, the frames start after it
+    constexpr int32_t kPersistenceChunkFrames{1024}; // Frames per transfer (4KB)
+
+    /**
+     * @brief Saves the loops to a storage (SD card, QSPI flash) and restores
+     * them, in the background: the work is done a chunk at a time from the
+     * main loop, while the audio callback keeps running. The storage is a
+     * template parameter that must provide:
+     *
+     * - bool Busy(), whether a transfer is in progress
+     * - bool Write(uint32_t offset, const void *data, size_t size), starts writing
+     * - bool Read(uint32_t offset, void *data, size_t size), starts reading
+     *
+     * The transfers may complete asynchronously (e.g. with DMA), the data is
+     * left alone until Busy() returns false. Two chunks are used, so that one
+     * is prepared while the other is being transferred.
+     *
+     * The samples are stored as 16 bit stereo frames, after a header with the
+     * loop parameters. The header is invalidated when a save starts and it's
+     * written when it ends, so an interrupted save leaves nothing to restore.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename S>
+    class Persistence
+    {
+    public:
+        Persistence() {}
+        ~Persistence() {}
+
+        struct Header
+        {
+            struct Channel
+            {
+                float loopStart;
+                float loopLength;
+                float readRate;
+                float writeRate;
+                int8_t direction;
+                uint8_t movement;
+                uint8_t reserved[2];
+            };
+
+            uint32_t magic;
+            uint16_t version;
+            uint8_t mode;
+            uint8_t reserved;
+            int32_t sampleRate;
+            int32_t bufferSamples;
+            Channel channels[2];
+        };
+
+        enum class Task
+        {
+            IDLE,
+            SAVING,
+            FINISHING, // Writing the header
+            RESTORING,
+            FAILED,
+        };
+
+        /**
+         * @brief Initializes the persistence.
+         *
+         * @param storage
+         * @param looper
+         * @param sampleRate
+         */
+        void Init(S *storage, StereoLooper *looper, int32_t sampleRate)
+        {
+            storage_ = storage;
+            looper_ = looper;
+            sampleRate_ = sampleRate;
+            task_ = Task::IDLE;
+        }
+
+        /**
+         * @brief Starts saving the buffers and the loop parameters, the work
+         * is then done by Update(). Note that if the looper is recording, the
+         * buffers are saved as they are while they're written.
+         *
+         * @return true
+         * @return false if busy, if there's nothing to save or the storage
+         * refused the transfer
+         */
+        bool Save()
+        {
+            if (IsBusy() || !(looper_->IsReady() || looper_->IsRunning()))
+            {
+                return false;
+            }
+
+            session_ = {};
+            session_.magic = kPersistenceMagic;
+            session_.version = kPersistenceVersion;
+            session_.mode = looper_->GetMode();
+            session_.sampleRate = sampleRate_;
+            session_.bufferSamples = looper_->GetBufferSamples(StereoLooper::LEFT);
+            for (int channel = StereoLooper::LEFT; channel <= StereoLooper::RIGHT; channel++)
+            {
+                typename Header::Channel &c = session_.channels[channel];
+                c.loopStart = looper_->GetLoopStart(channel);
+                c.loopLength = looper_->GetLoopLength(channel);
+                c.readRate = looper_->GetReadRate(channel);
+                c.writeRate = looper_->GetWriteRate(channel);
+                c.direction = looper_->IsGoingForward(channel) ? Direction::FORWARD : Direction::BACKWARDS;
+                c.movement = looper_->GetMovement(channel);
+            }
+
+            // Invalidate the previous save.
+            header_ = {};
+            if (!storage_->Write(0, &header_, sizeof(header_)))
+            {
+                task_ = Task::FAILED;
+
+                return false;
+            }
+            Begin(session_.bufferSamples, 0, true);
+            task_ = Task::SAVING;
+
+            return true;
+        }
+
+        /**
+         * @brief Reads the saved header, waiting for the storage. Call this at
+         * boot to init the looper in the saved mode before restoring.
+         *
+         * @param header
+         * @return true
+         * @return false if there's nothing saved
+         */
+        bool Peek(Header &header)
+        {
+            if (IsBusy() || !storage_->Read(0, &header_, sizeof(header_)))
+            {
+                return false;
+            }
+            while (storage_->Busy())
+            {
+            }
+            header = header_;
+
+            return kPersistenceMagic == header.magic && kPersistenceVersion == header.version && header.bufferSamples > 0;
+        }
+
+        /**
+         * @brief Starts restoring the saved loops. This must be called while
+         * the looper is starting up or buffering. The playback starts right
+         * away, while the buffers are paged in by Update() from the loop
+         * start in the reading direction, so that the beginning of the loop
+         * is there first. Writing resumes when everything has been loaded.
+         *
+         * @return true
+         * @return false if there's nothing saved, or if it was saved at
+         * another sample rate or in another mode than the looper's
+         */
+        bool Restore()
+        {
+            Header header;
+            if (!Peek(header) || header.sampleRate != sampleRate_ || header.mode != looper_->GetMode())
+            {
+                return false;
+            }
+
+            int32_t frames = std::min(header.bufferSamples, looper_->GetMaxBufferSamples(StereoLooper::LEFT));
+            const typename Header::Channel &left = header.channels[StereoLooper::LEFT];
+            bool forward = Direction::FORWARD == left.direction;
+            int32_t origin = static_cast<int32_t>(forward ? left.loopStart : left.loopStart + left.loopLength - 1);
+            origin = std::min(std::max(origin % frames, static_cast<int32_t>(0)), frames - 1);
+
+            looper_->Restore(frames);
+            looper_->StopWriting(StereoLooper::BOTH, true);
+            looper_->Start();
+            for (int channel = StereoLooper::LEFT; channel <= StereoLooper::RIGHT; channel++)
+            {
+                const typename Header::Channel &c = header.channels[channel];
+                looper_->SetLoopStart(channel, c.loopStart);
+                looper_->SetLoopLength(channel, c.loopLength);
+                looper_->SetReadRate(channel, c.readRate);
+                looper_->SetWriteRate(channel, c.writeRate);
+                looper_->SetDirection(channel, static_cast<Direction>(c.direction));
+                looper_->SetMovement(channel, static_cast<Movement>(c.movement));
+            }
+
+            Begin(frames, origin, forward);
+            task_ = Task::RESTORING;
+
+            return true;
+        }
+
+        /**
+         * @brief Moves the current task on by a chunk, call this from the main
+         * loop when there's nothing else to do. It never waits.
+         */
+        void Update()
+        {
+            switch (task_)
+            {
+            case Task::SAVING:
+            {
+                // Prepare the next chunk while the previous one is written.
+                if (ready_ < 0 && done_ < frames_)
+                {
+                    ready_ = !inFlight_;
+                    Next(ready_);
+                    Encode(ready_);
+                }
+                if (storage_->Busy())
+                {
+                    return;
+                }
+                if (ready_ >= 0)
+                {
+                    if (!Transfer(ready_, true))
+                    {
+                        return;
+                    }
+                    ready_ = -1;
+
+                    return;
+                }
+
+                header_ = session_;
+                if (!storage_->Write(0, &header_, sizeof(header_)))
+                {
+                    task_ = Task::FAILED;
+
+                    return;
+                }
+                task_ = Task::FINISHING;
+
+                break;
+            }
+            case Task::FINISHING:
+            {
+                if (!storage_->Busy())
+                {
+                    task_ = Task::IDLE;
+                }
+
+                break;
+            }
+            case Task::RESTORING:
+            {
+                if (storage_->Busy())
+                {
+                    return;
+                }
+
+                // Start reading the next chunk, then copy the one that has
+                // been read in the buffers while that's transferred.
+                int32_t completed = inFlight_;
+                inFlight_ = -1;
+                if (done_ < frames_)
+                {
+                    int32_t next = completed == 0 ? 1 : 0;
+                    Next(next);
+                    if (!Transfer(next, false))
+                    {
+                        return;
+                    }
+                }
+                if (completed >= 0)
+                {
+                    Decode(completed);
+                }
+                if (inFlight_ < 0)
+                {
+                    looper_->StartWriting(StereoLooper::BOTH, false);
+                    task_ = Task::IDLE;
+                }
+
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        inline bool IsBusy() { return Task::SAVING == task_ || Task::FINISHING == task_ || Task::RESTORING == task_; }
+        inline bool HasFailed() { return Task::FAILED == task_; }
+        inline Task GetTask() { return task_; }
+        inline float GetProgress() { return frames_ > 0 ? done_ / static_cast<float>(frames_) : 0.f; }
+
+    private:
+        S *storage_{};
+        StereoLooper *looper_{};
+        int32_t sampleRate_{};
+        Task task_{};
+        Header header_{};  // The header being transferred
+        Header session_{}; // The header of the save in progress
+
+        BufferSample *buffers_[2]{};
+        int32_t stride_{};
+        int32_t frames_{}; // The frames to transfer
+        int32_t origin_{}; // Where the transfer starts
+        bool forward_{};   // Whether the transfer goes forward from the origin
+        int32_t done_{};   // The frames prepared so far
+
+        int16_t chunks_[2][kPersistenceChunkFrames * 2]{};
+        int32_t chunkStart_[2]{};
+        int32_t chunkFrames_[2]{};
+        int32_t ready_{-1};    // The chunk ready to be written
+        int32_t inFlight_{-1}; // The chunk being transferred
+
+        void Begin(int32_t frames, int32_t origin, bool forward)
+        {
+            buffers_[StereoLooper::LEFT] = looper_->GetBuffer(StereoLooper::LEFT);
+            buffers_[StereoLooper::RIGHT] = looper_->GetBuffer(StereoLooper::RIGHT);
+            stride_ = looper_->GetBufferStride();
+            frames_ = frames;
+            origin_ = origin;
+            forward_ = forward;
+            done_ = 0;
+            ready_ = -1;
+            inFlight_ = -1;
+        }
+
+        /**
+         * @brief Assigns the next span of frames to the given chunk, going
+         * around the buffer from the origin. A chunk never wraps.
+         *
+         * @param chunk
+         */
+        void Next(int32_t chunk)
+        {
+            int32_t frames = std::min(kPersistenceChunkFrames, frames_ - done_);
+            int32_t start{};
+            if (forward_)
+            {
+                start = (origin_ + done_) % frames_;
+                frames = std::min(frames, frames_ - start);
+            }
+            else
+            {
+                int32_t end = origin_ + 1 - done_;
+                end = end <= 0 ? end + frames_ : end;
+                frames = std::min(frames, end);
+                start = end - frames;
+            }
+            chunkStart_[chunk] = start;
+            chunkFrames_[chunk] = frames;
+            done_ += frames;
+        }
+
+        bool Transfer(int32_t chunk, bool write)
+        {
+            uint32_t offset = kPersistenceHeaderBytes + chunkStart_[chunk] * sizeof(chunks_[0][0]) * 2;
+            size_t size = chunkFrames_[chunk] * sizeof(chunks_[0][0]) * 2;
+            if (!(write ? storage_->Write(offset, chunks_[chunk], size) : storage_->Read(offset, chunks_[chunk], size)))
+            {
+                task_ = Task::FAILED;
+
+                return false;
+            }
+            inFlight_ = chunk;
+
+            return true;
+        }
+
+        void Encode(int32_t chunk)
+        {
+            int16_t *out = chunks_[chunk];
+            for (int32_t i = 0, frame = chunkStart_[chunk]; i < chunkFrames_[chunk]; i++, frame++)
+            {
+                for (int channel = StereoLooper::LEFT; channel <= StereoLooper::RIGHT; channel++)
+                {
+                    *out++ = SampleFormat<int16_t>::Store(SampleFormat<BufferSample>::Load(buffers_[channel][frame * stride_]));
+                }
+            }
+        }
+
+        void Decode(int32_t chunk)
+        {
+            const int16_t *in = chunks_[chunk];
+            for (int32_t i = 0, frame = chunkStart_[chunk]; i < chunkFrames_[chunk]; i++, frame++)
+            {
+                for (int channel = StereoLooper::LEFT; channel <= StereoLooper::RIGHT; channel++)
+                {
+                    buffers_[channel][frame * stride_] = SampleFormat<BufferSample>::Store(SampleFormat<int16_t>::Load(*in++));
+                }
+            }
+            looper_->Reload(chunkStart_[chunk], chunkStart_[chunk] + chunkFrames_[chunk]);
+        }
+    };
+} // namespace wreath
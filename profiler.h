@@ -0,0 +1,246 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#if !defined(__arm__)
+#include <chrono>
+#endif
+
+/**
+ * Probes for measuring the processing stages, define WREATH_PROFILING to
+ * enable them. When it's not defined they are compiled out completely. The
+ * macros expect a Profiler named profiler_ in scope.
+ */
+#if defined(WREATH_PROFILING)
+#define WREATH_PROBE_START(stage) profiler_.Start(Profiler::stage)
+#define WREATH_PROBE_STOP(stage) profiler_.Stop(Profiler::stage)
+#define WREATH_PROBE_COMMIT() profiler_.Commit()
+#else
+#define WREATH_PROBE_START(stage)
+#define WREATH_PROBE_STOP(stage)
+#define WREATH_PROBE_COMMIT()
+#endif
+
+namespace wreath
+{
+    constexpr int32_t kProfilerBins{16};
+#if defined(__arm__)
+    constexpr float kCounterFrequency{480000000.f}; // The Daisy Seed's CPU clock
+#else
+    constexpr float kCounterFrequency{1000000000.f}; // Nanoseconds
+#endif
+
+    /**
+     * @brief Measures the cycles spent in each processing stage using the DWT
+     * cycle counter (on the host, where there's none, nanoseconds are used).
+     * A stage may be started and stopped more than once per sample, the time
+     * is summed up and committed at the end of the sample. Probing happens in
+     * the audio callback, the statistics can be read from the main loop.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    class Profiler
+    {
+    public:
+        Profiler() {}
+        ~Profiler() {}
+
+        enum Stage
+        {
+            INPUT,
+            READ,
+            FEEDBACK,
+            WRITE,
+            POSITION,
+            OUTPUT,
+            TOTAL, // The sum of the other stages
+            LAST_STAGE,
+        };
+
+        /**
+         * @brief The statistics of a stage, per sample. The histogram is
+         * logarithmic: bin i counts the samples that took between 2^i and
+         * 2^(i+1) cycles (the last bin counts all the longer ones).
+         */
+        struct Stats
+        {
+            uint32_t min;
+            uint32_t max;
+            uint32_t avg;
+            uint32_t samples;
+            uint32_t histogram[kProfilerBins];
+        };
+
+        /**
+         * @brief Enables the cycle counter and clears the statistics.
+         */
+        void Init()
+        {
+            EnableCounter();
+            Clear();
+        }
+
+        /**
+         * @brief Enables the cycle counter, the profiling probes aside. It's
+         * also used to estimate the load, see StereoLooper::Telemetry.
+         */
+        static void EnableCounter()
+        {
+#if defined(__arm__)
+            *reinterpret_cast<volatile uint32_t *>(0xE000EDFC) |= 1u << 24; // DEMCR, TRCENA
+            *reinterpret_cast<volatile uint32_t *>(0xE0001FB0) = 0xC5ACCE55; // DWT LAR, unlock
+            *reinterpret_cast<volatile uint32_t *>(0xE0001000) |= 1u;        // DWT CTRL, CYCCNTENA
+#endif
+        }
+
+        /**
+         * @brief Returns the cycle counter, it wraps around.
+         *
+         * @return uint32_t
+         */
+        static inline uint32_t Now()
+        {
+#if defined(__arm__)
+            return *reinterpret_cast<volatile uint32_t *>(0xE0001004);
+#else
+            return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+        }
+
+        /**
+         * @brief Returns the share of the time of the given samples that the
+         * given cycles take, that is the load of processing them.
+         *
+         * @param cycles
+         * @param samples
+         * @param sampleRate
+         * @return float
+         */
+        static inline float Load(uint32_t cycles, size_t samples, int32_t sampleRate)
+        {
+            // The product of the cycles and the sample rate overflows 32 bit,
+            // so it's done in float.
+            return static_cast<float>(cycles) * sampleRate / (samples * kCounterFrequency);
+        }
+
+        inline void Start(Stage stage)
+        {
+            starts_[stage] = Now();
+        }
+
+        inline void Stop(Stage stage)
+        {
+            current_[stage] += Now() - starts_[stage];
+            touched_ |= 1u << stage;
+        }
+
+        /**
+         * @brief Adds the cycles measured for the current sample to the
+         * statistics of the stages that have been probed.
+         */
+        void Commit()
+        {
+            if (mustClear_.load(std::memory_order_acquire))
+            {
+                Clear();
+                mustClear_.store(false, std::memory_order_release);
+
+                return;
+            }
+            if (!touched_)
+            {
+                return;
+            }
+
+            uint32_t total{};
+            for (int32_t stage = 0; stage < TOTAL; stage++)
+            {
+                if (touched_ & (1u << stage))
+                {
+                    Add(stage, current_[stage]);
+                    total += current_[stage];
+                    current_[stage] = 0;
+                }
+            }
+            Add(TOTAL, total);
+            touched_ = 0;
+        }
+
+        /**
+         * @brief Returns a copy of the statistics of the given stage. Call
+         * this from the main loop: the copy is taken again if the audio
+         * callback has committed a sample in the meantime.
+         *
+         * @param stage
+         * @return Stats
+         */
+        Stats GetStats(Stage stage)
+        {
+            Stats stats{};
+            uint64_t sum{};
+            uint32_t samples{};
+            do
+            {
+                samples = Samples(stage);
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                stats = stats_[stage];
+                sum = sums_[stage];
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            } while (samples != Samples(stage));
+
+            stats.avg = samples ? static_cast<uint32_t>(sum / samples) : 0;
+            if (!samples)
+            {
+                stats.min = 0;
+            }
+
+            return stats;
+        }
+
+        /**
+         * @brief Asks the audio callback to clear the statistics, call this
+         * from the main loop.
+         */
+        void Reset()
+        {
+            mustClear_.store(true, std::memory_order_release);
+        }
+
+    private:
+        uint32_t starts_[LAST_STAGE]{};
+        uint32_t current_[LAST_STAGE]{}; // Cycles of the current sample
+        uint32_t touched_{};             // Stages probed in the current sample
+        Stats stats_[LAST_STAGE]{};
+        uint64_t sums_[LAST_STAGE]{};
+        std::atomic<bool> mustClear_{};
+
+        inline uint32_t Samples(Stage stage)
+        {
+            return *static_cast<volatile uint32_t *>(&stats_[stage].samples);
+        }
+
+        void Clear()
+        {
+            for (int32_t stage = 0; stage < LAST_STAGE; stage++)
+            {
+                stats_[stage] = {};
+                stats_[stage].min = UINT32_MAX;
+                sums_[stage] = 0;
+                current_[stage] = 0;
+            }
+            touched_ = 0;
+        }
+
+        void Add(int32_t stage, uint32_t cycles)
+        {
+            Stats &stats = stats_[stage];
+            stats.min = cycles < stats.min ? cycles : stats.min;
+            stats.max = cycles > stats.max ? cycles : stats.max;
+            stats.samples++;
+            sums_[stage] += cycles;
+            int32_t bin = cycles ? 31 - __builtin_clz(cycles) : 0;
+            stats.histogram[bin < kProfilerBins ? bin : kProfilerBins - 1]++;
+        }
+    };
+} // namespace wreath
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+namespace wreath
+{
+    constexpr uint32_t kDefaultSeed{0x9E3779B9};
+
+    /**
+     * @brief A small and fast xorshift pseudo-random generator. Each looper
+     * owns one, so that the sequence only depends on the seed and renders can
+     * be reproduced.
+     * @author Roberto Noris
+     * @date Oct 2026
+     * @see https://www.jstatsoft.org/article/view/v008i14
+     */
+    class Random
+    {
+    public:
+        Random() {}
+        ~Random() {}
+
+        /**
+         * @brief Restarts the sequence from the given seed. A zero seed would
+         * get the generator stuck, so the default one is used instead.
+         *
+         * @param seed
+         */
+        void Seed(uint32_t seed)
+        {
+            state_ = seed ? seed : kDefaultSeed;
+        }
+
+        /**
+         * @brief Returns the next value in the sequence.
+         *
+         * @return uint32_t
+         */
+        inline uint32_t Next()
+        {
+            state_ ^= state_ << 13;
+            state_ ^= state_ >> 17;
+            state_ ^= state_ << 5;
+
+            return state_;
+        }
+
+        /**
+         * @brief Returns the next value in the sequence, in the [0, 1) range.
+         *
+         * @return float
+         */
+        inline float NextFloat()
+        {
+            // The upper 24 bits fit exactly in the float's mantissa.
+            return (Next() >> 8) * (1.f / 16777216.f);
+        }
+
+    private:
+        uint32_t state_{kDefaultSeed};
+    };
+} // namespace wreath
@@ -0,0 +1,381 @@
+#include "script.h"
+#include "stereo_looper.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Offline renderer: streams a WAV file through StereoLooper block by block,
+// applying a timeline of control events read from a script (see script.h for
+// the format), faster than real time. Each script is rendered on its own
+// thread with its own looper and memory, to a WAV file named after it.
+//
+// Usage: render_looper [-j threads] [-b block] input.wav script [script...]
+// The block size is up to kScriptMaxBlockSize frames, 48 by default.
+
+using namespace wreath;
+
+constexpr size_t kDefaultBlockSize{48};
+
+struct Input
+{
+    const uint8_t *data{};
+    size_t size{};
+    int32_t sampleRate{};
+    int32_t channels{};
+    int32_t bits{};
+    bool isFloat{};
+    const uint8_t *samples{};
+    int64_t frames{};
+};
+
+struct Job
+{
+    std::string path{};
+    std::string output{};
+    Script script{};
+    std::string error{};
+    double seconds{}; // Time taken by the rendering
+};
+
+uint32_t ReadLe(const uint8_t *p, int bytes)
+{
+    uint32_t value{};
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= static_cast<uint32_t>(p[i]) << (8 * i);
+    }
+
+    return value;
+}
+
+void WriteLe(uint8_t *p, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        p[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/**
+ * @brief Maps the input file and finds its format and samples. PCM (16, 24
+ * and 32 bit) and float files are supported, mono or stereo.
+ */
+bool OpenInput(const char *path, Input &input)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 12)
+    {
+        std::fprintf(stderr, "Can't open %s\n", path);
+
+        return false;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+    {
+        std::fprintf(stderr, "Can't map %s\n", path);
+
+        return false;
+    }
+    input.data = static_cast<const uint8_t *>(data);
+    input.size = st.st_size;
+
+    if (std::memcmp(input.data, "RIFF", 4) || std::memcmp(input.data + 8, "WAVE", 4))
+    {
+        std::fprintf(stderr, "%s is not a WAV file\n", path);
+
+        return false;
+    }
+
+    size_t offset{12};
+    int32_t format{};
+    while (offset + 8 <= input.size)
+    {
+        const uint8_t *chunk = input.data + offset;
+        size_t chunkSize = ReadLe(chunk + 4, 4);
+        if (!std::memcmp(chunk, "fmt ", 4) && chunkSize >= 16)
+        {
+            format = ReadLe(chunk + 8, 2);
+            input.channels = ReadLe(chunk + 10, 2);
+            input.sampleRate = ReadLe(chunk + 12, 4);
+            input.bits = ReadLe(chunk + 22, 2);
+            if (0xfffe == format && chunkSize >= 26)
+            {
+                // WAVE_FORMAT_EXTENSIBLE, the format is in the sub format.
+                format = ReadLe(chunk + 32, 2);
+            }
+        }
+        else if (!std::memcmp(chunk, "data", 4))
+        {
+            chunkSize = std::min(chunkSize, input.size - offset - 8);
+            input.samples = chunk + 8;
+            input.frames = input.channels > 0 && input.bits >= 8 ? chunkSize / (input.channels * (input.bits / 8)) : 0;
+        }
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    input.isFloat = 3 == format;
+    bool supported = (1 == format && (16 == input.bits || 24 == input.bits || 32 == input.bits)) || (input.isFloat && 32 == input.bits);
+    if (!supported || input.channels < 1 || input.channels > 2 || !input.samples || input.sampleRate <= 0)
+    {
+        std::fprintf(stderr, "%s: unsupported format\n", path);
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns the given sample of the input as a float, silence past its
+ * end.
+ */
+float InputSample(const Input &input, int64_t frame, int32_t channel)
+{
+    if (frame >= input.frames)
+    {
+        return 0.f;
+    }
+
+    int32_t bytes = input.bits / 8;
+    const uint8_t *p = input.samples + (frame * input.channels + std::min(channel, input.channels - 1)) * bytes;
+    if (input.isFloat)
+    {
+        float value;
+        std::memcpy(&value, p, sizeof(value));
+
+        return value;
+    }
+    switch (input.bits)
+    {
+    case 16:
+        return static_cast<int16_t>(ReadLe(p, 2)) / 32768.f;
+    case 24:
+        return static_cast<int32_t>(ReadLe(p, 3) << 8) / 2147483648.f;
+    default:
+        return static_cast<int32_t>(ReadLe(p, 4)) / 2147483648.f;
+    }
+}
+
+bool ParseScript(Job &job, int32_t sampleRate)
+{
+    std::ifstream file(job.path);
+    if (!file)
+    {
+        job.error = "can't open the script";
+
+        return false;
+    }
+    if (!job.script.Parse(file, sampleRate))
+    {
+        job.error = job.script.GetError();
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Renders a job to a 32 bit float stereo WAV file, written through a
+ * memory mapping. Everything the looper needs is owned by the job, so that
+ * jobs can run in parallel.
+ */
+bool Render(const Input &input, Job &job, size_t blockSize)
+{
+    int32_t sampleRate = input.sampleRate;
+    int64_t frames = job.script.lengthSeconds > 0 ? static_cast<int64_t>(job.script.lengthSeconds * sampleRate) : input.frames;
+    size_t dataBytes = frames * 2 * sizeof(float);
+    size_t fileBytes = 44 + dataBytes;
+    if (fileBytes > UINT32_MAX)
+    {
+        job.error = "the output is too long for a WAV file";
+
+        return false;
+    }
+
+    // The buffers and the freeze buffers of both channels, plus the room to
+    // align them.
+    size_t memoryBytes = 4 * static_cast<size_t>(job.script.conf.bufferSeconds * sampleRate + 1) * sizeof(BufferSample) + 4 * kArenaAlignment;
+    std::unique_ptr<uint8_t[]> memory{new (std::nothrow) uint8_t[memoryBytes + kArenaAlignment]};
+    std::unique_ptr<StereoLooper> looper{new (std::nothrow) StereoLooper()};
+    if (!memory || !looper)
+    {
+        job.error = "out of memory";
+
+        return false;
+    }
+    void *aligned = memory.get();
+    size_t space = memoryBytes + kArenaAlignment;
+    std::align(kArenaAlignment, memoryBytes, aligned, space);
+    Arena arena;
+    arena.Init(aligned, memoryBytes);
+    if (!looper->Init(sampleRate, job.script.conf, arena))
+    {
+        job.error = "the buffers don't fit in memory";
+
+        return false;
+    }
+
+    int fd = open(job.output.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, fileBytes) < 0)
+    {
+        job.error = "can't create " + job.output;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return false;
+    }
+    void *mapping = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mapping)
+    {
+        job.error = "can't map " + job.output;
+
+        return false;
+    }
+
+    uint8_t *header = static_cast<uint8_t *>(mapping);
+    std::memcpy(header, "RIFF", 4);
+    WriteLe(header + 4, fileBytes - 8, 4);
+    std::memcpy(header + 8, "WAVEfmt ", 8);
+    WriteLe(header + 16, 16, 4);
+    WriteLe(header + 20, 3, 2); // IEEE float
+    WriteLe(header + 22, 2, 2);
+    WriteLe(header + 24, sampleRate, 4);
+    WriteLe(header + 28, sampleRate * 2 * sizeof(float), 4);
+    WriteLe(header + 32, 2 * sizeof(float), 2);
+    WriteLe(header + 34, 32, 2);
+    std::memcpy(header + 36, "data", 4);
+    WriteLe(header + 40, dataBytes, 4);
+    float *out = reinterpret_cast<float *>(header + 44);
+
+    auto start = std::chrono::steady_clock::now();
+    job.script.Render(
+        *looper, frames, blockSize,
+        [&input](int64_t frame, float *left, float *right, size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                left[i] = InputSample(input, frame + i, 0);
+                right[i] = InputSample(input, frame + i, 1);
+            }
+        },
+        [out](int64_t frame, const float *left, const float *right, size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                out[(frame + i) * 2] = left[i];
+                out[(frame + i) * 2 + 1] = right[i];
+            }
+        });
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    munmap(mapping, fileBytes);
+
+    return true;
+}
+
+std::string OutputPath(const std::string &script)
+{
+    size_t slash = script.find_last_of('/');
+    size_t dot = script.find_last_of('.');
+    std::string base = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? script.substr(0, dot) : script;
+
+    return base + ".wav";
+}
+
+int main(int argc, char *argv[])
+{
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t blockSize{kDefaultBlockSize};
+    int arg{1};
+    for (; arg + 1 < argc && '-' == argv[arg][0]; arg += 2)
+    {
+        if (!std::strcmp(argv[arg], "-j"))
+        {
+            threads = std::max(std::atoi(argv[arg + 1]), 1);
+        }
+        else if (!std::strcmp(argv[arg], "-b"))
+        {
+            blockSize = std::max(std::atoi(argv[arg + 1]), 1);
+        }
+    }
+    if (argc - arg < 2)
+    {
+        std::fprintf(stderr, "Usage: %s [-j threads] [-b block] input.wav script [script...]\n", argv[0]);
+
+        return 1;
+    }
+
+    Input input;
+    if (!OpenInput(argv[arg], input))
+    {
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    for (int i = arg + 1; i < argc; i++)
+    {
+        Job job;
+        job.path = argv[i];
+        job.output = OutputPath(job.path);
+        jobs.push_back(job);
+    }
+
+    // Each thread takes the next job until there are none left.
+    std::atomic<size_t> nextJob{0};
+    auto worker = [&]()
+    {
+        for (size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+        {
+            if (ParseScript(jobs[i], input.sampleRate))
+            {
+                Render(input, jobs[i], blockSize);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < std::min(threads, jobs.size()); i++)
+    {
+        pool.emplace_back(worker);
+    }
+    for (std::thread &thread : pool)
+    {
+        thread.join();
+    }
+
+    int failed{};
+    double inputSeconds = static_cast<double>(input.frames) / input.sampleRate;
+    for (const Job &job : jobs)
+    {
+        if (!job.error.empty())
+        {
+            std::fprintf(stderr, "%s: %s\n", job.path.c_str(), job.error.c_str());
+            failed++;
+            continue;
+        }
+        double seconds = job.script.lengthSeconds > 0 ? job.script.lengthSeconds : inputSeconds;
+        std::printf("%s: %.1f s rendered in %.2f s (%.0fx real time)\n", job.output.c_str(), seconds, job.seconds, job.seconds > 0 ? seconds / job.seconds : 0.);
+    }
+
+    munmap(const_cast<uint8_t *>(input.data), input.size);
+
+    return failed ? 1 : 0;
+}
@@ -1,4 +1,4 @@
 #!/bin/sh
 
-clang++ -std=c++17 -stdlib=libc++ -I./DaisySP/Source tests.cpp looper.cpp -o tests
+clang++ -std=c++17 -stdlib=libc++ -I. -I./host -I./DaisySP/Source tests.cpp looper.cpp DaisySP/Source/Filters/svf.cpp -o tests
 ./tests
\ No newline at end of file
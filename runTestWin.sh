@@ -1,4 +1,4 @@
 #!/bin/sh
 
-g++ -I./DaisySP/Source tests.cpp looper.cpp -o tests
+g++ -std=c++17 -I. -I./host -I./DaisySP/Source tests.cpp looper.cpp DaisySP/Source/Filters/svf.cpp -o tests
 ./tests
\ No newline at end of file
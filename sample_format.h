@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace wreath
+{
+    /**
+     * @brief Converts the samples between the processing format (float) and
+     * the format used to store them in the buffers.
+     */
+    template <typename T>
+    struct SampleFormat;
+
+    template <>
+    struct SampleFormat<float>
+    {
+        static inline float Load(float sample) { return sample; }
+        static inline float Store(float value) { return value; }
+    };
+
+    /**
+     * @brief 16 bit storage, halves the memory used by the buffers (and the
+     * bandwidth on reading and writing) at the cost of some resolution. The
+     * values are rounded to the nearest step, with the same scale both ways,
+     * so that storing what was loaded gives back the same sample.
+     */
+    template <>
+    struct SampleFormat<int16_t>
+    {
+        static inline float Load(int16_t sample) { return sample * (1.f / 32767.f); }
+        static inline int16_t Store(float value) { return static_cast<int16_t>(std::lrintf(std::max(-1.f, std::min(value, 1.f)) * 32767.f)); }
+    };
+} // namespace wreath
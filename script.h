@@ -0,0 +1,396 @@
+#pragma once
+
+#include "stereo_looper.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace wreath
+{
+    constexpr float kScriptBufferSeconds{30.f}; // Unless the script says otherwise
+    constexpr size_t kScriptMaxBlockSize{256};
+
+    /**
+     * @brief A timeline of control events for StereoLooper, used to render
+     * presets and scenarios offline (see render.cpp and golden.cpp). A script
+     * has a configuration part and a timeline, one entry per line ("#" starts
+     * a comment). The configuration keywords are:
+     *
+     *   mode mono|cross|dual     movement normal|pendulum|drunk
+     *   direction forward|backwards
+     *   buffer <seconds>         length <seconds>
+     *   seed <number>
+     *
+     * The timeline entries start with the time in seconds, followed by the
+     * event and its arguments. The channel is left, right or both:
+     *
+     *   <t> start | stop_buffering | trigger | restart | clear | reset
+     *   <t> loop_start <channel> <seconds>   <t> loop_length <channel> <seconds>
+     *   <t> rate <channel> <rate>            <t> write_rate <channel> <rate>
+     *   <t> freeze <channel> <amount>        <t> direction <channel> forward|backwards
+     *   <t> movement <channel> normal|pendulum|drunk
+     *   <t> loop_sync <channel> on|off       <t> looping on|off
+     *   <t> grains <channel> <per second>    <t> grain_size <channel> <seconds>
+     *   <t> grain_spread <channel> <amount>
+     *   <t> feedback|mix|filter|filter_level|degradation|rate_slew|input_gain|output_gain <value>
+     *
+     * The events that are commands are sent stamped with their frame (see
+     * StereoLooper::SendAt()), so they take effect at their very sample. The
+     * others set a parameter directly, the blocks are split so that each of
+     * them falls at the start of one.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    class Script
+    {
+    public:
+        Script() {}
+        ~Script() {}
+
+        struct Event
+        {
+            int64_t frame{};
+            std::string name{};
+            int channel{StereoLooper::BOTH};
+            float value{};
+        };
+
+        StereoLooper::Conf conf{StereoLooper::MONO, Movement::NORMAL, Direction::FORWARD, 1.f};
+        double lengthSeconds{}; // 0 when not given
+
+        /**
+         * @brief Reads the script, the times are converted to frames at the
+         * given sample rate.
+         *
+         * @param in
+         * @param sampleRate
+         * @return true
+         * @return false on a syntax error, see GetError()
+         */
+        bool Parse(std::istream &in, int32_t sampleRate)
+        {
+            sampleRate_ = sampleRate;
+            conf.bufferSeconds = kScriptBufferSeconds;
+            events_.clear();
+
+            std::string line;
+            for (int number = 1; std::getline(in, line); number++)
+            {
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string first;
+                if (!(fields >> first))
+                {
+                    continue;
+                }
+
+                char *end{};
+                double time = std::strtod(first.c_str(), &end);
+                if (!(*end ? ParseConf(first, fields) : ParseEvent(time, fields)))
+                {
+                    error_ = "syntax error at line " + std::to_string(number);
+
+                    return false;
+                }
+            }
+
+            std::stable_sort(events_.begin(), events_.end(), [](const Event &a, const Event &b)
+                             { return a.frame < b.frame; });
+
+            return true;
+        }
+
+        /**
+         * @brief Runs the timeline on the given looper, which must have been
+         * initialized with the script's configuration. The input function
+         * fills the input blocks, the output function receives the processed
+         * ones.
+         *
+         * @param looper
+         * @param frames How many frames to render
+         * @param blockSize
+         * @param input void(int64_t frame, float *left, float *right, size_t n)
+         * @param output void(int64_t frame, const float *left, const float *right, size_t n)
+         */
+        template <typename I, typename O>
+        void Render(StereoLooper &looper, int64_t frames, size_t blockSize, I input, O output)
+        {
+            blockSize = std::min(std::max(blockSize, static_cast<size_t>(1)), kScriptMaxBlockSize);
+            float inL[kScriptMaxBlockSize];
+            float inR[kScriptMaxBlockSize];
+            float outL[kScriptMaxBlockSize];
+            float outR[kScriptMaxBlockSize];
+            size_t next{};
+
+            for (int64_t frame = 0; frame < frames;)
+            {
+                // The commands are sent stamped with their frame, only the
+                // parameters set directly split the block.
+                int64_t end = std::min(frames, frame + static_cast<int64_t>(blockSize));
+                StereoLooper::Command command;
+                while (next < events_.size() && events_[next].frame < end)
+                {
+                    const Event &event = events_[next];
+                    if (ToCommand(event, command))
+                    {
+                        looper.SendAt(command, event.frame);
+                    }
+                    else if (event.frame > frame)
+                    {
+                        end = event.frame;
+                        break;
+                    }
+                    else
+                    {
+                        Apply(looper, event);
+                    }
+                    next++;
+                }
+                size_t n = end - frame;
+
+                input(frame, inL, inR, n);
+                looper.ProcessBlock(inL, inR, outL, outR, n);
+                output(frame, outL, outR, n);
+                frame = end;
+            }
+        }
+
+        inline const std::string &GetError() { return error_; }
+
+    private:
+        std::vector<Event> events_{};
+        std::string error_{};
+        int32_t sampleRate_{};
+
+        static int ParseChannel(const std::string &channel)
+        {
+            if ("left" == channel)
+            {
+                return StereoLooper::LEFT;
+            }
+            if ("right" == channel)
+            {
+                return StereoLooper::RIGHT;
+            }
+
+            return StereoLooper::BOTH;
+        }
+
+        static bool ParseMovement(const std::string &value, Movement &movement)
+        {
+            movement = "pendulum" == value ? Movement::PENDULUM : ("drunk" == value ? Movement::DRUNK : Movement::NORMAL);
+
+            return "normal" == value || "pendulum" == value || "drunk" == value;
+        }
+
+        static bool ParseDirection(const std::string &value, Direction &direction)
+        {
+            direction = "backwards" == value ? Direction::BACKWARDS : Direction::FORWARD;
+
+            return "forward" == value || "backwards" == value;
+        }
+
+        static bool ParseSwitch(const std::string &value, float &result)
+        {
+            result = "on" == value;
+
+            return "on" == value || "off" == value;
+        }
+
+        bool ParseConf(const std::string &keyword, std::istringstream &fields)
+        {
+            std::string value;
+            fields >> value;
+            if ("mode" == keyword)
+            {
+                conf.mode = "dual" == value ? StereoLooper::DUAL : ("cross" == value ? StereoLooper::CROSS : StereoLooper::MONO);
+
+                return "mono" == value || "cross" == value || "dual" == value;
+            }
+            if ("movement" == keyword)
+            {
+                return ParseMovement(value, conf.movement);
+            }
+            if ("direction" == keyword)
+            {
+                return ParseDirection(value, conf.direction);
+            }
+            if ("buffer" == keyword)
+            {
+                conf.bufferSeconds = std::atof(value.c_str());
+
+                return conf.bufferSeconds > 0;
+            }
+            if ("length" == keyword)
+            {
+                lengthSeconds = std::atof(value.c_str());
+
+                return lengthSeconds > 0;
+            }
+            if ("seed" == keyword)
+            {
+                conf.seed = std::strtoul(value.c_str(), nullptr, 10);
+
+                return true;
+            }
+
+            return false;
+        }
+
+        bool ParseEvent(double time, std::istringstream &fields)
+        {
+            Event event;
+            event.frame = static_cast<int64_t>(time * sampleRate_ + 0.5);
+            if (time < 0 || !(fields >> event.name))
+            {
+                return false;
+            }
+
+            const std::string &name = event.name;
+            std::string channel;
+            std::string value;
+            bool ok{true};
+            if ("loop_start" == name || "loop_length" == name || "rate" == name || "write_rate" == name ||
+                "freeze" == name || "direction" == name || "movement" == name || "loop_sync" == name ||
+                "grains" == name || "grain_size" == name || "grain_spread" == name)
+            {
+                ok = static_cast<bool>(fields >> channel >> value);
+                event.channel = ParseChannel(channel);
+            }
+            else if ("feedback" == name || "mix" == name || "filter" == name || "filter_level" == name || "degradation" == name ||
+                     "rate_slew" == name || "input_gain" == name || "output_gain" == name || "looping" == name)
+            {
+                ok = static_cast<bool>(fields >> value);
+            }
+            else
+            {
+                ok = "start" == name || "stop_buffering" == name || "trigger" == name ||
+                     "restart" == name || "clear" == name || "reset" == name;
+            }
+
+            if ("direction" == name)
+            {
+                Direction direction{};
+                ok = ok && ParseDirection(value, direction);
+                event.value = direction;
+            }
+            else if ("movement" == name)
+            {
+                Movement movement{};
+                ok = ok && ParseMovement(value, movement);
+                event.value = movement;
+            }
+            else if ("loop_sync" == name || "looping" == name)
+            {
+                ok = ok && ParseSwitch(value, event.value);
+            }
+            else
+            {
+                event.value = std::atof(value.c_str());
+            }
+            events_.push_back(event);
+
+            return ok;
+        }
+
+        /**
+         * @brief Converts an event to the command sent for it.
+         *
+         * @param event
+         * @param command
+         * @return true
+         * @return false if the event sets a parameter directly, see Apply()
+         */
+        bool ToCommand(const Event &event, StereoLooper::Command &command)
+        {
+            using Command = StereoLooper::Command;
+            const std::string &name = event.name;
+            command = {Command::START, StereoLooper::BOTH, 0.f};
+            if ("start" == name)
+            {
+                return true;
+            }
+
+            static const struct
+            {
+                const char *name;
+                Command::Type type;
+            } types[]{
+                {"stop_buffering", Command::STOP_BUFFERING},
+                {"trigger", Command::RETRIGGER},
+                {"restart", Command::RESTART},
+                {"clear", Command::CLEAR_BUFFER},
+                {"reset", Command::RESET_LOOPER},
+                {"loop_start", Command::SET_LOOP_START},
+                {"loop_length", Command::SET_LOOP_LENGTH},
+                {"rate", Command::SET_READ_RATE},
+                {"write_rate", Command::SET_WRITE_RATE},
+                {"freeze", Command::SET_FREEZE},
+                {"direction", Command::SET_DIRECTION},
+                {"movement", Command::SET_MOVEMENT},
+                {"loop_sync", Command::SET_LOOP_SYNC},
+                {"looping", Command::SET_LOOPING},
+                {"filter", Command::SET_FILTER_VALUE},
+                {"degradation", Command::SET_DEGRADATION},
+                {"grains", Command::SET_GRAIN_DENSITY},
+                {"grain_size", Command::SET_GRAIN_SIZE},
+                {"grain_spread", Command::SET_GRAIN_SPREAD},
+            };
+            for (const auto &type : types)
+            {
+                if (type.name == name)
+                {
+                    bool samples = "loop_start" == name || "loop_length" == name || "grain_size" == name;
+                    bool toggle = "loop_sync" == name || "looping" == name;
+                    command.type = type.type;
+                    command.channel = event.channel;
+                    command.value = samples ? event.value * sampleRate_ : (toggle ? static_cast<float>(event.value > 0) : event.value);
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Sets the parameters that are not sent as commands, they take
+         * effect from the next block.
+         *
+         * @param looper
+         * @param event
+         */
+        void Apply(StereoLooper &looper, const Event &event)
+        {
+            const std::string &name = event.name;
+            if ("feedback" == name)
+            {
+                looper.feedback = event.value;
+            }
+            else if ("mix" == name)
+            {
+                looper.dryWetMix = event.value;
+            }
+            else if ("filter_level" == name)
+            {
+                looper.filterLevel = event.value;
+            }
+            else if ("rate_slew" == name)
+            {
+                looper.rateSlew = event.value;
+            }
+            else if ("input_gain" == name)
+            {
+                looper.inputGain = event.value;
+            }
+            else if ("output_gain" == name)
+            {
+                looper.outputGain = event.value;
+            }
+        }
+    };
+} // namespace wreath
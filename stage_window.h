@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+
+namespace wreath
+{
+    constexpr int32_t kStageSamples{512}; // Enough for a block at 4x speed
+    constexpr int32_t kStageMargin{4};    // Enough for the interpolation taps
+
+    /**
+     * @brief A window of the buffer staged in fast internal memory (where the
+     * looper lives) ahead of a reading head, so that reading doesn't hit the
+     * SDRAM sample by sample. Define WREATH_STAGED_READS to enable it.
+     *
+     * The copy is done by WREATH_STAGE_TRANSFER(dst, src, count, stride) when
+     * defined, for instance with an MDMA transfer on the Daisy, otherwise with
+     * a plain loop. Either way the transfer must be complete on return, and
+     * when done by a DMA the data cache lines of the source must be cleaned
+     * first.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T>
+    class StageWindow
+    {
+    public:
+        StageWindow() {}
+        ~StageWindow() {}
+
+        /**
+         * @brief Makes sure that the window holds the given span, copying it
+         * from the buffer if it doesn't already. The window is filled in the
+         * direction of the reading, so that it lasts as long as possible.
+         *
+         * @param buffer
+         * @param stride The distance between two consecutive samples
+         * @param from The first sample of the span
+         * @param to The sample after the last one of the span
+         * @param forward Whether the head goes forward
+         * @param bufferSamples The written buffer length, the span is clamped to it
+         */
+        void Stage(const T *buffer, int32_t stride, int32_t from, int32_t to, bool forward, int32_t bufferSamples)
+        {
+            from = from < 0 ? 0 : from;
+            to = to > bufferSamples ? bufferSamples : to;
+            if (from >= to || (from >= start_ && to <= start_ + count_))
+            {
+                return;
+            }
+
+            int32_t count = bufferSamples < kStageSamples ? bufferSamples : kStageSamples;
+            int32_t start = forward ? from : to - count;
+            start = start < 0 ? 0 : (start + count > bufferSamples ? bufferSamples - count : start);
+
+            Transfer(samples_, buffer + start * stride, count, stride);
+            start_ = start;
+            count_ = count;
+        }
+
+        /**
+         * @brief Tells whether the given sample is in the window.
+         *
+         * @param index
+         * @return true
+         * @return false
+         */
+        inline bool Contains(int32_t index)
+        {
+            return static_cast<uint32_t>(index - start_) < static_cast<uint32_t>(count_);
+        }
+
+        inline T Get(int32_t index)
+        {
+            return samples_[index - start_];
+        }
+
+        /**
+         * @brief Keeps the window coherent with the buffer, call this when
+         * writing the given sample.
+         *
+         * @param index
+         * @param value
+         */
+        inline void Refresh(int32_t index, T value)
+        {
+            if (Contains(index))
+            {
+                samples_[index - start_] = value;
+            }
+        }
+
+        /**
+         * @brief Empties the window, call this when the buffer is changed
+         * other than by writing.
+         */
+        void Invalidate()
+        {
+            start_ = 0;
+            count_ = 0;
+        }
+
+    private:
+        T samples_[kStageSamples]{};
+        int32_t start_{}; // The buffer index of the first sample in the window
+        int32_t count_{}; // The samples in the window
+
+        static void Transfer(T *dst, const T *src, int32_t count, int32_t stride)
+        {
+#if defined(WREATH_STAGE_TRANSFER)
+            WREATH_STAGE_TRANSFER(dst, src, count, stride);
+#else
+            for (int32_t i = 0; i < count; i++)
+            {
+                dst[i] = src[i * stride];
+            }
+#endif
+        }
+    };
+} // namespace wreath
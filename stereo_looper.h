@@ -1,11 +1,15 @@
 #pragma once
 
+#include "buffers.h"
 #include "head.h"
 #include "looper.h"
 #include "envelope_follower.h"
+#include "command_queue.h"
+#include "profiler.h"
+#include "telemetry.h"
 #include "Utility/dsp.h"
 #include "Filters/svf.h"
-#include "dev/sdram.h"
+#include <algorithm>
 #include <cmath>
 #include <stddef.h>
 
@@ -13,18 +17,6 @@ namespace wreath
 {
     using namespace daisysp;
 
-    constexpr int32_t kSampleRate{48000};
-    constexpr int kBufferSeconds{80}; // 1:20 minutes, max with 4 buffers
-    const int32_t kBufferSamples{kSampleRate * kBufferSeconds};
-
-    // Looper buffers.
-    float DSY_SDRAM_BSS leftBuffer_[kBufferSamples];
-    float DSY_SDRAM_BSS rightBuffer_[kBufferSamples];
-
-    // Freeze buffers.
-    float DSY_SDRAM_BSS leftFreezeBuffer_[kBufferSamples];
-    float DSY_SDRAM_BSS rightFreezeBuffer_[kBufferSamples];
-
     /**
      * @brief The higher level class of the looper, this is the one you want to
      *  instantiate.
@@ -82,11 +74,97 @@ namespace wreath
             Movement movement;
             Direction direction;
             float rate;
+            uint32_t seed{};             // Random seed, the same seed gives the same results
+            float bufferSeconds{};       // Buffer length per channel, 0 to take all the memory available
+            bool freezeBuffers{true};    // Whether to allocate the freeze buffers
+            float freezeSeconds{};       // Freeze buffer length per channel, 0 for the same as the buffer
+            float startupSeconds{0.25f}; // Silence before buffering, lets the input settle
+            bool waveformPeaks{};        // Whether to index the peaks of the buffers, see GetPeaks()
+            float undoSeconds{};         // Undo history per channel, 0 for none, see Undo()
+            int32_t grainVoices{kMaxGrains}; // Most grains per channel in granular mode, see SetGrainDensity()
+        };
+
+        /**
+         * @brief A consistent snapshot of the looper, published by the audio
+         * callback for the UI, see GetTelemetry().
+         */
+        struct Telemetry
+        {
+            struct Channel
+            {
+                float readPos;
+                float writePos;
+                float loopStart;
+                float loopEnd;
+                float loopLength;
+                float crossPoint;
+                float headsDistance;
+                float readRate;
+                float writeRate;
+                float freeze;
+                Direction direction;
+                Movement movement;
+                uint32_t fades; // The fades in progress, see Looper::FadeFlag
+                bool reading;
+                bool writing;
+                bool undoable;
+                bool redoable;
+                int32_t grains; // The grains playing, see SetGrainDensity()
+            };
+
+            Channel channels[2];
+            State state;
+            Mode mode;
+            float load;     // The share of the block's time spent processing it, averaged, 0 with Process()
+            uint32_t count; // Snapshots published so far
+            int64_t frame;  // The frames processed when it was published, the clock of SendAt()
         };
 
-        bool mustResetLooper{};
-        bool mustClearBuffer{};
-        bool mustStopBuffering{};
+        /**
+         * @brief A command sent by the control code to the audio callback.
+         * Commands are queued and handled at the beginning of the next block,
+         * or at the given frame when sent with SendAt().
+         */
+        struct Command
+        {
+            enum Type
+            {
+                START,
+                RESET_LOOPER,
+                CLEAR_BUFFER,
+                UNDO,
+                REDO,
+                STOP_BUFFERING,
+                RESTORE,
+                RELOAD,
+                RETRIGGER,
+                RESTART,
+                START_READING,
+                STOP_READING,
+                START_WRITING,
+                STOP_WRITING,
+                SET_LOOP_SYNC,
+                SET_FILTER_VALUE,
+                SET_DEGRADATION,
+                SET_LOOPING,
+                SET_MOVEMENT,
+                SET_DIRECTION,
+                SET_LOOP_START,
+                SET_LOOP_LENGTH,
+                SET_FREEZE,
+                SET_READ_RATE,
+                SET_WRITE_RATE,
+                SET_GRAIN_DENSITY,
+                SET_GRAIN_SIZE,
+                SET_GRAIN_SPREAD,
+            };
+
+            Type type;
+            int channel;
+            float value;
+            int32_t span{};  // The samples from value on, for RELOAD
+            int64_t frame{}; // When to handle it, see SendAt()
+        };
 
         float inputGain{1.f};
         float outputGain{1.f};
@@ -107,36 +185,10 @@ namespace wreath
         NoteMode noteModeLeft{};
         NoteMode noteModeRight{};
 
-        int32_t nextLeftLoopStart{};
-        int32_t nextRightLoopStart{};
-
-        Direction leftDirection{};
-        Direction rightDirection{};
-
-        int32_t nextLeftLoopLength{};
-        int32_t nextRightLoopLength{};
-
-        float nextLeftReadRate{};
-        float nextRightReadRate{};
-
-        float nextLeftWriteRate{};
-        float nextRightWriteRate{};
-
-        float nextLeftFreeze{};
-        float nextRightFreeze{};
-
-        bool mustStartReading{};
-        bool mustStopReading{};
-        bool mustStartWriting{};
-        bool mustStopWriting{};
-        bool mustStartWritingLeft{};
-        bool mustStopWritingLeft{};
-        bool mustStartWritingRight{};
-        bool mustStopWritingRight{};
-        bool mustRetrigger{};
-        bool mustRestart{};
-
+        inline BufferSample *GetBuffer(int channel) { return loopers_[channel].GetBuffer(); }
+        inline int32_t GetBufferStride() { return interleaved_ ? 2 : 1; }
         inline int32_t GetBufferSamples(int channel) { return loopers_[channel].GetBufferSamples(); }
+        inline int32_t GetMaxBufferSamples(int channel) { return loopers_[channel].GetMaxBufferSamples(); }
         inline float GetBufferSeconds(int channel) { return loopers_[channel].GetBufferSeconds(); }
         inline float GetLoopStartSeconds(int channel) { return loopers_[channel].GetLoopStartSeconds(); }
         inline float GetLoopLengthSeconds(int channel) { return loopers_[channel].GetLoopLengthSeconds(); }
@@ -147,6 +199,7 @@ namespace wreath
         inline float GetReadPos(int channel) { return loopers_[channel].GetReadPos(); }
         inline float GetWritePos(int channel) { return loopers_[channel].GetWritePos(); }
         inline float GetReadRate(int channel) { return loopers_[channel].GetReadRate(); }
+        inline float GetWriteRate(int channel) { return loopers_[channel].GetWriteRate(); }
         inline Movement GetMovement(int channel) { return loopers_[channel].GetMovement(); }
         inline bool IsGoingForward(int channel) { return loopers_[channel].IsGoingForward(); }
         inline int32_t GetCrossPoint(int channel) { return loopers_[channel].GetCrossPoint(); }
@@ -162,28 +215,287 @@ namespace wreath
         inline bool IsCrossMode() { return Mode::CROSS == conf_.mode; }
         inline bool IsDualMode() { return Mode::DUAL == conf_.mode; }
         inline Mode GetMode() { return conf_.mode; }
+        inline bool IsInterleaved() { return interleaved_; }
+#if defined(WREATH_PROFILING)
+        /**
+         * @brief Returns the cycles spent per sample in the given processing
+         * stage, call this from the main loop.
+         *
+         * @param stage
+         * @return Profiler::Stats
+         */
+        inline Profiler::Stats GetProfilerStats(Profiler::Stage stage) { return profiler_.GetStats(stage); }
+        inline void ResetProfiler() { profiler_.Reset(); }
+#endif
         inline bool GetLoopSync() { return loopSync_; }
         inline float GetFilterValue() { return filterValue_; }
 
+        /**
+         * @brief Returns the last snapshot of the looper, with the state of
+         * both channels taken at the same time. The audio callback publishes
+         * it once per block (every kTelemetrySamples with Process()), so
+         * call this from the main loop at the UI's rate instead of the
+         * single getters, whose values may change from a call to the next.
+         *
+         * @return Telemetry
+         */
+        inline Telemetry GetTelemetry() { return telemetry_.Read(); }
+
+        /**
+         * @brief Fills the waveform of the given channel's loop, the minimum
+         * and maximum values of each pixel. With the waveformPeaks
+         * configuration it takes O(pixels) and doesn't scan the buffer in
+         * SDRAM, call it from the main loop.
+         *
+         * @param channel
+         * @param peaks
+         * @param pixels
+         */
+        void GetPeaks(int channel, PeakIndex::Peak *peaks, int32_t pixels)
+        {
+            Looper<BufferSample, BufferInterpolation> &looper = loopers_[channel];
+            GetPeaks(channel, looper.GetLoopStart(), looper.GetLoopLength(), peaks, pixels);
+        }
+
+        /**
+         * @brief Fills the waveform of a window of the given channel's buffer,
+         * see GetPeaks().
+         *
+         * @param channel
+         * @param start The first sample of the window
+         * @param length The window length in samples
+         * @param peaks
+         * @param pixels
+         */
+        void GetPeaks(int channel, float start, float length, PeakIndex::Peak *peaks, int32_t pixels)
+        {
+            loopers_[channel].GetPeaks(start, length, peaks, pixels);
+        }
+
+        /**
+         * @brief Tells the audio callback that a span of both buffers has been
+         * filled externally (see Persistence), so that the loopers take it
+         * into account, see Looper::Reload().
+         *
+         * @param from
+         * @param to The sample after the last one
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Reload(int32_t from, int32_t to)
+        {
+            return Send({Command::RELOAD, BOTH, static_cast<float>(from), to - from});
+        }
+
 
         /**
          * @brief Inits the looper. Call this before setting up the AudioCallback.
+         * The buffers are carved from the whole SDRAM memory, which is given
+         * back first, so this is for when there's only one looper.
+         *
+         * @param sampleRate
+         * @param conf
+         * @return true
+         * @return false if the buffers don't fit in memory
+         */
+        bool Init(int32_t sampleRate, Conf conf)
+        {
+            sdramArena_.Init(sdramMemory_, sizeof(sdramMemory_));
+
+            return Init(sampleRate, conf, sdramArena_);
+        }
+
+        /**
+         * @brief Inits the looper, carving the buffers from the given arena.
+         * Use this to have more than one looper share the memory, using the
+         * configuration to split it.
          *
          * @param sampleRate
          * @param conf
+         * @param arena
+         * @return true
+         * @return false if the buffers don't fit in the arena
          */
-        void Init(int32_t sampleRate, Conf conf)
+        bool Init(int32_t sampleRate, Conf conf, Arena &arena)
         {
+            int32_t bufferSamples = conf.bufferSeconds * sampleRate;
+            int32_t freezeSamples = conf.freezeSeconds * sampleRate;
+            int32_t undoSamples = std::max(conf.undoSeconds, 0.f) * sampleRate;
+            if (bufferSamples <= 0)
+            {
+                // Take what's left, considering that the freeze buffers, if
+                // present, are as long as the buffers unless specified.
+                size_t available = arena.Available<BufferSample>();
+                if (conf.waveformPeaks)
+                {
+                    // Leave room for the peak indexes, as if the buffers took
+                    // all the memory.
+                    size_t peakBytes = PeakIndex::CountBuckets(available / 2) * sizeof(PeakIndex::Bucket) + kArenaAlignment;
+                    available -= std::min(available, 2 * peakBytes / sizeof(BufferSample));
+                }
+                if (undoSamples > 0)
+                {
+                    // And for the undo histories.
+                    size_t undoBytes = undoSamples * sizeof(BufferSample) + UndoPages(undoSamples, available / 2) * sizeof(UndoRecord) + 2 * kArenaAlignment;
+                    available -= std::min(available, 2 * undoBytes / sizeof(BufferSample));
+                }
+                if (!conf.freezeBuffers)
+                {
+                    bufferSamples = available / 2;
+                }
+                else if (freezeSamples > 0)
+                {
+                    // Leave room for aligning the freeze buffers.
+                    bufferSamples = available / 2 - freezeSamples - kArenaAlignment;
+                }
+                else
+                {
+                    bufferSamples = available / 4;
+                }
+                // This way the buffers need no padding between them.
+                bufferSamples &= ~(kArenaAlignment - 1);
+            }
+            if (freezeSamples <= 0 || freezeSamples > bufferSamples)
+            {
+                freezeSamples = bufferSamples;
+            }
+            if (bufferSamples <= 0)
+            {
+                return false;
+            }
+
+            // In the linked modes the heads of the two channels are usually at
+            // the same position, so the channels are interleaved and both
+            // samples of a frame come with the same access. In dual mode the
+            // heads diverge, so the channels are kept apart.
+            int32_t stride = Mode::DUAL == conf.mode ? 1 : 2;
+            BufferSample *buffers[2]{};
+            BufferSample *freezeBuffers[2]{};
+            if (stride > 1)
+            {
+                buffers[LEFT] = arena.Allocate<BufferSample>(2 * bufferSamples);
+                buffers[RIGHT] = buffers[LEFT] ? buffers[LEFT] + 1 : nullptr;
+            }
+            for (int channel = LEFT; channel <= RIGHT; channel++)
+            {
+                if (stride == 1)
+                {
+                    buffers[channel] = arena.Allocate<BufferSample>(bufferSamples);
+                }
+                if (conf.freezeBuffers)
+                {
+                    freezeBuffers[channel] = arena.Allocate<BufferSample>(freezeSamples);
+                    if (!freezeBuffers[channel])
+                    {
+                        return false;
+                    }
+                }
+                if (!buffers[channel])
+                {
+                    return false;
+                }
+            }
+            BufferSample *undoPools[2]{};
+            UndoRecord *undoRecords[2]{};
+            int32_t undoPages = UndoPages(undoSamples, bufferSamples);
+            for (int channel = LEFT; channel <= RIGHT && undoPages > 0; channel++)
+            {
+                undoPools[channel] = arena.Allocate<BufferSample>(undoPages << UndoHistory<BufferSample>::PageShift(bufferSamples));
+                undoRecords[channel] = arena.Allocate<UndoRecord>(undoPages);
+                if (!undoPools[channel] || !undoRecords[channel])
+                {
+                    return false;
+                }
+            }
+            PeakIndex::Bucket *peaks[2]{};
+            for (int channel = LEFT; channel <= RIGHT && conf.waveformPeaks; channel++)
+            {
+                peaks[channel] = arena.Allocate<PeakIndex::Bucket>(PeakIndex::CountBuckets(bufferSamples));
+                if (!peaks[channel])
+                {
+                    return false;
+                }
+            }
+
             sampleRate_ = sampleRate;
-            loopers_[LEFT].Init(sampleRate_, leftBuffer_, leftFreezeBuffer_, kBufferSamples);
-            loopers_[RIGHT].Init(sampleRate_, rightBuffer_, rightFreezeBuffer_, kBufferSamples);
+            loopers_[LEFT].Init(sampleRate_, buffers[LEFT], freezeBuffers[LEFT], bufferSamples, freezeSamples, stride);
+            loopers_[RIGHT].Init(sampleRate_, buffers[RIGHT], freezeBuffers[RIGHT], bufferSamples, freezeSamples, stride);
+            loopers_[LEFT].InitPeaks(peaks[LEFT]);
+            loopers_[RIGHT].InitPeaks(peaks[RIGHT]);
+            loopers_[LEFT].InitUndo(undoPools[LEFT], undoRecords[LEFT], undoPages);
+            loopers_[RIGHT].InitUndo(undoPools[RIGHT], undoRecords[RIGHT], undoPages);
+            loopers_[LEFT].SetGrainVoices(conf.grainVoices);
+            loopers_[RIGHT].SetGrainVoices(conf.grainVoices);
+            interleaved_ = stride > 1;
             state_ = State::STARTUP;
-            feedbackFilter_.Init(sampleRate_);
+            startupIndex_ = 0;
+            startupSamples_ = std::max(conf.startupSeconds, 0.f) * sampleRate_;
+            feedbackFilters_[LEFT].Init(sampleRate_);
+            feedbackFilters_[RIGHT].Init(sampleRate_);
+            Profiler::EnableCounter();
+            load_ = 0;
+            frame_ = 0;
+            scheduledCount_ = 0;
+            telemetrySamples_ = 0;
+            filterEnvelopes_[LEFT].Init(sampleRate_);
+            filterEnvelopes_[RIGHT].Init(sampleRate_);
+            stereoScale_ = fastroot(2, 10);
+#if defined(WREATH_PROFILING)
+            profiler_.Init();
+#endif
 
             // Process configuration and reset the looper.
             conf_ = conf;
-            loopers_[LEFT].Reset();
-            loopers_[RIGHT].Reset();
+            loopers_[LEFT].SetSeed(conf_.seed);
+            loopers_[RIGHT].SetSeed(conf_.seed + 1);
+            Reset();
+
+            return true;
+        }
+
+        /**
+         * @brief Sends a command to the audio callback, call it from one
+         * thread only. The actions below use it, while the parameter setters
+         * leave their latest value for the callback to take at the beginning
+         * of the next block, after the commands, so that they are never
+         * dropped.
+         *
+         * @param command
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Send(const Command &command)
+        {
+            return commands_.Push(command);
+        }
+
+        /**
+         * @brief Sends a command to be handled at the given frame of the
+         * looper's clock, the frames processed since Init() (see
+         * Telemetry::frame). The block the frame falls in is split there, so
+         * that the command takes effect at that very sample whatever the
+         * block size. An external clock is followed by converting its ticks
+         * to frames, for instance the frame of the last tick plus the
+         * samples per tick. Commands for a frame already processed are
+         * handled at the beginning of the next block, like with Send(). When
+         * kMaxScheduled commands are already waiting, the command and the
+         * ones sent after it stay in the queue until one of those is due, so
+         * that it's never handled early.
+         *
+         * @param command
+         * @param frame
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool SendAt(Command command, int64_t frame)
+        {
+            command.frame = frame;
+
+            return commands_.Push(command);
         }
 
         /**
@@ -195,16 +507,7 @@ namespace wreath
          */
         void SetLoopSync(int channel, bool loopSync)
         {
-            if (BOTH == channel)
-            {
-                loopers_[LEFT].SetLoopSync(loopSync);
-                loopers_[RIGHT].SetLoopSync(loopSync);
-                loopSync_ = loopSync;
-            }
-            else
-            {
-                loopers_[channel].SetLoopSync(loopSync);
-            }
+            SetParameter(Command::SET_LOOP_SYNC, channel, static_cast<float>(loopSync));
         }
 
         /**
@@ -215,10 +518,7 @@ namespace wreath
          */
         void SetFilterValue(float value)
         {
-            filterValue_ = value;
-            feedbackFilter_.SetFreq(filterValue_);
-            feedbackFilter_.SetDrive(0.75f);
-            feedbackFilter_.SetRes(fmap(1.f - feedback, 0.05f, 0.2f + (freeze_ * 0.2f)));
+            SetParameter(Command::SET_FILTER_VALUE, BOTH, value);
         }
 
         /**
@@ -228,9 +528,7 @@ namespace wreath
          */
         void SetDegradation(float value)
         {
-            degradation_ = value;
-            loopers_[LEFT].SetDegradation(value);
-            loopers_[RIGHT].SetDegradation(value);
+            SetParameter(Command::SET_DEGRADATION, BOTH, value);
         }
 
         /**
@@ -241,8 +539,7 @@ namespace wreath
          */
         void SetLooping(bool active)
         {
-            loopers_[LEFT].SetLooping(active);
-            loopers_[RIGHT].SetLooping(active);
+            SetParameter(Command::SET_LOOPING, BOTH, static_cast<float>(active));
         }
 
         /**
@@ -255,16 +552,7 @@ namespace wreath
          */
         void SetMovement(int channel, Movement movement)
         {
-            if (BOTH == channel)
-            {
-                loopers_[LEFT].SetMovement(movement);
-                loopers_[RIGHT].SetMovement(movement);
-                conf_.movement = movement;
-            }
-            else
-            {
-                loopers_[channel].SetMovement(movement);
-            }
+            SetParameter(Command::SET_MOVEMENT, channel, static_cast<float>(movement));
         }
 
         /**
@@ -275,25 +563,7 @@ namespace wreath
          */
         void SetDirection(int channel, Direction direction)
         {
-            if (LEFT == channel || BOTH == channel)
-            {
-                leftDirection = direction;
-            }
-            if (RIGHT == channel || BOTH == channel)
-            {
-                rightDirection = direction;
-            }
-            if (BOTH == channel)
-            {
-                conf_.direction = direction;
-            }
-            // Before the looper starts, if the direction is backwards set the
-            // reading head at the end of the loop.
-            if (State::READY == state_ && Direction::BACKWARDS == direction)
-            {
-                loopers_[LEFT].SetReadPos(loopers_[LEFT].GetLoopEnd());
-                loopers_[RIGHT].SetReadPos(loopers_[RIGHT].GetLoopEnd());
-            }
+            SetParameter(Command::SET_DIRECTION, channel, static_cast<float>(direction));
         }
 
         /**
@@ -304,14 +574,7 @@ namespace wreath
          */
         void SetLoopStart(int channel, float value)
         {
-            if (LEFT == channel || BOTH == channel)
-            {
-                nextLeftLoopStart = std::min(std::max(value, 0.f), loopers_[LEFT].GetBufferSamples() - 1.f);
-            }
-            if (RIGHT == channel || BOTH == channel)
-            {
-                nextRightLoopStart = std::min(std::max(value, 0.f), loopers_[RIGHT].GetBufferSamples() - 1.f);
-            }
+            SetParameter(Command::SET_LOOP_START, channel, value);
         }
 
         /**
@@ -322,19 +585,7 @@ namespace wreath
          */
         void SetFreeze(int channel, float amount)
         {
-            if (LEFT == channel || BOTH == channel)
-            {
-                nextLeftFreeze = amount;
-            }
-            if (RIGHT == channel || BOTH == channel)
-            {
-                nextRightFreeze = amount;
-            }
-            freeze_ = amount;
-            if (State::READY != state_)
-            {
-                state_ = amount == 1.f ? State::FROZEN : State::RECORDING;
-            }
+            SetParameter(Command::SET_FREEZE, channel, amount);
         }
 
         /**
@@ -345,15 +596,7 @@ namespace wreath
          */
         void SetReadRate(int channel, float rate)
         {
-            if (LEFT == channel || BOTH == channel)
-            {
-                nextLeftReadRate = rate;
-            }
-            if (RIGHT == channel || BOTH == channel)
-            {
-                nextRightReadRate = rate;
-            }
-            conf_.rate = rate;
+            SetParameter(Command::SET_READ_RATE, channel, rate);
         }
 
         /**
@@ -364,14 +607,7 @@ namespace wreath
          */
         void SetWriteRate(int channel, float rate)
         {
-            if (LEFT == channel || BOTH == channel)
-            {
-                nextLeftWriteRate = rate;
-            }
-            if (RIGHT == channel || BOTH == channel)
-            {
-                nextRightWriteRate = rate;
-            }
+            SetParameter(Command::SET_WRITE_RATE, channel, rate);
         }
 
         /**
@@ -383,288 +619,1559 @@ namespace wreath
          */
         void SetLoopLength(int channel, float length)
         {
-            if (LEFT == channel || BOTH == channel)
-            {
-                nextLeftLoopLength = std::min(std::max(length, kMinLoopLengthSamples), static_cast<float>(loopers_[LEFT].GetBufferSamples()));
-                noteModeLeft = NoteMode::NO_MODE;
-                if (length <= kMinLoopLengthSamples)
-                {
-                    noteModeLeft = NoteMode::NOTE;
-                }
-                else if (length >= kMinSamplesForTone && length <= kMinSamplesForFlanger)
-                {
-                    noteModeLeft = NoteMode::FLANGER;
-                }
-            }
-            if (RIGHT == channel || BOTH == channel)
-            {
-                nextRightLoopLength = std::min(std::max(length, kMinLoopLengthSamples), static_cast<float>(loopers_[RIGHT].GetBufferSamples()));
-                noteModeRight = NoteMode::NO_MODE;
-                if (length <= kMinLoopLengthSamples)
-                {
-                    noteModeRight = NoteMode::NOTE;
-                }
-                else if (length >= kMinSamplesForTone && length <= kMinSamplesForFlanger)
-                {
-                    noteModeRight = NoteMode::FLANGER;
-                }
-            }
+            SetParameter(Command::SET_LOOP_LENGTH, channel, length);
         }
 
         /**
-         * @brief Starts reading for the first time. This must be called when
-         * the looper is ready to go.
+         * @brief Sets how many grains start per second, 0 turns the granular
+         * mode off. In granular mode each channel's loop is played by a cloud
+         * of short grains around the reading head, at the reading rate and
+         * direction, instead of the head itself (see GrainCloud).
+         *
+         * @param channel
+         * @param density
          */
-        void Start()
+        void SetGrainDensity(int channel, float density)
         {
-            if (State::READY == state_)
-            {
-                loopers_[LEFT].StartReading(true);
-                loopers_[RIGHT].StartReading(true);
-                state_ = freeze_ == 1.f ? State::FROZEN : State::RECORDING;
-            }
+            SetParameter(Command::SET_GRAIN_DENSITY, channel, density);
         }
 
         /**
-         * @brief Processes the input signals and outputs something. This goes
-         * in the main loop of your code.
+         * @brief Sets the length of the grains (in samples).
          *
-         * @param leftIn
-         * @param rightIn
-         * @param leftOut
-         * @param rightOut
+         * @param channel
+         * @param size
          */
-        void Process(const float leftIn, const float rightIn, float &leftOut, float &rightOut)
+        void SetGrainSize(int channel, float size)
         {
-            // Input gain stage.
-            float leftDry = SoftClip(leftIn * inputGain);
-            float rightDry = SoftClip(rightIn * inputGain);
+            SetParameter(Command::SET_GRAIN_SIZE, channel, size);
+        }
 
-            float leftWet{};
-            float rightWet{};
+        /**
+         * @brief Sets how far from the reading head the grains start, from 0
+         * (on the head) to 1 (anywhere in the loop).
+         *
+         * @param channel
+         * @param spread
+         */
+        void SetGrainSpread(int channel, float spread)
+        {
+            SetParameter(Command::SET_GRAIN_SPREAD, channel, spread);
+        }
 
-            float leftFeedback{};
-            float rightFeedback{};
+        /**
+         * @brief Starts reading for the first time. This must be called when
+         * the looper is ready to go.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Start()
+        {
+            return Send({Command::START, BOTH, 0.f});
+        }
 
-            switch (state_)
-            {
-            case State::STARTUP:
-            {
-                static int32_t fadeIndex{0};
-                if (fadeIndex > sampleRate_)
-                {
-                    fadeIndex = 0;
-                    state_ = State::BUFFERING;
-                }
-                fadeIndex++;
+        /**
+         * @brief Stops reading and starts buffering again.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool ResetLooper()
+        {
+            return Send({Command::RESET_LOOPER, BOTH, 0.f});
+        }
 
-                // Return now, so we don't emit any sound.
-                return;
+        /**
+         * @brief Clears the loopers' buffers.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool ClearBuffer()
+        {
+            return Send({Command::CLEAR_BUFFER, BOTH, 0.f});
+        }
+
+        /**
+         * @brief Undoes the last overdub take, a pass of the writing head over
+         * the loop, when the configuration has an undo history. The buffer is
+         * restored over the next blocks.
+         *
+         * @param channel
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Undo(int channel = BOTH)
+        {
+            return Send({Command::UNDO, channel, 0.f});
+        }
+
+        /**
+         * @brief Redoes the last overdub take undone, see Undo().
+         *
+         * @param channel
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Redo(int channel = BOTH)
+        {
+            return Send({Command::REDO, channel, 0.f});
+        }
+
+        /**
+         * @brief Stops buffering before the buffer is full.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool StopBuffering()
+        {
+            return Send({Command::STOP_BUFFERING, BOTH, 0.f});
+        }
+
+        /**
+         * @brief Makes the looper ready with buffers that have been filled
+         * externally, as if the given number of samples had been buffered
+         * (see Persistence). It has effect only while starting up or
+         * buffering.
+         *
+         * @param samples
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Restore(int32_t samples)
+        {
+            return Send({Command::RESTORE, BOTH, static_cast<float>(samples)});
+        }
+
+        /**
+         * @brief Re-triggers the playback while playing.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Retrigger()
+        {
+            return Send({Command::RETRIGGER, BOTH, 0.f});
+        }
+
+        /**
+         * @brief Restarts the playback from a stopped status.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool Restart()
+        {
+            return Send({Command::RESTART, BOTH, 0.f});
+        }
+
+        /**
+         * @brief Starts reading immediately.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool StartReading()
+        {
+            return Send({Command::START_READING, BOTH, 0.f});
+        }
+
+        /**
+         * @brief Stops reading immediately.
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool StopReading()
+        {
+            return Send({Command::STOP_READING, BOTH, 0.f});
+        }
+
+        /**
+         * @brief Starts writing, either with a fade in or immediately
+         * depending on the parameter.
+         *
+         * @param channel
+         * @param now
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool StartWriting(int channel, bool now)
+        {
+            return Send({Command::START_WRITING, channel, static_cast<float>(now)});
+        }
+
+        /**
+         * @brief Stops writing, either with a fade out or immediately
+         * depending on the parameter.
+         *
+         * @param channel
+         * @param now
+         *
+         * @return true
+         * @return false if the command queue is full and the command has been
+         * dropped
+         */
+        bool StopWriting(int channel, bool now)
+        {
+            return Send({Command::STOP_WRITING, channel, static_cast<float>(now)});
+        }
+
+        /**
+         * @brief Processes the input signals and outputs something. This goes
+         * in the main loop of your code.
+         *
+         * @param leftIn
+         * @param rightIn
+         * @param leftOut
+         * @param rightOut
+         */
+        void Process(const float leftIn, const float rightIn, float &leftOut, float &rightOut)
+        {
+            HandleCommands();
+            HandleScheduled();
+            frame_++;
+            UpdateMixGains();
+            if (++telemetrySamples_ >= kTelemetrySamples)
+            {
+                telemetrySamples_ = 0;
+                PublishTelemetry(0, 0);
+            }
+
+            // Input gain stage.
+            WREATH_PROBE_START(INPUT);
+            float leftDry = SoftClip(leftIn * inputGain);
+            float rightDry = SoftClip(rightIn * inputGain);
+            WREATH_PROBE_STOP(INPUT);
+
+            float leftWet{};
+            float rightWet{};
+
+            float leftFeedback{};
+            float rightFeedback{};
+
+            float leftFiltered{};
+            float rightFiltered{};
+
+            switch (state_)
+            {
+            case State::STARTUP:
+            {
+                if (startupIndex_ > startupSamples_)
+                {
+                    startupIndex_ = 0;
+                    state_ = State::BUFFERING;
+                }
+                startupIndex_++;
+                WREATH_PROBE_COMMIT();
+
+                // Return now, so we don't emit any sound.
+                return;
+            }
+            case State::BUFFERING:
+            {
+                Buffer(leftDry, rightDry);
+
+                // Pass the audio through.
+                leftWet = leftDry;
+                rightWet = rightDry;
+
+                break;
+            }
+            case State::READY:
+            {
+                ResetParameters();
+
+                break;
+            }
+            case State::RECORDING:
+            case State::FROZEN:
+            {
+                if (pending_)
+                {
+                    pending_ = UpdateParameters();
+                }
+
+                if (!HandleFlags())
+                {
+                    break;
+                }
+
+                CheckLink(1);
+                loopers_[LEFT].Update(1);
+                loopers_[RIGHT].Update(1);
+
+                if (feedback <= 0.f)
+                {
+                    ProcessLoopers<false, false>(leftDry, rightDry, leftWet, rightWet, leftFeedback, rightFeedback, leftFiltered, rightFiltered);
+                }
+                else if (crossedFeedback)
+                {
+                    ProcessLoopers<true, true>(leftDry, rightDry, leftWet, rightWet, leftFeedback, rightFeedback, leftFiltered, rightFiltered);
+                }
+                else
+                {
+                    ProcessLoopers<true, false>(leftDry, rightDry, leftWet, rightWet, leftFeedback, rightFeedback, leftFiltered, rightFiltered);
+                }
+                WREATH_PROBE_START(FEEDBACK);
+                MixFiltered(leftWet, rightWet, leftFiltered, rightFiltered);
+                WREATH_PROBE_STOP(FEEDBACK);
+            }
+            default:
+                break;
+            }
+
+            ProcessOutput(leftDry, rightDry, leftWet, rightWet, leftFeedback, rightFeedback, leftOut, rightOut);
+            WREATH_PROBE_COMMIT();
+        }
+
+        /**
+         * @brief Processes a block of samples. The state machine, the commands
+         * and the parameters are handled once per block, then the loopers run
+         * in a tight loop. The block is split at the frames of the commands
+         * sent with SendAt(), and the same is done for each part. The output
+         * is the same as calling Process() for each sample, given that the
+         * commands are only sent in between blocks. Differently from
+         * Process(), during startup the output is zeroed.
+         *
+         * @param inL
+         * @param inR
+         * @param outL
+         * @param outR
+         * @param n
+         */
+        void ProcessBlock(const float *inL, const float *inR, float *outL, float *outR, size_t n)
+        {
+            uint32_t start = Profiler::Now();
+            HandleCommands();
+
+            for (size_t i = 0; i < n;)
+            {
+                HandleScheduled();
+                UpdateMixGains();
+
+                // Up to the next scheduled command, which is in the future.
+                size_t end = n;
+                if (scheduledCount_ > 0)
+                {
+                    end = std::min(n, i + static_cast<size_t>(std::min(scheduled_[scheduledCount_ - 1].frame - frame_, static_cast<int64_t>(n))));
+                }
+                ProcessSpan(inL + i, inR + i, outL + i, outR + i, end - i);
+                frame_ += end - i;
+                i = end;
+            }
+
+            PublishTelemetry(Profiler::Now() - start, n);
+        }
+
+    private:
+        /**
+         * @brief Processes a part of a block in which no command is due, see
+         * ProcessBlock().
+         *
+         * @param inL
+         * @param inR
+         * @param outL
+         * @param outR
+         * @param n
+         */
+        void ProcessSpan(const float *inL, const float *inR, float *outL, float *outR, size_t n)
+        {
+            size_t i{0};
+            while (i < n)
+            {
+                switch (state_)
+                {
+                case State::STARTUP:
+                {
+                    // Go through the startup at once, the same way as
+                    // Process() does it sample by sample.
+                    int32_t remaining = std::max(startupSamples_ + 2 - startupIndex_, static_cast<int32_t>(1));
+                    size_t samples = std::min(n - i, static_cast<size_t>(remaining));
+                    std::fill(outL + i, outL + i + samples, 0.f);
+                    std::fill(outR + i, outR + i + samples, 0.f);
+                    i += samples;
+                    if (static_cast<int32_t>(samples) == remaining)
+                    {
+                        startupIndex_ = 1;
+                        state_ = State::BUFFERING;
+                    }
+                    else
+                    {
+                        startupIndex_ += samples;
+                    }
+
+                    break;
+                }
+                case State::BUFFERING:
+                {
+                    // The state changes to READY when buffering is complete,
+                    // this way the remaining samples are processed accordingly.
+                    for (; i < n && State::BUFFERING == state_; i++)
+                    {
+                        float leftDry = SoftClip(inL[i] * inputGain);
+                        float rightDry = SoftClip(inR[i] * inputGain);
+                        Buffer(leftDry, rightDry);
+                        ProcessOutput(leftDry, rightDry, leftDry, rightDry, 0.f, 0.f, outL[i], outR[i]);
+                    }
+
+                    break;
+                }
+                case State::READY:
+                {
+                    ResetParameters();
+                    for (; i < n; i++)
+                    {
+                        float leftDry = SoftClip(inL[i] * inputGain);
+                        float rightDry = SoftClip(inR[i] * inputGain);
+                        ProcessOutput(leftDry, rightDry, 0.f, 0.f, 0.f, 0.f, outL[i], outR[i]);
+                    }
+
+                    break;
+                }
+                case State::RECORDING:
+                case State::FROZEN:
+                {
+                    if (pending_)
+                    {
+                        pending_ = UpdateParameters();
+                    }
+
+                    // On reset the looper goes back to buffering, the current
+                    // sample is emitted dry like in Process().
+                    if (!HandleFlags())
+                    {
+                        float leftDry = SoftClip(inL[i] * inputGain);
+                        float rightDry = SoftClip(inR[i] * inputGain);
+                        ProcessOutput(leftDry, rightDry, 0.f, 0.f, 0.f, 0.f, outL[i], outR[i]);
+                        i++;
+
+                        break;
+                    }
+
+                    CheckLink(n - i);
+                    loopers_[LEFT].Update(n - i);
+                    loopers_[RIGHT].Update(n - i);
+
+                    // The kernels are selected once per block, on settings
+                    // that only change in between blocks.
+                    if (feedback <= 0.f)
+                    {
+                        RunLoopers<false, false>(inL, inR, outL, outR, i, n);
+                    }
+                    else if (crossedFeedback)
+                    {
+                        RunLoopers<true, true>(inL, inR, outL, outR, i, n);
+                    }
+                    else
+                    {
+                        RunLoopers<true, false>(inL, inR, outL, outR, i, n);
+                    }
+
+                    break;
+                }
+                default:
+                    i = n;
+                    break;
+                }
+            }
+        }
+
+        using UndoRecord = UndoHistory<BufferSample>::Record;
+
+        Looper<BufferSample, BufferInterpolation> loopers_[2];
+        State state_{}; // The current state of the looper
+        EnvFollow filterEnvelopes_[2]{}; // One per channel, like the filters
+        Svf feedbackFilters_[2];
+        int32_t sampleRate_{};
+        float freeze_{};
+        float degradation_{};
+        float filterValue_{};
+        float stereoScale_{}; // The mid-side scaling
+        float dryGain_{};     // The crossfade gains of the dry and wet signals, see UpdateMixGains()
+        float wetGain_{};
+        Seqlock<Telemetry> telemetry_;
+        float load_{};               // The load averaged over the blocks
+        int32_t telemetrySamples_{}; // Samples since the last snapshot, with Process()
+        int32_t startupIndex_{};   // Samples elapsed during startup
+        int32_t startupSamples_{}; // Length of the startup
+        bool interleaved_{};       // Whether the channels share an interleaved buffer
+#if defined(WREATH_PROFILING)
+        Profiler profiler_;
+#endif
+        Conf conf_{};
+
+        enum Flag : uint32_t
+        {
+            FLAG_RESET_LOOPER = 1 << 0,
+            FLAG_CLEAR_BUFFER = 1 << 1,
+            FLAG_STOP_BUFFERING = 1 << 2,
+            FLAG_RETRIGGER = 1 << 3,
+            FLAG_RESTART = 1 << 4,
+            FLAG_START_READING = 1 << 5,
+            FLAG_STOP_READING = 1 << 6,
+            // The following flags are per channel, shifted by the channel.
+            FLAG_START_WRITING_NOW = 1 << 8,
+            FLAG_STOP_WRITING_NOW = 1 << 10,
+            FLAG_START_WRITING = 1 << 12,
+            FLAG_STOP_WRITING = 1 << 14,
+        };
+
+        static constexpr size_t kCommandQueueSize{128};
+        static constexpr size_t kMaxScheduled{32}; // Commands waiting for their frame, see SendAt()
+        CommandQueue<Command, kCommandQueueSize> commands_;
+        static constexpr int32_t kParameters{Command::SET_GRAIN_SPREAD - Command::SET_LOOP_SYNC + 1};
+        LatestValues<2 * kParameters> parameters_; // A slot per parameter and channel, see SetParameter()
+        Command scheduled_[kMaxScheduled]; // From the latest to the earliest
+        size_t scheduledCount_{};
+        bool queueHeld_{}; // Whether a command waits in the queue for room to be scheduled
+        int64_t frame_{}; // The frames processed since Init()
+        uint32_t flags_{}; // Actions waiting to be handled
+        bool pending_{};   // Whether some parameters must be updated
+
+        static constexpr int32_t kLinkCheckSamples{32};
+        static constexpr int32_t kTelemetrySamples{48}; // How often Process() publishes the telemetry
+        static constexpr float kLoadSmoothing{0.05f};   // The weight of the last block in the load average
+        bool linked_{};              // Whether the right channel follows the left one's motion
+        bool mustCheckLink_{true};   // Whether the channels may have been set apart
+        int32_t linkCheckSamples_{}; // Samples before trying to link the channels again
+
+#if defined(WREATH_PROFILING)
+        static constexpr size_t kFeedbackSliceSize{1}; // So that each sample is committed to the profiler as a whole
+#else
+        static constexpr size_t kFeedbackSliceSize{32}; // Samples of a block processed a stage at a time, see ProcessBlock()
+#endif
+
+        int32_t nextLeftLoopStart{};
+        int32_t nextRightLoopStart{};
+
+        Direction leftDirection{};
+        Direction rightDirection{};
+
+        int32_t nextLeftLoopLength{};
+        int32_t nextRightLoopLength{};
+
+        float nextLeftReadRate{};
+        float nextRightReadRate{};
+
+        float nextLeftWriteRate{};
+        float nextRightWriteRate{};
+
+        float nextLeftFreeze{};
+        float nextRightFreeze{};
+
+        /**
+         * @brief Resets the loopers to their initial state.
+         */
+        void Reset()
+        {
+            loopers_[LEFT].Reset();
+            loopers_[RIGHT].Reset();
+
+            // SetMode(conf_.mode);
+            ApplyMovement(BOTH, conf_.movement);
+            ApplyDirection(BOTH, conf_.direction);
+            ApplyReadRate(BOTH, conf_.rate);
+            ApplyWriteRate(BOTH, conf_.rate);
+        }
+
+        /**
+         * @brief Raises a flag, for both channels if the flag is per channel
+         * and so is the command.
+         *
+         * @param flag
+         * @param channel
+         */
+        void RaiseFlag(uint32_t flag, int channel)
+        {
+            flags_ |= BOTH == channel ? flag | (flag << 1) : flag << channel;
+        }
+
+        /**
+         * @brief Leaves the latest value of a parameter for the audio
+         * callback, in the slot of the channel or in both.
+         *
+         * @param type
+         * @param channel
+         * @param value
+         */
+        void SetParameter(Command::Type type, int channel, float value)
+        {
+            int32_t slot = 2 * (type - Command::SET_LOOP_SYNC);
+            parameters_.Set((BOTH == channel ? 3u : 1u << channel) << slot, value);
+        }
+
+        /**
+         * @brief Handles the parameters set by the control code since the
+         * last call. The same value set for both channels is handled as a
+         * single command for both, like it was sent.
+         */
+        void HandleParameters()
+        {
+            uint32_t changed = parameters_.TakeChanged();
+            for (int32_t p = 0; changed; p++, changed >>= 2)
+            {
+                if (!(changed & 3u))
+                {
+                    continue;
+                }
+                Command::Type type = static_cast<Command::Type>(Command::SET_LOOP_SYNC + p);
+                float left = parameters_.Get(2 * p + LEFT);
+                float right = parameters_.Get(2 * p + RIGHT);
+                if ((changed & 3u) == 3u && left == right)
+                {
+                    HandleCommand({type, BOTH, left});
+                }
+                else
+                {
+                    if (changed & 1u)
+                    {
+                        HandleCommand({type, LEFT, left});
+                    }
+                    if (changed & 2u)
+                    {
+                        HandleCommand({type, RIGHT, right});
+                    }
+                }
+                mustCheckLink_ = true;
+            }
+        }
+
+        /**
+         * @brief Handles the parameters and the commands sent by the control
+         * code since the last call. This is called once per block, before
+         * anything else.
+         */
+        void HandleCommands()
+        {
+            PopCommands();
+
+            // After the commands, that may reset the parameters (see RESTORE).
+            HandleParameters();
+        }
+
+        /**
+         * @brief Pops the commands from the queue, handling them or keeping
+         * them until their frame. When there's no room to keep one, it's left
+         * in the queue, and so are the ones after it, to be popped again when
+         * a scheduled command has been handled.
+         */
+        void PopCommands()
+        {
+            Command command;
+            while (commands_.Peek(command))
+            {
+                if (command.frame > frame_)
+                {
+                    if (!Schedule(command))
+                    {
+                        queueHeld_ = true;
+
+                        return;
+                    }
+                }
+                else
+                {
+                    HandleCommand(command);
+                    mustCheckLink_ = true;
+                }
+                commands_.Pop(command);
+            }
+            queueHeld_ = false;
+        }
+
+        /**
+         * @brief Keeps a command until its frame, the commands for the same
+         * frame are handled in the order they were sent.
+         *
+         * @param command
+         * @return true
+         * @return false if there's no room left
+         */
+        bool Schedule(const Command &command)
+        {
+            if (scheduledCount_ >= kMaxScheduled)
+            {
+                return false;
+            }
+
+            size_t i = scheduledCount_++;
+            for (; i > 0 && scheduled_[i - 1].frame <= command.frame; i--)
+            {
+                scheduled_[i] = scheduled_[i - 1];
+            }
+            scheduled_[i] = command;
+
+            return true;
+        }
+
+        /**
+         * @brief Handles the scheduled commands that are due, then pops the
+         * commands left in the queue for want of room, if any.
+         */
+        void HandleScheduled()
+        {
+            bool handled{};
+            while (scheduledCount_ > 0 && scheduled_[scheduledCount_ - 1].frame <= frame_)
+            {
+                HandleCommand(scheduled_[--scheduledCount_]);
+                mustCheckLink_ = true;
+                handled = true;
+            }
+            if (handled && queueHeld_)
+            {
+                PopCommands();
+            }
+        }
+
+        /**
+         * @brief Handles a single command. Actions are flagged and performed
+         * when the looper is running, parameters are stored and applied at
+         * the right moment by UpdateParameters().
+         *
+         * @param command
+         */
+        void HandleCommand(const Command &command)
+        {
+            int channel = command.channel;
+            float value = command.value;
+
+            switch (command.type)
+            {
+            case Command::START:
+            {
+                if (State::READY == state_)
+                {
+                    loopers_[LEFT].StartReading(true);
+                    loopers_[RIGHT].StartReading(true);
+                    state_ = freeze_ == 1.f ? State::FROZEN : State::RECORDING;
+                }
+                break;
+            }
+            case Command::RESET_LOOPER:
+                flags_ |= FLAG_RESET_LOOPER;
+                break;
+            case Command::UNDO:
+            case Command::REDO:
+            {
+                for (int c = LEFT; c <= RIGHT; c++)
+                {
+                    if (c == channel || BOTH == channel)
+                    {
+                        Command::UNDO == command.type ? loopers_[c].Undo() : loopers_[c].Redo();
+                    }
+                }
+                break;
+            }
+            case Command::CLEAR_BUFFER:
+                flags_ |= FLAG_CLEAR_BUFFER;
+                break;
+            case Command::STOP_BUFFERING:
+                flags_ |= FLAG_STOP_BUFFERING;
+                break;
+            case Command::RESTORE:
+            {
+                // The buffers have been filled externally, skip the buffering.
+                if (State::STARTUP == state_ || State::BUFFERING == state_)
+                {
+                    loopers_[LEFT].Restore(value);
+                    loopers_[RIGHT].Restore(value);
+                    ResetParameters();
+                    state_ = State::READY;
+                }
+                break;
+            }
+            case Command::RELOAD:
+            {
+                int32_t from = static_cast<int32_t>(value);
+                loopers_[LEFT].Reload(from, from + command.span);
+                loopers_[RIGHT].Reload(from, from + command.span);
+                break;
+            }
+            case Command::RETRIGGER:
+                flags_ |= FLAG_RETRIGGER;
+                break;
+            case Command::RESTART:
+                flags_ |= FLAG_RESTART;
+                break;
+            case Command::START_READING:
+                flags_ |= FLAG_START_READING;
+                break;
+            case Command::STOP_READING:
+                flags_ |= FLAG_STOP_READING;
+                break;
+            case Command::START_WRITING:
+                RaiseFlag(value ? FLAG_START_WRITING_NOW : FLAG_START_WRITING, channel);
+                break;
+            case Command::STOP_WRITING:
+                RaiseFlag(value ? FLAG_STOP_WRITING_NOW : FLAG_STOP_WRITING, channel);
+                break;
+            case Command::SET_LOOP_SYNC:
+            {
+                if (BOTH == channel)
+                {
+                    loopers_[LEFT].SetLoopSync(value);
+                    loopers_[RIGHT].SetLoopSync(value);
+                    loopSync_ = value;
+                }
+                else
+                {
+                    loopers_[channel].SetLoopSync(value);
+                }
+                break;
+            }
+            case Command::SET_FILTER_VALUE:
+            {
+                filterValue_ = value;
+                for (Svf &filter : feedbackFilters_)
+                {
+                    filter.SetFreq(filterValue_);
+                    filter.SetDrive(0.75f);
+                    filter.SetRes(fmap(1.f - feedback, 0.05f, 0.2f + (freeze_ * 0.2f)));
+                }
+                break;
+            }
+            case Command::SET_DEGRADATION:
+            {
+                degradation_ = value;
+                loopers_[LEFT].SetDegradation(value);
+                loopers_[RIGHT].SetDegradation(value);
+                break;
+            }
+            case Command::SET_LOOPING:
+            {
+                loopers_[LEFT].SetLooping(value);
+                loopers_[RIGHT].SetLooping(value);
+                break;
+            }
+            case Command::SET_MOVEMENT:
+                ApplyMovement(channel, static_cast<Movement>(value));
+                break;
+            case Command::SET_DIRECTION:
+                ApplyDirection(channel, static_cast<Direction>(value));
+                break;
+            case Command::SET_LOOP_START:
+            {
+                if (LEFT == channel || BOTH == channel)
+                {
+                    nextLeftLoopStart = std::min(std::max(value, 0.f), loopers_[LEFT].GetBufferSamples() - 1.f);
+                }
+                if (RIGHT == channel || BOTH == channel)
+                {
+                    nextRightLoopStart = std::min(std::max(value, 0.f), loopers_[RIGHT].GetBufferSamples() - 1.f);
+                }
+                pending_ = true;
+                break;
+            }
+            case Command::SET_LOOP_LENGTH:
+            {
+                const Timing &timing = loopers_[LEFT].GetTiming();
+                if (LEFT == channel || BOTH == channel)
+                {
+                    nextLeftLoopLength = std::min(std::max(value, timing.minLoopLength), static_cast<float>(loopers_[LEFT].GetBufferSamples()));
+                    noteModeLeft = NoteMode::NO_MODE;
+                    if (value <= timing.minLoopLength)
+                    {
+                        noteModeLeft = NoteMode::NOTE;
+                    }
+                    else if (value >= timing.minSamplesForTone && value <= timing.minSamplesForFlanger)
+                    {
+                        noteModeLeft = NoteMode::FLANGER;
+                    }
+                }
+                if (RIGHT == channel || BOTH == channel)
+                {
+                    nextRightLoopLength = std::min(std::max(value, timing.minLoopLength), static_cast<float>(loopers_[RIGHT].GetBufferSamples()));
+                    noteModeRight = NoteMode::NO_MODE;
+                    if (value <= timing.minLoopLength)
+                    {
+                        noteModeRight = NoteMode::NOTE;
+                    }
+                    else if (value >= timing.minSamplesForTone && value <= timing.minSamplesForFlanger)
+                    {
+                        noteModeRight = NoteMode::FLANGER;
+                    }
+                }
+                pending_ = true;
+                break;
+            }
+            case Command::SET_FREEZE:
+            {
+                if (LEFT == channel || BOTH == channel)
+                {
+                    nextLeftFreeze = value;
+                }
+                if (RIGHT == channel || BOTH == channel)
+                {
+                    nextRightFreeze = value;
+                }
+                freeze_ = value;
+                if (State::READY != state_)
+                {
+                    state_ = value == 1.f ? State::FROZEN : State::RECORDING;
+                }
+                pending_ = true;
+                break;
+            }
+            case Command::SET_READ_RATE:
+                ApplyReadRate(channel, value);
+                break;
+            case Command::SET_WRITE_RATE:
+                ApplyWriteRate(channel, value);
+                break;
+            case Command::SET_GRAIN_DENSITY:
+            case Command::SET_GRAIN_SIZE:
+            case Command::SET_GRAIN_SPREAD:
+            {
+                for (int c = LEFT; c <= RIGHT; c++)
+                {
+                    if (c == channel || BOTH == channel)
+                    {
+                        ApplyGrains(loopers_[c], command.type, value);
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        /**
+         * @brief Sets a parameter of a looper's grains.
+         *
+         * @param looper
+         * @param type
+         * @param value
+         */
+        static void ApplyGrains(Looper<BufferSample, BufferInterpolation> &looper, Command::Type type, float value)
+        {
+            switch (type)
+            {
+            case Command::SET_GRAIN_DENSITY:
+                looper.SetGrainDensity(value);
+                break;
+            case Command::SET_GRAIN_SIZE:
+                looper.SetGrainSize(value);
+                break;
+            default:
+                looper.SetGrainSpread(value);
+                break;
+            }
+        }
+
+        /**
+         * @brief Sets the reading heads movement.
+         *
+         * @param channel
+         * @param movement
+         */
+        void ApplyMovement(int channel, Movement movement)
+        {
+            if (BOTH == channel)
+            {
+                loopers_[LEFT].SetMovement(movement);
+                loopers_[RIGHT].SetMovement(movement);
+                conf_.movement = movement;
+            }
+            else
+            {
+                loopers_[channel].SetMovement(movement);
+            }
+        }
+
+        /**
+         * @brief Sets the next direction of the reading heads.
+         *
+         * @param channel
+         * @param direction
+         */
+        void ApplyDirection(int channel, Direction direction)
+        {
+            if (LEFT == channel || BOTH == channel)
+            {
+                leftDirection = direction;
             }
-            case State::BUFFERING:
+            if (RIGHT == channel || BOTH == channel)
             {
-                bool doneLeft{loopers_[LEFT].Buffer(leftDry)};
-                bool doneRight{loopers_[RIGHT].Buffer(rightDry)};
-                if ((doneLeft && doneRight) || mustStopBuffering)
-                {
-                    mustStopBuffering = false;
-                    loopers_[LEFT].StopBuffering();
-                    loopers_[RIGHT].StopBuffering();
+                rightDirection = direction;
+            }
+            if (BOTH == channel)
+            {
+                conf_.direction = direction;
+            }
+            // Before the looper starts, if the direction is backwards set the
+            // reading head at the end of the loop.
+            if (State::READY == state_ && Direction::BACKWARDS == direction)
+            {
+                loopers_[LEFT].SetReadPos(loopers_[LEFT].GetLoopEnd());
+                loopers_[RIGHT].SetReadPos(loopers_[RIGHT].GetLoopEnd());
+            }
+            pending_ = true;
+        }
 
-                    state_ = State::READY;
-                }
+        /**
+         * @brief Sets the next speed of the reading heads.
+         *
+         * @param channel
+         * @param rate
+         */
+        void ApplyReadRate(int channel, float rate)
+        {
+            if (LEFT == channel || BOTH == channel)
+            {
+                nextLeftReadRate = rate;
+            }
+            if (RIGHT == channel || BOTH == channel)
+            {
+                nextRightReadRate = rate;
+            }
+            conf_.rate = rate;
+            pending_ = true;
+        }
 
-                // Pass the audio through.
-                leftWet = leftDry;
-                rightWet = rightDry;
+        /**
+         * @brief Sets the next speed of the writing heads.
+         *
+         * @param channel
+         * @param rate
+         */
+        void ApplyWriteRate(int channel, float rate)
+        {
+            if (LEFT == channel || BOTH == channel)
+            {
+                nextLeftWriteRate = rate;
+            }
+            if (RIGHT == channel || BOTH == channel)
+            {
+                nextRightWriteRate = rate;
+            }
+            pending_ = true;
+        }
 
-                break;
+        /**
+         * @brief Buffers the provided samples and completes the buffering
+         * procedure when the buffer is full or when requested.
+         *
+         * @param leftDry
+         * @param rightDry
+         */
+        void Buffer(float leftDry, float rightDry)
+        {
+            bool doneLeft{loopers_[LEFT].Buffer(leftDry)};
+            bool doneRight{loopers_[RIGHT].Buffer(rightDry)};
+            if ((doneLeft && doneRight) || (flags_ & FLAG_STOP_BUFFERING))
+            {
+                flags_ &= ~FLAG_STOP_BUFFERING;
+                loopers_[LEFT].StopBuffering();
+                loopers_[RIGHT].StopBuffering();
+
+                state_ = State::READY;
             }
-            case State::READY:
+        }
+
+        /**
+         * @brief Aligns the next parameters with the current ones while the
+         * looper is waiting to be started.
+         */
+        void ResetParameters()
+        {
+            nextLeftLoopLength = loopers_[LEFT].GetLoopLength();
+            nextRightLoopLength = loopers_[RIGHT].GetLoopLength();
+            nextLeftLoopStart = loopers_[LEFT].GetLoopStart();
+            nextRightLoopStart = loopers_[RIGHT].GetLoopStart();
+            nextLeftReadRate = 1.f;
+            nextRightReadRate = 1.f;
+            nextLeftWriteRate = 1.f;
+            nextRightWriteRate = 1.f;
+            nextLeftFreeze = 0.f;
+            nextRightFreeze = 0.f;
+            pending_ = true;
+        }
+
+        /**
+         * @brief Handles the actions flagged by the commands.
+         *
+         * @return true
+         * @return false if the looper has been reset and is buffering again
+         */
+        bool HandleFlags()
+        {
+            if (!flags_)
             {
-                nextLeftLoopLength = loopers_[LEFT].GetLoopLength();
-                nextRightLoopLength = loopers_[RIGHT].GetLoopLength();
-                nextLeftLoopStart = loopers_[LEFT].GetLoopStart();
-                nextRightLoopStart = loopers_[RIGHT].GetLoopStart();
-                nextLeftReadRate = 1.f;
-                nextRightReadRate = 1.f;
-                nextLeftWriteRate = 1.f;
-                nextRightWriteRate = 1.f;
-                nextLeftFreeze = 0.f;
-                nextRightFreeze = 0.f;
+                return true;
+            }
+            mustCheckLink_ = true;
 
-                break;
+            if (flags_ & FLAG_CLEAR_BUFFER)
+            {
+                flags_ &= ~FLAG_CLEAR_BUFFER;
+                loopers_[LEFT].ClearBuffer();
+                loopers_[RIGHT].ClearBuffer();
             }
-            case State::RECORDING:
-            case State::FROZEN:
+
+            if (flags_ & FLAG_RESET_LOOPER)
             {
-                UpdateParameters();
+                flags_ &= ~FLAG_RESET_LOOPER;
+                loopers_[LEFT].StopReading(true);
+                loopers_[RIGHT].StopReading(true);
+                Reset();
+                state_ = State::BUFFERING;
 
-                if (mustClearBuffer)
-                {
-                    mustClearBuffer = false;
-                    loopers_[LEFT].ClearBuffer();
-                    loopers_[RIGHT].ClearBuffer();
-                }
+                return false;
+            }
 
-                if (mustResetLooper)
-                {
-                    mustResetLooper = false;
-                    loopers_[LEFT].StopReading(true);
-                    loopers_[RIGHT].StopReading(true);
-                    Reset();
-                    state_ = State::BUFFERING;
+            if (flags_ & FLAG_RETRIGGER)
+            {
+                loopers_[LEFT].Trigger(false);
+                loopers_[RIGHT].Trigger(false);
+            }
 
-                    break;
-                }
+            if (flags_ & FLAG_RESTART)
+            {
+                loopers_[LEFT].Trigger(true);
+                loopers_[RIGHT].Trigger(true);
+            }
 
-                if (mustRetrigger)
-                {
-                    loopers_[LEFT].Trigger(false);
-                    loopers_[RIGHT].Trigger(false);
-                    mustRetrigger = false;
-                }
+            if (flags_ & FLAG_START_READING)
+            {
+                loopers_[LEFT].StartReading(true);
+                loopers_[RIGHT].StartReading(true);
+            }
 
-                if (mustRestart)
-                {
-                    loopers_[LEFT].Trigger(true);
-                    loopers_[RIGHT].Trigger(true);
-                    mustRestart = false;
-                }
+            if (flags_ & FLAG_STOP_READING)
+            {
+                loopers_[LEFT].StopReading(true);
+                loopers_[RIGHT].StopReading(true);
+            }
 
-                if (mustStartReading)
+            for (int channel = LEFT; channel <= RIGHT; channel++)
+            {
+                if (flags_ & (FLAG_START_WRITING_NOW << channel))
                 {
-                    loopers_[LEFT].StartReading(true);
-                    loopers_[RIGHT].StartReading(true);
-                    mustStartReading = false;
+                    loopers_[channel].StartWriting(true);
                 }
+            }
 
-                if (mustStopReading)
+            for (int channel = LEFT; channel <= RIGHT; channel++)
+            {
+                if (flags_ & (FLAG_STOP_WRITING_NOW << channel))
                 {
-                    loopers_[LEFT].StopReading(true);
-                    loopers_[RIGHT].StopReading(true);
-                    mustStopReading = false;
+                    loopers_[channel].StopWriting(true);
                 }
+            }
 
-                if (mustStartWriting)
+            for (int channel = LEFT; channel <= RIGHT; channel++)
+            {
+                if (flags_ & (FLAG_START_WRITING << channel))
                 {
-                    loopers_[LEFT].StartWriting(true);
-                    loopers_[RIGHT].StartWriting(true);
-                    mustStartWriting = false;
+                    loopers_[channel].StartWriting(false);
                 }
-
-                if (mustStopWriting)
+                if (flags_ & (FLAG_STOP_WRITING << channel))
                 {
-                    loopers_[LEFT].StopWriting(true);
-                    loopers_[RIGHT].StopWriting(true);
-                    mustStopWriting = false;
+                    loopers_[channel].StopWriting(false);
                 }
+            }
 
-                if (mustStartWritingLeft)
-                {
-                    loopers_[LEFT].StartWriting(false);
-                    mustStartWritingLeft = false;
-                }
+            // Buffering is handled in its own state.
+            flags_ &= FLAG_STOP_BUFFERING;
 
-                if (mustStopWritingLeft)
-                {
-                    loopers_[LEFT].StopWriting(false);
-                    mustStopWritingLeft = false;
-                }
+            return true;
+        }
 
-                if (mustStartWritingRight)
-                {
-                    loopers_[RIGHT].StartWriting(false);
-                    mustStartWritingRight = false;
-                }
+        /**
+         * @brief Decides whether the right channel can follow the motion of
+         * the left one, which is the case when both have the same parameters
+         * and are in the same state (usually in mono mode). It's checked
+         * again as soon as something may have set them apart, otherwise only
+         * every now and then while they are not linked (for instance, to link
+         * them back when a fade is over).
+         *
+         * @param samples The samples elapsed since the last call
+         */
+        void CheckLink(int32_t samples)
+        {
+            linkCheckSamples_ -= samples;
+            if (mustCheckLink_ || (!linked_ && linkCheckSamples_ <= 0))
+            {
+                linked_ = loopers_[LEFT].IsLinkableWith(loopers_[RIGHT]);
+                mustCheckLink_ = false;
+                linkCheckSamples_ = kLinkCheckSamples;
+            }
+        }
 
-                if (mustStopWritingRight)
+        /**
+         * @brief Runs the loopers for the rest of the block, from the given
+         * sample on. The loopers run sample by sample, as the feedback
+         * written depends on what has just been read, what follows the
+         * writing is done in slices, a stage at a time.
+         *
+         * @tparam kFeedback Whether there is feedback
+         * @tparam kCrossed Whether the feedback is crossed
+         * @param inL
+         * @param inR
+         * @param outL
+         * @param outR
+         * @param i
+         * @param n
+         */
+        template <bool kFeedback, bool kCrossed>
+        void RunLoopers(const float *inL, const float *inR, float *outL, float *outR, size_t &i, size_t n)
+        {
+            OutputKernel output = SelectOutputKernel();
+            while (i < n)
+            {
+                size_t slice = std::min(n - i, kFeedbackSliceSize);
+                float leftDry[kFeedbackSliceSize];
+                float rightDry[kFeedbackSliceSize];
+                float leftWet[kFeedbackSliceSize];
+                float rightWet[kFeedbackSliceSize];
+                float leftFeedback[kFeedbackSliceSize]{};
+                float rightFeedback[kFeedbackSliceSize]{};
+                float leftFiltered[kFeedbackSliceSize]{};
+                float rightFiltered[kFeedbackSliceSize]{};
+                for (size_t j = 0; j < slice; j++, i++)
                 {
-                    loopers_[RIGHT].StopWriting(false);
-                    mustStopWritingRight = false;
+                    WREATH_PROBE_START(INPUT);
+                    leftDry[j] = SoftClip(inL[i] * inputGain);
+                    rightDry[j] = SoftClip(inR[i] * inputGain);
+                    WREATH_PROBE_STOP(INPUT);
+                    ProcessLoopers<kFeedback, kCrossed>(leftDry[j], rightDry[j], leftWet[j], rightWet[j], leftFeedback[j], rightFeedback[j], leftFiltered[j], rightFiltered[j]);
+
+                    // Keep updating the parameters for the next sample only
+                    // while they are changing (slewing rates or a deferred
+                    // loop change).
+                    if (pending_ && i + 1 < n)
+                    {
+                        pending_ = UpdateParameters();
+                        CheckLink(0);
+                    }
                 }
 
-                leftWet = loopers_[LEFT].Read();
-                rightWet = loopers_[RIGHT].Read();
+                WREATH_PROBE_START(FEEDBACK);
+                MixFiltered(leftWet, rightWet, leftFiltered, rightFiltered, slice);
+                WREATH_PROBE_STOP(FEEDBACK);
+                WREATH_PROBE_START(OUTPUT);
+                (this->*output)(leftDry, rightDry, leftWet, rightWet, leftFeedback, rightFeedback, outL + i - slice, outR + i - slice, slice);
+                WREATH_PROBE_STOP(OUTPUT);
+                WREATH_PROBE_COMMIT();
+            }
+        }
+
+        /**
+         * @brief Reads from and writes to the loopers, handling the feedback
+         * path. The feedback and the filtered outputs are left untouched when
+         * there's no feedback.
+         *
+         * @tparam kFeedback Whether there is feedback
+         * @tparam kCrossed Whether the feedback is crossed
+         * @param leftDry
+         * @param rightDry
+         * @param leftWet
+         * @param rightWet
+         * @param leftFeedback
+         * @param rightFeedback
+         * @param leftFiltered The filtered feedback, for MixFiltered()
+         * @param rightFiltered
+         */
+        template <bool kFeedback, bool kCrossed>
+        inline void ProcessLoopers(float leftDry, float rightDry, float &leftWet, float &rightWet, float &leftFeedback, float &rightFeedback, float &leftFiltered, float &rightFiltered)
+        {
+            WREATH_PROBE_START(READ);
+            leftWet = loopers_[LEFT].Read();
+            rightWet = loopers_[RIGHT].Read();
+            WREATH_PROBE_STOP(READ);
 
-                if (feedback > 0.f)
+            if (kFeedback)
+            {
+                WREATH_PROBE_START(FEEDBACK);
+                if (kCrossed)
                 {
-                    if (crossedFeedback)
-                    {
-                        leftFeedback = loopers_[LEFT].Degrade(Mix(leftWet * (1.f - leftFeedbackPath), rightWet * (1.f - rightFeedbackPath)) * feedback);
-                        rightFeedback = loopers_[RIGHT].Degrade(Mix(leftWet * leftFeedbackPath, rightWet * rightFeedbackPath) * feedback);
-                    }
-                    else
-                    {
-                        leftFeedback = loopers_[LEFT].Degrade(leftWet * feedback);
-                        rightFeedback = loopers_[RIGHT].Degrade(rightWet * feedback);
-                    }
-                    float leftFiltered = filterLevel * Filter(leftFeedback) * feedback;
-                    float rightFiltered = filterLevel * Filter(rightFeedback) * feedback;
-                    leftFiltered *= (feedbackLevel - filterEnvelope_.GetEnv(leftFiltered));
-                    rightFiltered *= (feedbackLevel - filterEnvelope_.GetEnv(rightFiltered));
-                    leftFeedback = Mix(leftFeedback, leftFiltered);
-                    rightFeedback = Mix(rightFeedback, rightFiltered);
+                    leftFeedback = loopers_[LEFT].Degrade(Mix(leftWet * (1.f - leftFeedbackPath), rightWet * (1.f - rightFeedbackPath)) * feedback);
+                    rightFeedback = loopers_[RIGHT].Degrade(Mix(leftWet * leftFeedbackPath, rightWet * rightFeedbackPath) * feedback);
+                }
+                else
+                {
+                    leftFeedback = loopers_[LEFT].Degrade(leftWet * feedback);
+                    rightFeedback = loopers_[RIGHT].Degrade(rightWet * feedback);
                 }
+                // Each channel is filtered once, the result is also what is
+                // mixed with the wet when frozen.
+                leftFiltered = Filter(LEFT, leftFeedback);
+                rightFiltered = Filter(RIGHT, rightFeedback);
+                float leftLevel = filterLevel * leftFiltered * feedback;
+                float rightLevel = filterLevel * rightFiltered * feedback;
+                leftLevel *= (feedbackLevel - filterEnvelopes_[LEFT].GetEnv(leftLevel));
+                rightLevel *= (feedbackLevel - filterEnvelopes_[RIGHT].GetEnv(rightLevel));
+                leftFeedback = Mix(leftFeedback, leftLevel);
+                rightFeedback = Mix(rightFeedback, rightLevel);
+                WREATH_PROBE_STOP(FEEDBACK);
+            }
 
-                loopers_[LEFT].UpdateReadPos();
+            WREATH_PROBE_START(POSITION);
+            loopers_[LEFT].UpdateReadPos();
+            if (linked_)
+            {
+                loopers_[RIGHT].FollowReadPos(loopers_[LEFT]);
+            }
+            else
+            {
                 loopers_[RIGHT].UpdateReadPos();
+            }
+            WREATH_PROBE_STOP(POSITION);
 
+            WREATH_PROBE_START(WRITE);
+            if (kFeedback)
+            {
                 loopers_[LEFT].Write(Mix(leftDry * dryLevel, leftFeedback));
                 loopers_[RIGHT].Write(Mix(rightDry * dryLevel, rightFeedback));
+            }
+            else
+            {
+                loopers_[LEFT].Write(SoftClip(leftDry * dryLevel));
+                loopers_[RIGHT].Write(SoftClip(rightDry * dryLevel));
+            }
+            WREATH_PROBE_STOP(WRITE);
 
-                loopers_[LEFT].UpdateWritePos();
+            WREATH_PROBE_START(POSITION);
+            loopers_[LEFT].UpdateWritePos();
+            if (linked_)
+            {
+                loopers_[RIGHT].FollowWritePos(loopers_[LEFT]);
+            }
+            else
+            {
                 loopers_[RIGHT].UpdateWritePos();
+            }
+            WREATH_PROBE_STOP(POSITION);
+        }
+
+        /**
+         * @brief Mixes some of the filtered fed back signal with the wet, as
+         * much as the loopers are frozen.
+         *
+         * @param leftWet
+         * @param rightWet
+         * @param leftFiltered
+         * @param rightFiltered
+         */
+        inline void MixFiltered(float &leftWet, float &rightWet, float leftFiltered, float rightFiltered)
+        {
+            MixFiltered(&leftWet, &rightWet, &leftFiltered, &rightFiltered, 1);
+        }
+
+        /**
+         * @brief Block variant of MixFiltered(), the filtered signals having
+         * been collected by ProcessLoopers() sample by sample. With no
+         * dependencies between the samples the loops can be vectorized.
+         *
+         * @param leftWet
+         * @param rightWet
+         * @param leftFiltered
+         * @param rightFiltered
+         * @param n
+         */
+        inline void MixFiltered(float *leftWet, float *rightWet, const float *leftFiltered, const float *rightFiltered, size_t n)
+        {
+            if (freeze_ <= 0.f)
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    leftWet[i] = SoftClip(leftWet[i]);
+                    rightWet[i] = SoftClip(rightWet[i]);
+                }
+
+                return;
+            }
 
-                // Mix some of the filtered fed back signal with the wet when frozen.
-                leftWet = Mix(leftWet, filterLevel * Filter(leftFeedback) * freeze_);
-                rightWet = Mix(rightWet, filterLevel * Filter(rightFeedback) * freeze_);
+            float level = filterLevel * freeze_;
+            for (size_t i = 0; i < n; i++)
+            {
+                leftWet[i] = Mix(leftWet[i], level * leftFiltered[i]);
+                rightWet[i] = Mix(rightWet[i], level * rightFiltered[i]);
             }
-            default:
-                break;
+        }
+
+        /**
+         * @brief Computes the gains of the dry and wet signals, the same for
+         * the whole block.
+         */
+        inline void UpdateMixGains()
+        {
+            dryGain_ = EqualCrossFadeGain(1.f - dryWetMix);
+            wetGain_ = EqualCrossFadeGain(dryWetMix);
+        }
+
+        /**
+         * @brief Returns the pages of an undo history of the given length.
+         *
+         * @param undoSamples
+         * @param bufferSamples
+         * @return int32_t
+         */
+        static int32_t UndoPages(int32_t undoSamples, size_t bufferSamples)
+        {
+            return UndoHistory<BufferSample>::CountPages(undoSamples, static_cast<int32_t>(std::min(bufferSamples, static_cast<size_t>(INT32_MAX))));
+        }
+
+        /**
+         * @brief Updates the load estimate and publishes the telemetry.
+         *
+         * @param cycles The cycles spent processing the block
+         * @param n The samples in the block, 0 to leave the load as it is
+         */
+        void PublishTelemetry(uint32_t cycles, size_t n)
+        {
+            if (n > 0)
+            {
+                float load = Profiler::Load(cycles, n, sampleRate_);
+                load_ += kLoadSmoothing * (load - load_);
             }
 
-            // Mid-side processing for stereo widening.
-            float mid = (leftWet + rightWet) / fastroot(2, 10);
-            float side = ((leftWet - rightWet) / fastroot(2, 10)) * stereoWidth;
-            float stereoLeft = (mid + side) / fastroot(2, 10);
-            float stereoRight = (mid - side) / fastroot(2, 10);
+            Telemetry telemetry;
+            for (int channel = LEFT; channel <= RIGHT; channel++)
+            {
+                Looper<BufferSample, BufferInterpolation> &looper = loopers_[channel];
+                Telemetry::Channel &c = telemetry.channels[channel];
+                c.readPos = looper.GetReadPos();
+                c.writePos = looper.GetWritePos();
+                c.loopStart = looper.GetLoopStart();
+                c.loopEnd = looper.GetLoopEnd();
+                c.loopLength = looper.GetLoopLength();
+                c.crossPoint = looper.GetCrossPoint();
+                c.headsDistance = looper.GetHeadsDistance();
+                c.readRate = looper.GetReadRate();
+                c.writeRate = looper.GetWriteRate();
+                c.freeze = looper.GetFreeze();
+                c.direction = looper.GetDirection();
+                c.movement = looper.GetMovement();
+                c.fades = looper.GetFades();
+                c.reading = looper.IsReading();
+                c.writing = looper.IsWriting();
+                c.undoable = looper.CanUndo();
+                c.redoable = looper.CanRedo();
+                c.grains = looper.GetActiveGrains();
+            }
+            telemetry.state = state_;
+            telemetry.mode = conf_.mode;
+            telemetry.load = load_;
+            telemetry.count = telemetry_.GetCount() + 1;
+            telemetry.frame = frame_;
+            telemetry_.Write(telemetry);
+        }
 
-            // Output gain stage.
-            leftOut = SoftClip(Fader::EqualCrossFade(leftDry, stereoLeft, dryWetMix) * outputGain);
-            rightOut = SoftClip(Fader::EqualCrossFade(rightDry, stereoRight, dryWetMix) * outputGain);
+        using OutputKernel = void (StereoLooper::*)(const float *, const float *, const float *, const float *, const float *, const float *, float *, float *, size_t);
 
+        /**
+         * @brief Selects the output stage kernel for the current settings.
+         *
+         * @return OutputKernel
+         */
+        OutputKernel SelectOutputKernel()
+        {
             if (feedbackOnly)
             {
-                leftOut = SoftClip(leftFeedback);
-                rightOut = SoftClip(rightFeedback);
+                return &StereoLooper::ProcessFeedbackOutput;
+            }
+            bool widened = 1.f != stereoWidth;
+            bool dry = dryWetMix < 1.f;
+            if (widened)
+            {
+                return dry ? &StereoLooper::ProcessOutput<true, true> : &StereoLooper::ProcessOutput<true, false>;
             }
+
+            return dry ? &StereoLooper::ProcessOutput<false, true> : &StereoLooper::ProcessOutput<false, false>;
         }
 
-    private:
-        Looper loopers_[2];
-        State state_{}; // The current state of the looper
-        EnvFollow filterEnvelope_{};
-        Svf feedbackFilter_;
-        int32_t sampleRate_{};
-        float freeze_{};
-        float degradation_{};
-        float filterValue_{};
-        Conf conf_{};
+        /**
+         * @brief Mixes the wet and dry signals of a block into the output.
+         *
+         * @tparam kWidened Whether the stereo width is other than 1
+         * @tparam kDry Whether there is some dry signal, that is the mix is
+         * not fully wet
+         */
+        template <bool kWidened, bool kDry>
+        void ProcessOutput(const float *leftDry, const float *rightDry, const float *leftWet, const float *rightWet, const float *, const float *, float *leftOut, float *rightOut, size_t n)
+        {
+            float scale = stereoScale_;
+            float width = stereoWidth;
+            float dryGain = dryGain_;
+            float wetGain = wetGain_;
+            float gain = outputGain;
+            for (size_t i = 0; i < n; i++)
+            {
+                // Mid-side processing for stereo widening.
+                float mid = (leftWet[i] + rightWet[i]) / scale;
+                float side = (leftWet[i] - rightWet[i]) / scale;
+                if (kWidened)
+                {
+                    side *= width;
+                }
+                float stereoLeft = (mid + side) / scale;
+                float stereoRight = (mid - side) / scale;
+
+                // Output gain stage.
+                if (kDry)
+                {
+                    leftOut[i] = SoftClip((leftDry[i] * dryGain + stereoLeft * wetGain) * gain);
+                    rightOut[i] = SoftClip((rightDry[i] * dryGain + stereoRight * wetGain) * gain);
+                }
+                else
+                {
+                    leftOut[i] = SoftClip(stereoLeft * gain);
+                    rightOut[i] = SoftClip(stereoRight * gain);
+                }
+            }
+        }
 
         /**
-         * @brief Resets the loopers to their initial state.
+         * @brief Outputs the fed back signal of a block alone.
          */
-        void Reset()
+        void ProcessFeedbackOutput(const float *, const float *, const float *, const float *, const float *leftFeedback, const float *rightFeedback, float *leftOut, float *rightOut, size_t n)
         {
-            loopers_[LEFT].Reset();
-            loopers_[RIGHT].Reset();
+            for (size_t i = 0; i < n; i++)
+            {
+                leftOut[i] = SoftClip(leftFeedback[i]);
+                rightOut[i] = SoftClip(rightFeedback[i]);
+            }
+        }
 
-            // SetMode(conf_.mode);
-            SetMovement(BOTH, conf_.movement);
-            SetDirection(BOTH, conf_.direction);
-            SetReadRate(BOTH, conf_.rate);
-            SetWriteRate(BOTH, conf_.rate);
+        /**
+         * @brief Mixes the wet and dry signals into the output, one sample at
+         * a time with the same kernels as ProcessBlock().
+         *
+         * @param leftDry
+         * @param rightDry
+         * @param leftWet
+         * @param rightWet
+         * @param leftFeedback
+         * @param rightFeedback
+         * @param leftOut
+         * @param rightOut
+         */
+        void ProcessOutput(float leftDry, float rightDry, float leftWet, float rightWet, float leftFeedback, float rightFeedback, float &leftOut, float &rightOut)
+        {
+            WREATH_PROBE_START(OUTPUT);
+            (this->*SelectOutputKernel())(&leftDry, &rightDry, &leftWet, &rightWet, &leftFeedback, &rightFeedback, &leftOut, &rightOut, 1);
+            WREATH_PROBE_STOP(OUTPUT);
         }
 
         /**
@@ -680,24 +2187,27 @@ namespace wreath
         }
 
         /**
-         * @brief Filters the provided signal and returns the result.
+         * @brief Filters the provided signal with the filter of the given
+         * channel and returns the result.
          *
+         * @param channel
          * @param value
          * @return float
          */
-        float Filter(float value)
+        float Filter(int channel, float value)
         {
-            feedbackFilter_.Process(value);
+            Svf &filter = feedbackFilters_[channel];
+            filter.Process(value);
             switch (filterType)
             {
             case FilterType::BP:
-                return feedbackFilter_.Band();
+                return filter.Band();
             case FilterType::HP:
-                return feedbackFilter_.High();
+                return filter.High();
             case FilterType::LP:
-                return feedbackFilter_.Low();
+                return filter.Low();
             default:
-                return feedbackFilter_.Band();
+                return filter.Band();
             }
         }
 
@@ -705,9 +2215,14 @@ namespace wreath
          * @brief Updates the loopers' parameters. This is called at the
          * beginning of the Process() method to ensure that the parameters are
          * changed at the right moment.
+         *
+         * @return true if some parameters have yet to reach their next value
+         * @return false
          */
-        void UpdateParameters()
+        bool UpdateParameters()
         {
+            mustCheckLink_ = true;
+
             if (leftDirection != loopers_[LEFT].GetDirection())
             {
                 loopers_[LEFT].SetDirection(leftDirection);
@@ -780,6 +2295,13 @@ namespace wreath
             {
                 loopers_[RIGHT].SetFreeze(nextRightFreeze);
             }
+
+            // Rates may be slewing, while the loop start and length are not
+            // changed during a loop fade.
+            return loopers_[LEFT].GetReadRate() != nextLeftReadRate || loopers_[RIGHT].GetReadRate() != nextRightReadRate ||
+                   loopers_[LEFT].GetWriteRate() != nextLeftWriteRate || loopers_[RIGHT].GetWriteRate() != nextRightWriteRate ||
+                   loopers_[LEFT].GetLoopLength() != nextLeftLoopLength || loopers_[RIGHT].GetLoopLength() != nextRightLoopLength ||
+                   loopers_[LEFT].GetLoopStart() != nextLeftLoopStart || loopers_[RIGHT].GetLoopStart() != nextRightLoopStart;
         }
     };
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+namespace wreath
+{
+    /**
+     * @brief A sequence lock holding a snapshot of a trivially copyable type,
+     * used to publish the state of the audio callback to the main loop. The
+     * writer never waits: it marks the sequence as odd, copies the snapshot
+     * and marks it as even again. The reader copies the snapshot and takes it
+     * only if the sequence was even and didn't change in the meantime, so it
+     * always gets a consistent copy. Only one thread may write.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T>
+    class Seqlock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "The snapshot must be trivially copyable");
+
+    public:
+        Seqlock() {}
+        ~Seqlock() {}
+
+        /**
+         * @brief Publishes a snapshot. Call this from the writer side only.
+         *
+         * @param value
+         */
+        void Write(const T &value)
+        {
+            uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+            sequence_.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            value_ = value;
+            sequence_.store(sequence + 2, std::memory_order_release);
+        }
+
+        /**
+         * @brief Copies the last snapshot, if no write is in progress.
+         *
+         * @param value
+         * @return true
+         * @return false if the writer was publishing, try again
+         */
+        bool TryRead(T &value) const
+        {
+            uint32_t before = sequence_.load(std::memory_order_acquire);
+            value = value_;
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            return !(before & 1) && before == sequence_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Returns the last snapshot. When the writer is an interrupt
+         * it completes while the reader is suspended, so this retries at most
+         * once per publication.
+         *
+         * @return T
+         */
+        T Read() const
+        {
+            T value;
+            while (!TryRead(value))
+            {
+            }
+
+            return value;
+        }
+
+        /**
+         * @brief Returns how many snapshots have been published.
+         *
+         * @return uint32_t
+         */
+        uint32_t GetCount() const { return sequence_.load(std::memory_order_acquire) / 2; }
+
+    private:
+        T value_{};
+        std::atomic<uint32_t> sequence_{0}; // Odd while a write is in progress
+    };
+} // namespace wreath
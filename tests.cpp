@@ -1,10 +1,22 @@
+#include "command_queue.h"
+#include "grain_cloud.h"
 #include "head.h"
+#include "hot_loop.h"
 #include "looper.h"
+#include "multi_looper.h"
+#include "peak_index.h"
+#include "persistence.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "undo_history.h"
+#include <algorithm>
 #include <ctime>
 #include <cstdlib>
 #include <iostream>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 
 using namespace wreath;
 
@@ -14,7 +26,7 @@ constexpr int32_t bufferSamples = 48000;
 
 float buffer[48000];
 float buffer2[48000];
-Looper looper;
+Looper<float> looper;
 
 bool Compare (float a, float b)
 {
@@ -258,7 +270,7 @@ void TestCrossPoint()
 
     float loopStart = std::rand() / (RAND_MAX / static_cast<float>(bufferSamples - 1));
     //loopStart = 18374.f;
-    float loopLength = kMinLoopLengthSamples + std::rand() / (RAND_MAX / ((bufferSamples - 1) - kMinLoopLengthSamples));
+    float loopLength = looper.GetTiming().minLoopLength + std::rand() / (RAND_MAX / ((bufferSamples - 1) - looper.GetTiming().minLoopLength));
     //loopLength = 33929.6f;
 
     looper.SetLoopLength(loopLength);
@@ -443,6 +455,800 @@ void TestHeadsDistance()
     }
 }
 
+void TestPhasePrecision()
+{
+    // A long buffer with a ramp, so that the value read tells the position.
+    constexpr int32_t samples = 4000000;
+    constexpr int32_t period = 1024;
+    constexpr int32_t updates = 100000;
+    constexpr float rate = 1.f / 3;
+    static float ramp[samples];
+    for (int32_t i = 0; i < samples; i++)
+    {
+        ramp[i] = i % period;
+    }
+
+    FreezeBuffer<float> freezeBuffer;
+    BufferEraser<float> eraser;
+    eraser.Init(ramp, samples);
+    Head<float> head{Type::READ};
+    head.Init(ramp, &freezeBuffer, &eraser, samples, Timing::ToSamples(kFadeSeconds, 48000));
+    head.InitBuffer(samples);
+    head.SetLooping(true);
+    head.SetActive(true);
+    head.SetDirection(Direction::FORWARD);
+    head.SetRate(rate);
+    head.SetIndex(3800000);
+
+    float error{};
+    for (int32_t i = 1; i <= updates; i++)
+    {
+        head.UpdatePosition();
+        double position = std::fmod(3800000 + static_cast<double>(rate) * i, period);
+        if (position < period - 1)
+        {
+            error = std::max(error, static_cast<float>(std::fabs(head.Read() - position)));
+        }
+    }
+
+    std::cout << "Phase precision: max error " << error << " samples after " << updates << " updates\n";
+    assert(error < 1e-3f);
+}
+
+void TestFaderCurves()
+{
+    constexpr size_t samples = 4800;
+    constexpr int32_t runs = 200;
+    static float from[samples];
+    static float to[samples];
+    static float out[samples];
+    static float reference[samples];
+    for (size_t i = 0; i < samples; i++)
+    {
+        from[i] = Sine(1.f / 480, i);
+        to[i] = Sine(1.f / 733, i);
+    }
+
+    struct Scenario
+    {
+        std::string desc{};
+        Fader::FadeCurve curve{};
+        bool sine{}; // Whether the curve is the one of CrossFade()
+        float maxError{};
+    };
+
+    static Scenario scenarios[] =
+    {
+        { "polynomial", Fader::FadeCurve::POLYNOMIAL, false, 1e-6f },
+        { "table", Fader::FadeCurve::TABLE, false, 1e-4f },
+        { "incremental", Fader::FadeCurve::INCREMENTAL, true, 2e-4f },
+    };
+
+    std::cout << "\n";
+
+    for (Scenario scenario : scenarios)
+    {
+        for (size_t i = 0; i < samples; i++)
+        {
+            float pos = static_cast<float>(i) / samples;
+            reference[i] = scenario.sine ? Fader::CrossFade(from[i], to[i], pos) : Fader::EqualCrossFade(from[i], to[i], pos);
+        }
+
+        Fader fader;
+        std::clock_t start = std::clock();
+        for (int32_t run = 0; run < runs; run++)
+        {
+            fader.SetCurve(scenario.curve);
+            fader.Init(Fader::FadeType::FADE_SINGLE, samples, 1.f);
+            fader.ProcessBlock(from, to, out, samples);
+        }
+        double ns = (std::clock() - start) * 1e9 / CLOCKS_PER_SEC / (runs * samples);
+
+        float error{};
+        for (size_t i = 0; i < samples; i++)
+        {
+            error = std::max(error, std::fabs(out[i] - reference[i]));
+        }
+
+        std::cout << "Fader curve " << scenario.desc << ": " << ns << " ns/sample, max error " << error << "\n";
+        assert(error <= scenario.maxError);
+    }
+}
+
+void TestSampleFormat()
+{
+    // Storing what was loaded gives back the same sample, and a store
+    // rounds to the nearest step, without a bias.
+    for (int32_t sample = -32767; sample <= 32767; sample++)
+    {
+        assert(SampleFormat<int16_t>::Store(SampleFormat<int16_t>::Load(sample)) == sample);
+    }
+    double bias{};
+    float error{};
+    constexpr int32_t values = 100000;
+    for (int32_t i = 0; i < values; i++)
+    {
+        float value = Sine(1.f / 997, i) * 0.9f;
+        float stored = SampleFormat<int16_t>::Load(SampleFormat<int16_t>::Store(value));
+        error = std::max(error, std::fabs(stored - value));
+        bias += stored - value;
+    }
+    assert(error <= 0.5f / 32767 + 1e-7f && std::fabs(bias / values) < 1e-6);
+
+    std::cout << "Sample format: 16 bit max error " << error << ", bias " << bias / values << "\n";
+}
+
+void TestCommandQueue()
+{
+    constexpr size_t size = 8;
+    CommandQueue<int32_t, size> queue;
+    int32_t item{};
+    assert(queue.IsEmpty());
+    assert(!queue.Pop(item));
+    assert(!queue.Peek(item));
+
+    // Fill it up and drain it several times, so that the indices wrap
+    // around: the items come out in the order they went in.
+    int32_t pushed{};
+    int32_t popped{};
+    for (int32_t round = 0; round < 5; round++)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            assert(queue.Push(pushed++));
+        }
+        assert(!queue.Push(-1));
+        assert(queue.Peek(item) && item == popped);
+        while (queue.Pop(item))
+        {
+            assert(item == popped++);
+        }
+        assert(queue.IsEmpty());
+        assert(!queue.Pop(item));
+
+        // Move the indices on, so that the next round starts elsewhere in
+        // the ring.
+        for (size_t i = 0; i < size / 2 + round % 3; i++)
+        {
+            assert(queue.Push(pushed++));
+        }
+        for (size_t i = 0; i < size / 2 + round % 3; i++)
+        {
+            assert(queue.Pop(item) && item == popped++);
+        }
+    }
+    assert(pushed == popped);
+
+    std::cout << "\nCommand queue: " << pushed << " items through a queue of " << size << "\n";
+}
+
+void TestTelemetry()
+{
+    struct Snapshot
+    {
+        uint32_t values[16];
+    };
+
+    Seqlock<Snapshot> seqlock;
+    for (uint32_t count = 1; count <= 1000; count++)
+    {
+        Snapshot snapshot;
+        std::fill(snapshot.values, snapshot.values + 16, count);
+        seqlock.Write(snapshot);
+
+        Snapshot read{};
+        assert(seqlock.TryRead(read));
+        assert(std::count(read.values, read.values + 16, count) == 16);
+        assert(seqlock.GetCount() == count);
+    }
+
+    // The load of a block whose cycles times the sample rate doesn't fit in
+    // 32 bit.
+    uint32_t cycles = static_cast<uint32_t>(0.25f * 48 * kCounterFrequency / 48000);
+    assert(static_cast<uint64_t>(cycles) * 48000 > UINT32_MAX);
+    assert(std::abs(Profiler::Load(cycles, 48, 48000) - 0.25f) < 1e-4f);
+    assert(std::abs(Profiler::Load(cycles / 2, 48, 48000) - 0.125f) < 1e-4f);
+
+    std::cout << "\nTelemetry: " << seqlock.GetCount() << " snapshots published and read back\n";
+}
+
+void TestPeaks()
+{
+    constexpr int32_t samples = 100000;
+    constexpr int32_t pixels = 128;
+    static float wave[samples];
+    static PeakIndex::Bucket buckets[PeakIndex::CountBuckets(samples)];
+    PeakIndex index;
+    index.Init(buckets, samples);
+    auto read = [](int32_t i) { return wave[i]; };
+
+    // Write twice, the second pass must replace the peaks of the first.
+    for (int32_t pass = 0; pass < 2; pass++)
+    {
+        for (int32_t i = 0; i < samples; i++)
+        {
+            wave[i] = Sine(1.f / (pass ? 997 : 331), i) * (pass ? 0.5f : 1.f) * i / samples;
+            index.Add(i, wave[i]);
+        }
+        index.Publish();
+    }
+
+    // Loops long and short, and inverted ones wrapping around the end.
+    float windows[][2]{{0, samples}, {20000, 60000}, {70000, 50000}, {1234, 5000}, {99000, 900}};
+    PeakIndex::Peak peaks[pixels];
+    float error{};
+    for (auto &window : windows)
+    {
+        index.GetPeaks(window[0], window[1], samples, peaks, pixels, read);
+        float samplesPerPixel = window[1] / pixels;
+        for (int32_t pixel = 0; pixel < pixels; pixel++)
+        {
+            // The peaks cover at least the pixel's samples, and no more than
+            // the buckets around it.
+            int32_t from = window[0] + pixel * samplesPerPixel;
+            int32_t to = std::max(static_cast<int32_t>(window[0] + (pixel + 1) * samplesPerPixel), from + 1);
+            float min{wave[from % samples]};
+            float max{min};
+            for (int32_t i = from; i < to; i++)
+            {
+                min = std::min(min, wave[i % samples]);
+                max = std::max(max, wave[i % samples]);
+            }
+            error = std::max(error, std::max(peaks[pixel].min - min, max - peaks[pixel].max));
+            assert(peaks[pixel].min >= -0.5f && peaks[pixel].max <= 0.5f);
+        }
+    }
+    assert(error <= 1.f / 32768);
+
+    index.Clear();
+    index.GetPeaks(0, samples, samples, peaks, pixels, read);
+    assert(std::all_of(peaks, peaks + pixels, [](const PeakIndex::Peak &peak) { return 0 == peak.min && 0 == peak.max; }));
+
+    std::cout << "Peaks: " << sizeof(buckets) << " bytes for " << samples << " samples, max error " << error << "\n";
+}
+
+void TestUndo()
+{
+    constexpr int32_t samples = 10000;
+    constexpr int32_t poolSamples = 2 * 10240; // Room for two whole takes
+    static float wave[samples];
+    static float pool[poolSamples];
+    static UndoHistory<float>::Record records[poolSamples >> kMinUndoPageShift];
+    BufferEraser<float> eraser;
+    eraser.Init(wave, samples);
+    FreezeBuffer<float> freezeBuffer;
+    freezeBuffer.Init(wave, &eraser, nullptr, 0);
+
+    auto write = [&](UndoHistory<float> &undo, int32_t to, float value)
+    {
+        for (int32_t i = 0; i < to; i++)
+        {
+            undo.Preserve(i);
+            wave[i] = value;
+        }
+    };
+    auto check = [&](int32_t from, int32_t to, float value)
+    {
+        return std::all_of(wave + from, wave + to, [value](float sample) { return sample == value; });
+    };
+    auto restore = [](UndoHistory<float> &undo)
+    {
+        int32_t blocks{};
+        while (undo.IsRestoring())
+        {
+            undo.Restore(48, [](int32_t, int32_t) {});
+            blocks++;
+        }
+        return blocks;
+    };
+
+    // Two takes, the second one over the first half only.
+    UndoHistory<float> undo;
+    undo.Init(wave, &eraser, &freezeBuffer, samples, pool, records, UndoHistory<float>::CountPages(poolSamples, samples));
+    std::fill(wave, wave + samples, 0.f);
+    write(undo, samples, 1.f);
+    write(undo, samples / 2, 2.f);
+    assert(undo.Undo());
+    int32_t blocks = restore(undo);
+    assert(check(0, samples, 1.f));
+    assert(undo.Undo());
+    restore(undo);
+    assert(check(0, samples, 0.f));
+    assert(!undo.CanUndo() && undo.Redo());
+    restore(undo);
+    assert(undo.Redo());
+    restore(undo);
+    assert(check(0, samples / 2, 2.f) && check(samples / 2, samples, 1.f));
+
+    // With room for three quarters of a take, the oldest ones are evicted.
+    undo.Init(wave, &eraser, &freezeBuffer, samples, pool, records, UndoHistory<float>::CountPages(poolSamples, samples) * 3 / 8);
+    std::fill(wave, wave + samples, 0.f);
+    write(undo, samples / 2, 1.f);
+    write(undo, samples / 2, 2.f);
+    write(undo, samples / 2, 3.f);
+    assert(undo.Undo());
+    restore(undo);
+    assert(check(0, samples / 2, 2.f) && !undo.CanUndo());
+
+    std::cout << "Undo: a take of " << samples / 2 << " samples restored in " << blocks << " blocks\n";
+}
+
+void TestGrains()
+{
+    constexpr int32_t samples = 10000;
+    constexpr int32_t voices = 8;
+    constexpr int32_t blockSize = 48;
+    static float wave[samples];
+    std::fill(wave, wave + samples, 0.5f);
+    BufferEraser<float> eraser;
+    eraser.Init(wave, samples);
+    FreezeBuffer<float> freezeBuffer;
+    freezeBuffer.Init(wave, &eraser, nullptr, 0);
+    Head<float> head{Type::READ};
+    head.Init(wave, &freezeBuffer, &eraser, samples, 0);
+    head.InitBuffer(samples);
+    Random random;
+    GrainCloud<float> grains;
+    grains.Init(48000, &random);
+    grains.SetVoices(voices);
+    grains.SetSize(480);
+    grains.SetSpread(1.f);
+
+    // Far more grains than the voices, the spawns per block are bounded and
+    // the voices are stolen without going beyond them.
+    grains.SetDensity(48000);
+    float max{};
+    for (int32_t block = 0; block < 200; block++)
+    {
+        int32_t active = grains.GetActive();
+        grains.Schedule(blockSize, block * 7.3f, 1.3f, block % 2 ? FORWARD : BACKWARDS, 0, samples, samples);
+        assert(grains.GetActive() - active <= kMaxGrainSpawns && grains.GetActive() <= voices);
+        for (int32_t i = 0; i < blockSize; i++)
+        {
+            max = std::max(max, std::fabs(grains.Process(head)));
+        }
+    }
+    assert(max > 0 && max <= 0.5f * std::sqrt(static_cast<float>(voices)));
+
+    // Turned off, the grains playing end within their length.
+    grains.SetDensity(0);
+    for (int32_t block = 0; block < 480 / blockSize + 1; block++)
+    {
+        grains.Schedule(blockSize, 0, 1.3f, FORWARD, 0, samples, samples);
+        for (int32_t i = 0; i < blockSize; i++)
+        {
+            grains.Process(head);
+        }
+    }
+    assert(!grains.GetActive());
+
+    std::cout << "Grains: " << voices << " voices, peak " << max << "\n";
+}
+
+void TestHotLoop()
+{
+    constexpr int32_t samples = 10000;
+    static float wave[samples];
+    for (int32_t i = 0; i < samples; i++)
+    {
+        wave[i] = static_cast<float>(i);
+    }
+    auto check = [](HotLoop<float> &hot, int32_t from, int32_t to)
+    {
+        for (int32_t i = from; i < to; i++)
+        {
+            if (!hot.Contains(i) || hot.Get(i) != wave[i])
+            {
+                return false;
+            }
+        }
+
+        return !hot.Contains(from - 1) && !hot.Contains(to);
+    };
+
+    // A loop that moves keeps the samples already mirrored, and the writes
+    // are mirrored too.
+    static HotLoop<float> hot;
+    hot.Track(wave, 1, 1000, 2999, samples);
+    assert(check(hot, 1000 - kHotLoopMargin, 3000 + kHotLoopMargin));
+    wave[2000] = -1.f;
+    hot.Refresh(2000, wave[2000]);
+    hot.Track(wave, 1, 1500, 4999, samples);
+    assert(check(hot, 1500 - kHotLoopMargin, 5000 + kHotLoopMargin));
+
+    // Long and inverted loops are not mirrored.
+    hot.Track(wave, 1, 0, kHotLoopSamples, samples);
+    assert(!hot.IsActive());
+    hot.Track(wave, 1, 9000, 500, samples);
+    assert(!hot.IsActive());
+
+    std::cout << "Hot loop: " << kHotLoopSamples << " samples mirrored at most\n";
+}
+
+void TestMultiLooper()
+{
+    constexpr int32_t tracks = 4;
+    constexpr size_t blockSize = 48;
+    constexpr int32_t bufferSamples = 4800;
+    MultiLooper<tracks>::Conf conf{tracks, Movement::NORMAL, Direction::FORWARD};
+    conf.bufferSeconds = bufferSamples / 48000.f;
+    constexpr size_t memoryBytes = 2 * tracks * bufferSamples * sizeof(BufferSample) + 2 * tracks * kArenaAlignment;
+    static uint8_t memory[2][memoryBytes + kArenaAlignment];
+
+    // One looper processes the blocks, the other one the single frames, and
+    // both must give the same output.
+    static MultiLooper<tracks> loopers[2];
+    for (int i = 0; i < 2; i++)
+    {
+        Arena arena;
+        arena.Init(memory[i] + kArenaAlignment - reinterpret_cast<uintptr_t>(memory[i]) % kArenaAlignment, memoryBytes);
+        assert(loopers[i].Init(48000, conf, arena));
+        assert(loopers[i].GetTracks() == tracks);
+        assert(loopers[i].IsBuffering());
+        for (int32_t track = 0; track < tracks; track++)
+        {
+            loopers[i].feedback[track] = 1.f;
+            loopers[i].dryLevel[track] = 0.f;
+        }
+    }
+
+    float in[tracks][blockSize];
+    float out[tracks][blockSize];
+    const float *inputs[tracks];
+    float *outputs[tracks];
+    double sums[tracks]{};
+    int32_t frames{};
+    auto run = [&](int32_t samples, bool silence)
+    {
+        for (int32_t done = 0; done < samples; done += blockSize, frames += blockSize)
+        {
+            for (int32_t track = 0; track < tracks; track++)
+            {
+                for (size_t i = 0; i < blockSize; i++)
+                {
+                    // Each track gets its own frequency.
+                    in[track][i] = silence ? 0.f : 0.5f * std::sin((frames + i) * 2 * pi() / (50 + 25 * track));
+                }
+                inputs[track] = in[track];
+                outputs[track] = out[track];
+            }
+            loopers[0].ProcessBlock(inputs, outputs, blockSize);
+            for (size_t i = 0; i < blockSize; i++)
+            {
+                float frameIn[tracks];
+                float frameOut[tracks];
+                for (int32_t track = 0; track < tracks; track++)
+                {
+                    frameIn[track] = in[track][i];
+                }
+                loopers[1].Process(frameIn, frameOut);
+                for (int32_t track = 0; track < tracks; track++)
+                {
+                    assert(frameOut[track] == out[track][i]);
+                    sums[track] += out[track][i] * out[track][i];
+                }
+            }
+        }
+    };
+
+    // Buffer, then play the loops back with no input.
+    run(2400, false);
+    for (MultiLooper<tracks> &multiLooper : loopers)
+    {
+        assert(multiLooper.IsBuffering());
+        multiLooper.StopBuffering();
+    }
+    run(blockSize, true);
+    for (MultiLooper<tracks> &multiLooper : loopers)
+    {
+        assert(multiLooper.IsReady());
+        multiLooper.Start();
+    }
+    std::fill(sums, sums + tracks, 0.);
+    run(4800, true);
+    assert(loopers[0].IsRunning() && loopers[1].IsRunning());
+    for (int32_t track = 0; track < tracks; track++)
+    {
+        assert(loopers[0].GetTrack(track).GetBufferSamples() == loopers[1].GetTrack(track).GetBufferSamples());
+        assert(std::sqrt(sums[track] / 4800) > 0.1);
+    }
+
+    std::cout << "Multi looper: " << tracks << " tracks, " << loopers[0].GetTrack(0).GetBufferSamples() << " samples loops\n";
+}
+
+void TestBlockProcessing()
+{
+    constexpr size_t blockSize = 48;
+    StereoLooper::Conf conf{};
+    conf.rate = 1.f;
+    conf.bufferSeconds = 0.1f;
+    conf.startupSeconds = 0.f;
+    constexpr size_t memoryBytes = 4 * (4800 + 1) * sizeof(BufferSample) + 4 * kArenaAlignment;
+    static uint8_t memory[2][memoryBytes + kArenaAlignment];
+
+    for (StereoLooper::Mode mode : {StereoLooper::Mode::MONO, StereoLooper::Mode::CROSS, StereoLooper::Mode::DUAL})
+    {
+        // One looper processes the blocks, the other one the single samples,
+        // and both must give the same output.
+        conf.mode = mode;
+        std::unique_ptr<StereoLooper> loopers[2]{std::unique_ptr<StereoLooper>(new StereoLooper()), std::unique_ptr<StereoLooper>(new StereoLooper())};
+        for (int i = 0; i < 2; i++)
+        {
+            Arena arena;
+            arena.Init(memory[i] + kArenaAlignment - reinterpret_cast<uintptr_t>(memory[i]) % kArenaAlignment, memoryBytes);
+            assert(loopers[i]->Init(48000, conf, arena));
+            loopers[i]->dryWetMix = 1.f;
+        }
+
+        float inL[blockSize];
+        float inR[blockSize];
+        float outL[blockSize];
+        float outR[blockSize];
+        int64_t frames{};
+        double sum{};
+        auto run = [&](int32_t samples, bool silence)
+        {
+            for (int32_t done = 0; done < samples; done += blockSize, frames += blockSize)
+            {
+                for (size_t i = 0; i < blockSize; i++)
+                {
+                    inL[i] = silence ? 0.f : 0.5f * std::sin((frames + i) * 2 * pi() / 100);
+                    inR[i] = silence ? 0.f : 0.5f * std::sin((frames + i) * 2 * pi() / 75);
+                }
+                loopers[0]->ProcessBlock(inL, inR, outL, outR, blockSize);
+                for (size_t i = 0; i < blockSize; i++)
+                {
+                    // Process() leaves the output alone during startup.
+                    float left{};
+                    float right{};
+                    loopers[1]->Process(inL[i], inR[i], left, right);
+                    assert(left == outL[i] && right == outR[i]);
+                    sum += left * left;
+                }
+            }
+        };
+        // The same change to both loopers, in between blocks.
+        auto change = [&](auto &&apply)
+        {
+            for (std::unique_ptr<StereoLooper> &stereoLooper : loopers)
+            {
+                apply(*stereoLooper);
+            }
+        };
+
+        run(2400, false);
+        change([](StereoLooper &l) { l.StopBuffering(); });
+        run(blockSize, true);
+        change([](StereoLooper &l) { l.Start(); });
+        run(2400, false);
+        change([](StereoLooper &l) { l.feedback = 0.8f; });
+        run(2400, false);
+        change([](StereoLooper &l) { l.SetFreeze(StereoLooper::BOTH, 1.f); });
+        run(2400, false);
+        change([](StereoLooper &l)
+               {
+                   l.SetMovement(StereoLooper::LEFT, Movement::PENDULUM);
+                   l.SetDirection(StereoLooper::RIGHT, Direction::BACKWARDS);
+                   l.SetReadRate(StereoLooper::BOTH, 1.5f);
+               });
+        run(2400, true);
+
+        // Commands for frames inside the next blocks, which are split there.
+        change([frames](StereoLooper &l)
+               {
+                   l.SendAt({StereoLooper::Command::SET_FREEZE, StereoLooper::BOTH, 0.f}, frames + 17);
+                   l.SendAt({StereoLooper::Command::RETRIGGER, StereoLooper::BOTH, 0.f}, frames + blockSize + 5);
+               });
+        sum = 0;
+        run(2400, false);
+        assert(std::sqrt(sum / 2400) > 0.01);
+    }
+
+    std::cout << "Block processing: same output as sample by sample in " << StereoLooper::Mode::LAST_MODE << " modes\n";
+}
+
+// A storage for the persistence in memory, the transfers complete at once.
+struct MemoryStorage
+{
+    static constexpr size_t kBytes{kPersistenceHeaderBytes + 48000 * 4};
+    uint8_t data[kBytes]{};
+
+    bool Busy() { return false; }
+
+    bool Write(uint32_t offset, const void *source, size_t size)
+    {
+        if (offset + size > kBytes)
+        {
+            return false;
+        }
+        std::memcpy(data + offset, source, size);
+
+        return true;
+    }
+
+    bool Read(uint32_t offset, void *destination, size_t size)
+    {
+        if (offset + size > kBytes)
+        {
+            return false;
+        }
+        std::memcpy(destination, data + offset, size);
+
+        return true;
+    }
+};
+
+// Runs the given looper for the given number of samples of a sine wave, or of
+// silence, and returns the RMS of the left output.
+float Run(StereoLooper &stereoLooper, int32_t samples, bool silence)
+{
+    constexpr size_t blockSize = 48;
+    float in[blockSize];
+    float outL[blockSize];
+    float outR[blockSize];
+    double sum{};
+    for (int32_t done = 0; done < samples; done += blockSize)
+    {
+        for (size_t i = 0; i < blockSize; i++)
+        {
+            in[i] = silence ? 0.f : 0.5f * std::sin((done + i) * 2 * pi() / 100);
+        }
+        stereoLooper.ProcessBlock(in, in, outL, outR, blockSize);
+        for (size_t i = 0; i < blockSize; i++)
+        {
+            sum += outL[i] * outL[i];
+        }
+    }
+
+    return std::sqrt(sum / samples);
+}
+
+void TestParameters()
+{
+    StereoLooper::Conf conf{};
+    conf.mode = StereoLooper::Mode::DUAL;
+    conf.rate = 1.f;
+    conf.bufferSeconds = 1.f;
+    conf.startupSeconds = 0.f;
+    constexpr size_t memoryBytes = 4 * (48000 + 1) * sizeof(BufferSample) + 4 * kArenaAlignment;
+    static uint8_t memory[memoryBytes + kArenaAlignment];
+    Arena arena;
+    arena.Init(memory + kArenaAlignment - reinterpret_cast<uintptr_t>(memory) % kArenaAlignment, memoryBytes);
+    std::unique_ptr<StereoLooper> stereoLooper{new StereoLooper()};
+    assert(stereoLooper->Init(48000, conf, arena));
+    Run(*stereoLooper, 20000, false);
+    stereoLooper->StopBuffering();
+    Run(*stereoLooper, 48, true);
+    stereoLooper->Start();
+    Run(*stereoLooper, 48, true);
+
+    // Far more changes than the command queue holds between two blocks: the
+    // latest value of each channel is the one taken.
+    for (int32_t i = 0; i < 1000; i++)
+    {
+        stereoLooper->SetLoopLength(StereoLooper::BOTH, 5000.f + i);
+    }
+    stereoLooper->SetLoopLength(StereoLooper::RIGHT, 3000.f);
+    Run(*stereoLooper, 48, true);
+    assert(stereoLooper->GetLoopLength(StereoLooper::LEFT) == 5999.f);
+    assert(stereoLooper->GetLoopLength(StereoLooper::RIGHT) == 3000.f);
+
+    // More commands for later frames than can be scheduled: the ones left
+    // over wait in the queue, none is handled before its frame.
+    constexpr int32_t commands = 40;
+    float filterValue = stereoLooper->GetFilterValue();
+    int64_t frame = stereoLooper->GetTelemetry().frame;
+    for (int32_t k = 0; k < commands; k++)
+    {
+        assert(stereoLooper->SendAt({StereoLooper::Command::SET_FILTER_VALUE, StereoLooper::BOTH, 1000.f + k}, frame + 100 + 10 * k));
+    }
+    for (int32_t block = 0; block < 20; block++)
+    {
+        Run(*stereoLooper, 48, true);
+        int64_t last = stereoLooper->GetTelemetry().frame - 1;
+        int64_t due = last < frame + 100 ? 0 : std::min<int64_t>((last - frame - 100) / 10 + 1, commands);
+        assert(stereoLooper->GetFilterValue() == (due ? 1000.f + due - 1 : filterValue));
+    }
+
+    std::cout << "Parameters: latest loop lengths " << stereoLooper->GetLoopLength(StereoLooper::LEFT) << " and " << stereoLooper->GetLoopLength(StereoLooper::RIGHT) << "\n";
+}
+
+void TestPersistence()
+{
+    StereoLooper::Conf conf{};
+    conf.mode = StereoLooper::Mode::DUAL;
+    conf.rate = 1.f;
+    conf.bufferSeconds = 1.f;
+    conf.startupSeconds = 0.f;
+    constexpr size_t memoryBytes = 4 * (48000 + 1) * sizeof(BufferSample) + 4 * kArenaAlignment;
+    static uint8_t memory[memoryBytes + kArenaAlignment];
+    static MemoryStorage storage;
+    static BufferSample saved[2][48000];
+    auto init = [&conf](StereoLooper &stereoLooper)
+    {
+        Arena arena;
+        arena.Init(memory + kArenaAlignment - reinterpret_cast<uintptr_t>(memory) % kArenaAlignment, memoryBytes);
+        assert(stereoLooper.Init(48000, conf, arena));
+        stereoLooper.dryWetMix = 1.f;
+        stereoLooper.feedback = 1.f;
+        stereoLooper.filterLevel = 0.f;
+    };
+
+    // The short loop is the one mirrored in internal memory, the long one
+    // takes several chunks to restore.
+    for (int32_t loopSamples : {300, 20000})
+    {
+        // Record a loop and save it.
+        std::unique_ptr<StereoLooper> stereoLooper{new StereoLooper()};
+        init(*stereoLooper);
+        Run(*stereoLooper, loopSamples, false);
+        stereoLooper->StopBuffering();
+        Run(*stereoLooper, 48, true);
+        stereoLooper->Start();
+        float rms = Run(*stereoLooper, 4800, true);
+        assert(rms > 0.1f);
+
+        Persistence<MemoryStorage> persistence;
+        persistence.Init(&storage, stereoLooper.get(), 48000);
+        assert(persistence.Save());
+        while (persistence.IsBusy())
+        {
+            persistence.Update();
+        }
+        assert(!persistence.HasFailed());
+        int32_t bufferSamples = stereoLooper->GetBufferSamples(StereoLooper::LEFT);
+        int32_t stride = stereoLooper->GetBufferStride();
+        for (int channel = StereoLooper::LEFT; channel <= StereoLooper::RIGHT; channel++)
+        {
+            for (int32_t i = 0; i < bufferSamples; i++)
+            {
+                saved[channel][i] = stereoLooper->GetBuffer(channel)[i * stride];
+            }
+        }
+
+        // It's not restored at another sample rate, nor in another mode.
+        stereoLooper.reset(new StereoLooper());
+        init(*stereoLooper);
+        persistence.Init(&storage, stereoLooper.get(), 44100);
+        assert(!persistence.Restore());
+        conf.mode = StereoLooper::Mode::MONO;
+        stereoLooper.reset(new StereoLooper());
+        init(*stereoLooper);
+        persistence.Init(&storage, stereoLooper.get(), 48000);
+        assert(!persistence.Restore());
+        conf.mode = StereoLooper::Mode::DUAL;
+
+        // Restore it in a new looper, over a cleared memory.
+        std::memset(memory, 0, sizeof(memory));
+        stereoLooper.reset(new StereoLooper());
+        init(*stereoLooper);
+        persistence.Init(&storage, stereoLooper.get(), 48000);
+        assert(persistence.Restore());
+        while (persistence.IsBusy())
+        {
+            Run(*stereoLooper, 48, true);
+            persistence.Update();
+        }
+        assert(!persistence.HasFailed());
+        assert(stereoLooper->GetBufferSamples(StereoLooper::LEFT) == bufferSamples);
+        for (int channel = StereoLooper::LEFT; channel <= StereoLooper::RIGHT; channel++)
+        {
+            for (int32_t i = 0; i < bufferSamples; i++)
+            {
+                float error = SampleFormat<BufferSample>::Load(stereoLooper->GetBuffer(channel)[i * stride]) - SampleFormat<BufferSample>::Load(saved[channel][i]);
+                assert(std::abs(error) <= 1.f / 32767);
+            }
+        }
+
+        // The loop is heard right away, the heads don't read stale copies of
+        // the buffer.
+        float restored = Run(*stereoLooper, 480, true);
+        assert(restored > 0.1f * rms);
+
+        std::cout << "Persistence: " << bufferSamples << " samples restored, RMS " << restored << "\n";
+    }
+}
+
 int main()
 {
     looper.Init(48000, buffer, buffer2, 48000);
@@ -452,6 +1258,19 @@ int main()
     //TestLeds();
     //TestCrossPoint();
     TestHeadsDistance();
+    TestFaderCurves();
+    TestPhasePrecision();
+    TestSampleFormat();
+    TestCommandQueue();
+    TestTelemetry();
+    TestPeaks();
+    TestUndo();
+    TestGrains();
+    TestHotLoop();
+    TestMultiLooper();
+    TestBlockProcessing();
+    TestParameters();
+    TestPersistence();
 
     return 0;
 }
@@ -0,0 +1,358 @@
+#pragma once
+
+#include "buffer_eraser.h"
+#include "freeze_buffer.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace wreath
+{
+    constexpr int32_t kMaxUndoPages{4096};
+    constexpr int32_t kMinUndoPageShift{8}; // 256 samples
+    constexpr int32_t kUndoCopyFactor{32};  // Samples restored per sample processed
+
+    /**
+     * @brief The undo and redo history of the overdubs. Each pass of the
+     * writing head over the loop is a take, and before a page of the buffer
+     * is written for the first time in a take, its content is saved in a
+     * page of a pool. So only the regions touched by a take are kept, not a
+     * copy of the whole buffer. A take ends when the writing head comes back
+     * to a page it has already written in it, that is at each lap.
+     *
+     * The pool is a ring of fixed-size pages carved from the SDRAM arena,
+     * handed out in order and given back from the oldest: when it runs out,
+     * the oldest take is evicted as a whole. Undoing a take swaps its pages
+     * with the buffer, so that they hold what's needed to redo it. The swap
+     * is made a bounded amount per block, like the buffer erasing, and the
+     * writes in the meantime are not recorded. A new take discards the
+     * takes that have been undone.
+     * @author Roberto Noris
+     * @date Oct 2026
+     */
+    template <typename T>
+    class UndoHistory
+    {
+    public:
+        UndoHistory() {}
+        ~UndoHistory() {}
+
+        /**
+         * @brief The buffer page held by a page of the pool, and the take it
+         * belongs to.
+         */
+        struct Record
+        {
+            int32_t page;
+            uint32_t take;
+        };
+
+        /**
+         * @brief Returns the shift of the pages for a buffer of the given
+         * length, so that the buffer has at most kMaxUndoPages.
+         *
+         * @param maxSamples
+         * @return int32_t
+         */
+        static constexpr int32_t PageShift(int32_t maxSamples)
+        {
+            int32_t shift{kMinUndoPageShift};
+            while (maxSamples > 0 && ((maxSamples - 1) >> shift) + 1 > kMaxUndoPages)
+            {
+                shift++;
+            }
+
+            return shift;
+        }
+
+        /**
+         * @brief Returns how many pages of the pool fit in the given number
+         * of samples, one record is needed for each.
+         *
+         * @param poolSamples
+         * @param maxSamples The whole buffer length
+         * @return int32_t
+         */
+        static constexpr int32_t CountPages(int32_t poolSamples, int32_t maxSamples)
+        {
+            return poolSamples > 0 ? poolSamples >> PageShift(maxSamples) : 0;
+        }
+
+        /**
+         * @brief Initializes the history. Without a pool there's no history.
+         *
+         * @param buffer The looper buffer
+         * @param eraser The looper buffer's eraser
+         * @param freezeBuffer The looper freeze buffer, restoring preserves the
+         * snapshot like writing does
+         * @param maxSamples The whole buffer length
+         * @param pool The pages memory
+         * @param records The records of the pages, CountPages() of them
+         * @param pages CountPages() of the pool
+         * @param stride The distance between two consecutive samples in the
+         * buffer
+         */
+        void Init(T *buffer, BufferEraser<T> *eraser, FreezeBuffer<T> *freezeBuffer, int32_t maxSamples, T *pool, Record *records, int32_t pages, int32_t stride = 1)
+        {
+            buffer_ = buffer;
+            eraser_ = eraser;
+            freezeBuffer_ = freezeBuffer;
+            maxSamples_ = maxSamples;
+            pool_ = pool;
+            records_ = records;
+            stride_ = stride;
+            pageShift_ = PageShift(maxSamples);
+            capacity_ = pool && records ? pages : 0;
+            Clear();
+        }
+
+        /**
+         * @brief Forgets the whole history, for instance when the buffer is
+         * cleared.
+         */
+        void Clear()
+        {
+            oldest_ = 0;
+            applied_ = 0;
+            count_ = 0;
+            restoring_ = 0;
+            credit_ = 0;
+            take_++;
+            lastPage_ = -1;
+            overflow_ = false;
+            memset(touched_, 0, sizeof(touched_));
+        }
+
+        /**
+         * @brief Saves the page of the given index if it's the first time it
+         * is written in the current take. Call this before writing in the
+         * buffer.
+         *
+         * @param index
+         */
+        inline void Preserve(int32_t index)
+        {
+            int32_t page = index >> pageShift_;
+            if (page == lastPage_ || !capacity_ || restoring_)
+            {
+                return;
+            }
+            if (IsTouched(page))
+            {
+                // Back to a page already written, that's a new take.
+                NewTake();
+            }
+            lastPage_ = page;
+            touched_[page >> 5] |= 1u << (page & 31);
+            if (!overflow_)
+            {
+                Save(page);
+            }
+        }
+
+        /**
+         * @brief Starts undoing the last take.
+         *
+         * @return true
+         * @return false if there's nothing to undo, or a restore is running
+         */
+        bool Undo()
+        {
+            if (restoring_ || !applied_)
+            {
+                return false;
+            }
+
+            // The pages of the last take go back in the buffer.
+            uint32_t take = records_[Slot(applied_ - 1)].take;
+            int32_t first = applied_;
+            while (first > 0 && records_[Slot(first - 1)].take == take)
+            {
+                first--;
+            }
+            StartRestoring(first, applied_);
+            applied_ = first;
+
+            return true;
+        }
+
+        /**
+         * @brief Starts redoing the last take undone.
+         *
+         * @return true
+         * @return false if there's nothing to redo, or a restore is running
+         */
+        bool Redo()
+        {
+            if (restoring_ || applied_ >= count_)
+            {
+                return false;
+            }
+
+            uint32_t take = records_[Slot(applied_)].take;
+            int32_t last = applied_;
+            while (last < count_ && records_[Slot(last)].take == take)
+            {
+                last++;
+            }
+            StartRestoring(applied_, last);
+            applied_ = last;
+
+            return true;
+        }
+
+        /**
+         * @brief Swaps the next pages of the take being undone or redone, for
+         * the given number of processed samples. Call this once per block.
+         *
+         * @param samples
+         * @param restored void(int32_t from, int32_t to), called with the span
+         * of the buffer of each page restored
+         */
+        template <typename R>
+        void Restore(int32_t samples, R restored)
+        {
+            if (!restoring_)
+            {
+                return;
+            }
+
+            credit_ += samples * kUndoCopyFactor;
+            int32_t pageSamples = 1 << pageShift_;
+            while (credit_ >= pageSamples && restoring_)
+            {
+                int32_t from = records_[Slot(cursor_)].page << pageShift_;
+                int32_t to = std::min(from + pageSamples, maxSamples_);
+                Swap(Slot(cursor_), from, to);
+                restored(from, to);
+                credit_ -= pageSamples;
+                cursor_++;
+                restoring_--;
+            }
+            if (!restoring_)
+            {
+                // What's written from now on is a new take.
+                credit_ = 0;
+                NewTake();
+            }
+        }
+
+        inline bool IsRestoring() const { return restoring_ > 0; }
+        inline bool CanUndo() const { return capacity_ && !restoring_ && applied_ > 0; }
+        inline bool CanRedo() const { return capacity_ && !restoring_ && applied_ < count_; }
+
+    private:
+        T *buffer_{};
+        BufferEraser<T> *eraser_{};
+        FreezeBuffer<T> *freezeBuffer_{};
+        T *pool_{};
+        Record *records_{};
+        int32_t maxSamples_{}; // The whole buffer length
+        int32_t stride_{1};    // Distance between consecutive samples in the buffer
+        int32_t pageShift_{kMinUndoPageShift};
+        int32_t capacity_{}; // The pages in the pool
+        int32_t oldest_{};   // The slot of the oldest record
+        int32_t count_{};    // The records, from the oldest
+        int32_t applied_{};  // The records not undone, the others can be redone
+        int32_t cursor_{};   // The next record to be restored
+        int32_t restoring_{}; // The records left to be restored
+        int32_t credit_{};    // Samples that can be restored
+        uint32_t take_{};     // The current take
+        int32_t lastPage_{-1}; // The last page preserved
+        bool overflow_{};      // Whether the current take doesn't fit in the pool
+        uint32_t touched_[kMaxUndoPages / 32]{}; // The pages written in the current take
+
+        inline int32_t Slot(int32_t record) const
+        {
+            int32_t slot = oldest_ + record;
+
+            return slot >= capacity_ ? slot - capacity_ : slot;
+        }
+
+        inline bool IsTouched(int32_t page) const
+        {
+            return touched_[page >> 5] & (1u << (page & 31));
+        }
+
+        void NewTake()
+        {
+            take_++;
+            lastPage_ = -1;
+            overflow_ = false;
+            memset(touched_, 0, sizeof(touched_));
+        }
+
+        void StartRestoring(int32_t from, int32_t to)
+        {
+            cursor_ = from;
+            restoring_ = to - from;
+            credit_ = 0;
+        }
+
+        /**
+         * @brief Saves a page in the next page of the pool, evicting the
+         * oldest take if needed. The takes that have been undone are
+         * discarded first.
+         *
+         * @param page
+         */
+        void Save(int32_t page)
+        {
+            count_ = applied_;
+            if (count_ >= capacity_)
+            {
+                uint32_t oldest = records_[oldest_].take;
+                if (oldest == take_)
+                {
+                    // The take alone doesn't fit, it can't be undone.
+                    Drop();
+
+                    return;
+                }
+                while (count_ > 0 && records_[oldest_].take == oldest)
+                {
+                    oldest_ = oldest_ + 1 < capacity_ ? oldest_ + 1 : 0;
+                    count_--;
+                }
+            }
+
+            int32_t slot = Slot(count_);
+            records_[slot] = {page, take_};
+            T *saved = pool_ + (slot << pageShift_);
+            int32_t from = page << pageShift_;
+            int32_t to = std::min(from + (1 << pageShift_), maxSamples_);
+            for (int32_t i = from; i < to; i++)
+            {
+                *saved++ = eraser_->IsPending(i) ? T{} : buffer_[i * stride_];
+            }
+            count_++;
+            applied_ = count_;
+        }
+
+        /**
+         * @brief Drops the records of the current take.
+         */
+        void Drop()
+        {
+            while (count_ > 0 && records_[Slot(count_ - 1)].take == take_)
+            {
+                count_--;
+            }
+            applied_ = count_;
+            overflow_ = true;
+        }
+
+        void Swap(int32_t slot, int32_t from, int32_t to)
+        {
+            T *saved = pool_ + (slot << pageShift_);
+            for (int32_t i = from; i < to; i++, saved++)
+            {
+                freezeBuffer_->Preserve(i);
+                eraser_->Prepare(i);
+                T value = buffer_[i * stride_];
+                buffer_[i * stride_] = *saved;
+                *saved = value;
+            }
+        }
+    };
+} // namespace wreath